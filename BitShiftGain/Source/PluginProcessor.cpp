@@ -1,18 +1,33 @@
 #include "PluginProcessor.h"
 
+namespace BitShiftGain {
+
 AudioProcessor::AudioProcessor() :
     juce::AudioProcessor(BusesProperties().withInput ("Input",  juce::AudioChannelSet::stereo(), true)
                                           .withOutput("Output", juce::AudioChannelSet::stereo(), true))
 {
+    bitShiftParameter = apvts.getRawParameterValue("Bits");
+    ditherParameter = apvts.getRawParameterValue("Dither");
+
+    apvts.addParameterListener("Bits", this);
+    apvts.addParameterListener("Dither", this);
 }
 
 AudioProcessor::~AudioProcessor()
 {
+    apvts.removeParameterListener("Bits", this);
+    apvts.removeParameterListener("Dither", this);
 }
 
 void AudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
+    // Use the best instruction set that this CPU has, unless a test forced
+    // a lower one. See CpuDispatch.h.
+    isaLevel = CpuDispatch::select();
+
+    dither.prepare(getTotalNumOutputChannels());
     resetState();
+    update();
 }
 
 void AudioProcessor::releaseResources()
@@ -26,55 +41,46 @@ void AudioProcessor::reset()
 
 bool AudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
 {
-    return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo();
+    // Any number of channels is fine, as long as the input and output match.
+    auto mainOutput = layouts.getMainOutputChannelSet();
+    return !mainOutput.isDisabled() && mainOutput == layouts.getMainInputChannelSet();
 }
 
 void AudioProcessor::resetState()
 {
-    gain = 1.0f;
+    kernel.reset();
+    dither.reset();
+    numOverflows = 0;
+    numUnderflows = 0;
+}
+
+void AudioProcessor::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    parametersChanged.store(true);
 }
 
 void AudioProcessor::update()
 {
-    int bits = apvts.getRawParameterValue("BitShift")->load();
-    switch (bits) {
-        case -16: gain = 0.0000152587890625; break;
-        case -15: gain = 0.000030517578125; break;
-        case -14: gain = 0.00006103515625; break;
-        case -13: gain = 0.0001220703125; break;
-        case -12: gain = 0.000244140625; break;
-        case -11: gain = 0.00048828125; break;
-        case -10: gain = 0.0009765625; break;
-        case -9: gain = 0.001953125; break;
-        case -8: gain = 0.00390625; break;
-        case -7: gain = 0.0078125; break;
-        case -6: gain = 0.015625; break;
-        case -5: gain = 0.03125; break;
-        case -4: gain = 0.0625; break;
-        case -3: gain = 0.125; break;
-        case -2: gain = 0.25; break;
-        case -1: gain = 0.5; break;
-        case 0: gain = 1.0; break;
-        case 1: gain = 2.0; break;
-        case 2: gain = 4.0; break;
-        case 3: gain = 8.0; break;
-        case 4: gain = 16.0; break;
-        case 5: gain = 32.0; break;
-        case 6: gain = 64.0; break;
-        case 7: gain = 128.0; break;
-        case 8: gain = 256.0; break;
-        case 9: gain = 512.0; break;
-        case 10: gain = 1024.0; break;
-        case 11: gain = 2048.0; break;
-        case 12: gain = 4096.0; break;
-        case 13: gain = 8192.0; break;
-        case 14: gain = 16384.0; break;
-        case 15: gain = 32768.0; break;
-        case 16: gain = 65536.0; break;
-    }
+    bits = int(bitShiftParameter->load());
+    kernel.bits = bits;
+
+    // Not in the original plug-in, which is all about not adding any noise,
+    // but the other plug-ins have it too.
+    dithering = ditherParameter->load();
 }
 
 void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+void AudioProcessor::processBlock(juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+template<typename SampleType>
+void AudioProcessor::process(juce::AudioBuffer<SampleType>& buffer)
 {
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels = getTotalNumInputChannels();
@@ -85,19 +91,37 @@ void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBu
         buffer.clear(i, 0, buffer.getNumSamples());
     }
 
-    update();
-
-    const float* inL = buffer.getReadPointer(0);
-    const float* inR = buffer.getReadPointer(1);
-    float* outL = buffer.getWritePointer(0);
-    float* outR = buffer.getWritePointer(1);
+    // Only look at the parameters again when one of them has changed.
+    if (parametersChanged.exchange(false)) { update(); }
+
+    // There is no state, so every channel gets the same treatment. This works
+    // in place, since the input and output are the same buffer anyway. A shift
+    // of 0 bits leaves the audio alone, so then don't even touch it.
+    if (bits != 0) {
+        auto processKernel = CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel);
+        for (int channel = 0; channel < totalNumInputChannels; ++channel) {
+            auto* data = buffer.getWritePointer(channel);
+            auto result = processKernel(kernel, data, data, data, data, buffer.getNumSamples());
+            numOverflows += result.numOverflows;
+            numUnderflows += result.numUnderflows;
+        }
+    }
 
-    for (int i = 0; i < buffer.getNumSamples(); ++i) {
-        outL[i] = inL[i] * gain;
-        outR[i] = inR[i] * gain;
+    if (dithering) {
+        dither.process(buffer.getArrayOfWritePointers(), totalNumInputChannels, buffer.getNumSamples());
     }
 }
 
+void AudioProcessor::processPCM(void* data, BitShift::PCMFormat format, int numSamples)
+{
+    if (parametersChanged.exchange(false)) { update(); }
+    if (bits == 0) { return; }
+
+    auto result = kernel.processPCM(data, format, numSamples);
+    numOverflows += result.numOverflows;
+    numUnderflows += result.numUnderflows;
+}
+
 juce::AudioProcessorEditor* AudioProcessor::createEditor()
 {
     return new juce::GenericAudioProcessorEditor(*this);
@@ -105,31 +129,82 @@ juce::AudioProcessorEditor* AudioProcessor::createEditor()
 
 void AudioProcessor::getStateInformation(juce::MemoryBlock& destData)
 {
-    copyXmlToBinary(*apvts.copyState().createXml(), destData);
+    auto& parameters = getParameters();
+    CompactState::Writer writer(parameters.size());
+    for (auto* parameter : parameters) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        writer.add(ranged->getParameterID().toRawUTF8(), ranged->convertFrom0to1(ranged->getValue()));
+    }
+    destData.replaceAll(writer.getBytes().data(), writer.getBytes().size());
 }
 
 void AudioProcessor::setStateInformation(const void* data, int sizeInBytes)
 {
-    std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
-    if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
-        apvts.replaceState(juce::ValueTree::fromXml(*xml));
+    // Sessions that were saved by older versions of the plug-in have XML.
+    if (!CompactState::isCompact(data, size_t(sizeInBytes))) {
+        std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
+        if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
+            auto state = juce::ValueTree::fromXml(*xml);
+            apvts.replaceState(state);
+
+            auto legacy = state.getChildWithProperty("id", legacyBitShiftID);
+            if (legacy.isValid()) { setBits(float(legacy.getProperty("value"))); }
+        }
+        return;
+    }
+
+    CompactState::Reader reader(data, size_t(sizeInBytes));
+    if (!reader.isValid()) { return; }
+
+    // Like replaceState() does with the XML, parameters that are not in the
+    // state go back to their default value.
+    for (auto* parameter : getParameters()) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        float value = ranged->convertFrom0to1(ranged->getDefaultValue());
+        reader.find(ranged->getParameterID().toRawUTF8(), value);
+        ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
     }
+
+    float legacyBits = 0.0f;
+    if (reader.find(legacyBitShiftID, legacyBits)) { setBits(legacyBits); }
+}
+
+void AudioProcessor::setBits(float value)
+{
+    auto* parameter = apvts.getParameter("Bits");
+    parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
 }
 
 juce::AudioProcessorValueTreeState::ParameterLayout AudioProcessor::createParameterLayout()
 {
     juce::AudioProcessorValueTreeState::ParameterLayout layout;
 
+    // Until version 2, this was the parameter "BitShift", which went from -16
+    // to +16 bits. Hosts store automation as a value from 0 to 1, so changing
+    // the range under the same ID would have doubled every automated shift.
+    // With a new ID, old automation no longer applies instead. The state of
+    // older sessions is carried over by setStateInformation().
     layout.add(std::make_unique<juce::AudioParameterInt>(
-        juce::ParameterID("BitShift", 1),
+        juce::ParameterID("Bits", 2),
         "BitShift",
-        -16, 16, 0,
+        -32, 32, 0,
         juce::AudioParameterIntAttributes().withLabel("bits")));
 
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("Dither", 1),
+        "Dither",
+        false));
+
     return layout;
 }
 
+}  // namespace BitShiftGain
+
+// Only the plug-in projects define JucePlugin_Name. The other projects that
+// compile this file, such as the batch renderer, create the processor directly.
+#ifdef JucePlugin_Name
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
-    return new AudioProcessor();
+    return new BitShiftGain::AudioProcessor();
 }
+#endif
@@ -1,8 +1,16 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Shared/BitShiftGainKernel.h"
+#include "../../Shared/CacheAligned.h"
+#include "../../Shared/CompactState.h"
+#include "../../Shared/CpuDispatch.h"
+#include "../../Shared/FloatDither.h"
 
-class AudioProcessor : public juce::AudioProcessor
+namespace BitShiftGain {
+
+class alignas(CacheAligned::lineSize) AudioProcessor : public juce::AudioProcessor,
+                                                       private juce::AudioProcessorValueTreeState::Listener
 {
 public:
     AudioProcessor();
@@ -13,13 +21,15 @@ public:
     void releaseResources() override;
     void reset() override;
     void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
 
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
     juce::AudioProcessorEditor* createEditor() override;
 
     bool hasEditor() const override { return true; }
-    const juce::String getName() const override { return JucePlugin_Name; }
+    const juce::String getName() const override { return "BitShiftGain"; }
     bool acceptsMidi() const override { return false; }
     bool producesMidi() const override { return false; }
     bool isMidiEffect() const override { return false; }
@@ -31,15 +41,58 @@ public:
     const juce::String getProgramName(int index) override { return {}; }
     void changeProgramName(int index, const juce::String& newName) override { }
 
+    // The number of samples since the last reset that were too loud or too
+    // quiet to be shifted exactly. These became infinity or (close to) zero.
+    juce::int64 getNumOverflows() const { return numOverflows.load(); }
+    juce::int64 getNumUnderflows() const { return numUnderflows.load(); }
+
+    // Shifts integer PCM samples directly, for tools that work on integer
+    // files, such as BatchRender with --integer. This skips the conversion to
+    // float and back that processBlock() needs. The samples may be interleaved.
+    // Samples that don't fit are saturated and counted as overflows. The
+    // Dither parameter has no effect here. Don't call this at the same time
+    // as processBlock().
+    void processPCM(void* data, BitShift::PCMFormat format, int numSamples);
+
+    // The instruction set that the kernels use, chosen in prepareToPlay().
+    CpuDispatch::Level getIsaLevel() const { return isaLevel; }
+
     juce::AudioProcessorValueTreeState apvts { *this, nullptr, "Parameters", createParameterLayout() };
 
 private:
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
     void update();
+
+    // The ID of the shift in sessions that were saved before version 2. Its
+    // value is a number of bits, like now, so it carries over as is.
+    static constexpr const char* legacyBitShiftID = "BitShift";
+    void setBits(float value);
     void resetState();
 
-    double gain;
+    template<typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+    // Set by parameterChanged(), which can be called from any thread, and
+    // cleared by the audio thread when it reads the new values in update().
+    std::atomic<bool> parametersChanged { true };
+
+    std::atomic<float>* bitShiftParameter;
+    std::atomic<float>* ditherParameter;
+
+    int bits;
+    bool dithering;
+    Kernel kernel;
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+
+    // Adds the Airwindows dither to the output, when the Dither parameter is on.
+    FloatDither dither;
+
+    std::atomic<juce::int64> numOverflows { 0 };
+    std::atomic<juce::int64> numUnderflows { 0 };
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioProcessor)
 };
+
+}  // namespace BitShiftGain
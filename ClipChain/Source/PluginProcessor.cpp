@@ -0,0 +1,466 @@
+#include "PluginProcessor.h"
+
+namespace ClipChain {
+
+namespace
+{
+    const char* stageIDs[] = { "Stage1", "Stage2", "Stage3", "Stage4" };
+}
+
+AudioProcessor::AudioProcessor() :
+    juce::AudioProcessor(BusesProperties().withInput ("Input",  juce::AudioChannelSet::stereo(), true)
+                                          .withOutput("Output", juce::AudioChannelSet::stereo(), true))
+{
+    bypassParameter = apvts.getRawParameterValue("Bypass");
+    inputParameter = apvts.getRawParameterValue("Input");
+    outputParameter = apvts.getRawParameterValue("Output");
+    fastMathParameter = apvts.getRawParameterValue("FastMath");
+    ditherParameter = apvts.getRawParameterValue("Dither");
+
+    apvts.addParameterListener("Bypass", this);
+    apvts.addParameterListener("Input", this);
+    apvts.addParameterListener("Output", this);
+    apvts.addParameterListener("FastMath", this);
+    apvts.addParameterListener("Dither", this);
+
+    for (int i = 0; i < numStages; ++i) {
+        stageParameters[i] = apvts.getRawParameterValue(stageIDs[i]);
+        apvts.addParameterListener(stageIDs[i], this);
+    }
+}
+
+AudioProcessor::~AudioProcessor()
+{
+    cancelPendingUpdate();
+    apvts.removeParameterListener("Bypass", this);
+    apvts.removeParameterListener("Input", this);
+    apvts.removeParameterListener("Output", this);
+    apvts.removeParameterListener("FastMath", this);
+    apvts.removeParameterListener("Dither", this);
+
+    for (int i = 0; i < numStages; ++i) {
+        apvts.removeParameterListener(stageIDs[i], this);
+    }
+}
+
+void AudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
+{
+    this->sampleRate = sampleRate;
+
+    // The channels are processed in pairs, one channel per lane of a DoublePair.
+    // With an odd number of channels, the last pair has only one real channel.
+    size_t numPairs = size_t(getTotalNumOutputChannels() + 1) / 2;
+    kernels.resize(numPairs);
+    fadingKernels.resize(numPairs);
+
+    for (auto& kernel : kernels) {
+        kernel.prepare(sampleRate);
+    }
+    for (auto& kernel : fadingKernels) {
+        kernel.prepare(sampleRate);
+    }
+
+    // Use the best instruction set that this CPU has, unless a test forced
+    // a lower one. See CpuDispatch.h.
+    isaLevel = CpuDispatch::select();
+
+    // Before setStages(), which sets the delay of the bypassed audio.
+    bypass.prepare(sampleRate, getTotalNumOutputChannels());
+    crossfade.prepare(sampleRate);
+    kernelsNeedPriming = false;
+
+    // The host may only be told about a new latency from here or from the
+    // message thread, not from processBlock().
+    getStageParameters(stages);
+    setStages();
+    setLatencySamples(getLatencyFor(stages));
+
+    update();
+    inputLevel.prepare(sampleRate);
+    outputLevel.prepare(sampleRate);
+    dither.prepare(getTotalNumOutputChannels());
+}
+
+void AudioProcessor::releaseResources()
+{
+}
+
+void AudioProcessor::reset()
+{
+    resetState();
+}
+
+juce::AudioProcessorParameter* AudioProcessor::getBypassParameter() const
+{
+    return apvts.getParameter("Bypass");
+}
+
+bool AudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
+{
+    // Any number of channels is fine, as long as the input and output match.
+    auto mainOutput = layouts.getMainOutputChannelSet();
+    return !mainOutput.isDisabled() && mainOutput == layouts.getMainInputChannelSet();
+}
+
+void AudioProcessor::resetState()
+{
+    inputLevel.snapToTarget();
+    outputLevel.snapToTarget();
+
+    for (auto& kernel : kernels) {
+        kernel.reset();
+    }
+
+    bypass.reset();
+    crossfade.reset();
+    kernelsNeedPriming = false;
+    dither.reset();
+}
+
+void AudioProcessor::getStageParameters(Stage* types) const
+{
+    // The choices are in the same order as the Stage enum.
+    for (int i = 0; i < numStages; ++i) {
+        types[i] = Stage(int(stageParameters[i]->load()));
+    }
+}
+
+int AudioProcessor::getLatencyFor(const Stage* types) const
+{
+    // The same latency that the kernels end up with, worked out without
+    // touching them, so that the message thread can call this.
+    int latency = 0;
+    for (int i = 0; i < numStages; ++i) {
+        latency += Kernel::getLatencyFor(types[i], sampleRate);
+    }
+    return latency;
+}
+
+void AudioProcessor::setStages()
+{
+    // A stage that changes type starts out with a cleared state. This doesn't
+    // allocate.
+    for (auto& kernel : kernels) {
+        for (int i = 0; i < numStages; ++i) {
+            kernel.setStage(i, stages[i]);
+        }
+    }
+
+    // The bypassed audio gets the same delay, including the sample of a
+    // ClipOnly stage that isn't reported as latency.
+    int delay = 0;
+    for (int i = 0; i < numStages; ++i) {
+        delay += Kernel::getDelayFor(stages[i], sampleRate);
+    }
+    bypass.setDelay(delay);
+}
+
+void AudioProcessor::switchStages()
+{
+    // Keep the chains with the old stages, with their state, to fade out
+    // from. The other set gets the new stages, and is primed on the recent
+    // input before the next block. None of this allocates.
+    std::swap(kernels, fadingKernels);
+    setStages();
+    kernelsNeedPriming = true;
+
+    // While fully bypassed, the old kernels aren't running, so there is
+    // nothing to fade from. Leaving bypass primes the kernels anyway.
+    if (bypass.isBypassed()) {
+        crossfade.reset();
+    } else {
+        crossfade.start();
+    }
+}
+
+void AudioProcessor::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    parametersChanged.store(true);
+
+    // The stages can't be automated, so this comes from the editor or from
+    // loading a state, not from the audio thread.
+    for (int i = 0; i < numStages; ++i) {
+        if (parameterID == stageIDs[i]) { triggerAsyncUpdate(); }
+    }
+}
+
+void AudioProcessor::handleAsyncUpdate()
+{
+    // Tells the host about the latency of the new stages, on the message
+    // thread. The audio thread switches to them by itself in update().
+    Stage types[numStages];
+    getStageParameters(types);
+    setLatencySamples(getLatencyFor(types));
+}
+
+void AudioProcessor::update()
+{
+    bypass.setBypassed(bypassParameter->load());
+    inputLevel.setTarget(juce::Decibels::decibelsToGain(inputParameter->load()));
+    outputLevel.setTarget(juce::Decibels::decibelsToGain(outputParameter->load()));
+    fastMath = fastMathParameter->load();
+
+    // Changing a stage fades over from the old chain. handleAsyncUpdate()
+    // reports the new latency to the host.
+    Stage types[numStages];
+    getStageParameters(types);
+    if (!std::equal(types, types + numStages, stages)) {
+        std::copy(types, types + numStages, stages);
+        switchStages();
+    }
+
+    for (auto& kernel : kernels) {
+        kernel.fastMath = fastMath;
+    }
+    for (auto& kernel : fadingKernels) {
+        kernel.fastMath = fastMath;
+    }
+
+    // The Airwindows dither as an output stage, as in the other plug-ins.
+    dithering = ditherParameter->load();
+}
+
+void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+void AudioProcessor::processBlock(juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+template<typename SampleType>
+void AudioProcessor::process(juce::AudioBuffer<SampleType>& buffer)
+{
+    juce::ScopedNoDenormals noDenormals;
+    auto totalNumInputChannels = getTotalNumInputChannels();
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    // Clear any output channels that don't contain input data.
+    for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i) {
+        buffer.clear(i, 0, buffer.getNumSamples());
+    }
+
+    // Only look at the parameters again when one of them has changed.
+    if (parametersChanged.exchange(false)) { update(); }
+
+    // A crossfade in or out of bypass may end halfway through the block.
+    // Then the block is done in two parts, so that each part is either all
+    // crossfade or none of it.
+    int numSamples = buffer.getNumSamples();
+    for (int start = 0; start < numSamples; ) {
+        int count = bypass.getSegmentLength(numSamples - start);
+        juce::AudioBuffer<SampleType> segment(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, count);
+        processSegment(segment);
+        start += count;
+    }
+}
+
+template<typename SampleType>
+void AudioProcessor::processSegment(juce::AudioBuffer<SampleType>& buffer)
+{
+    int numChannels = std::min(buffer.getNumChannels(), int(kernels.size()) * 2);
+    int numSamples = buffer.getNumSamples();
+    SampleType* const* channels = buffer.getArrayOfWritePointers();
+
+    // Bypassed, the audio only gets the same delay as the kernels give it.
+    // There is no point in ramping a level that nobody hears.
+    if (bypass.isBypassed()) {
+        inputLevel.snapToTarget();
+        outputLevel.snapToTarget();
+        bypass.processBypassed(channels, numChannels, numSamples);
+        return;
+    }
+
+    // While a level is changing, the kernels use a level of 1 and the ramp is
+    // applied to the whole buffer instead, before or after the kernels. Once
+    // the ramp is done, the kernels apply the level themselves again.
+    bool inputRamping = inputLevel.isRamping();
+    bool outputRamping = outputLevel.isRamping();
+    for (auto& kernel : kernels) {
+        kernel.inputLevel = inputRamping ? 1.0 : inputLevel.getTarget();
+        kernel.outputLevel = outputRamping ? 1.0 : outputLevel.getTarget();
+    }
+    for (auto& kernel : fadingKernels) {
+        kernel.inputLevel = inputRamping ? 1.0 : inputLevel.getTarget();
+        kernel.outputLevel = outputRamping ? 1.0 : outputLevel.getTarget();
+    }
+
+    // Coming out of bypass, the kernels still have the state from before it.
+    // Start them over on the input of the last few milliseconds instead, so
+    // that the crossfade fades in what they would be putting out by now. The
+    // same goes for the new kernels after a stage changes.
+    if (bypass.needsPriming()) {
+        crossfade.reset();
+        kernelsNeedPriming = true;
+        bypass.clearPriming();
+    }
+    if (kernelsNeedPriming) {
+        primeKernels<SampleType>(numChannels);
+        kernelsNeedPriming = false;
+    }
+
+    bypass.pushInput(channels, numChannels, numSamples);
+
+    if (inputRamping) { inputLevel.process(channels, numChannels, numSamples); }
+
+    auto processKernel = CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel);
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        // With an odd number of channels, the last channel goes into both lanes.
+        // Both lanes then see the same input and compute the same output.
+        int other = std::min(channel + 1, numChannels - 1);
+        size_t pair = size_t(channel / 2);
+        if (crossfade.isFading()) {
+            processPairFading(pair, buffer.getReadPointer(channel), buffer.getReadPointer(other),
+                              buffer.getWritePointer(channel), buffer.getWritePointer(other), numSamples);
+        } else {
+            processKernel(kernels[pair], buffer.getReadPointer(channel), buffer.getReadPointer(other),
+                          buffer.getWritePointer(channel), buffer.getWritePointer(other), numSamples);
+        }
+    }
+    crossfade.advance(numSamples);
+
+    if (outputRamping) { outputLevel.process(channels, numChannels, numSamples); }
+    if (dithering) { dither.process(channels, numChannels, numSamples); }
+
+    bypass.crossfade(channels, numChannels, numSamples);
+}
+
+template<typename SampleType>
+void AudioProcessor::primeKernels(int numChannels)
+{
+    auto processKernel = CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel);
+    constexpr int chunkSize = 64;
+    SampleType a[chunkSize];
+    SampleType b[chunkSize];
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        auto& kernel = kernels[size_t(channel / 2)];
+        int other = std::min(channel + 1, numChannels - 1);
+        kernel.reset();
+        for (int start = 0; start < Bypass::historyLength; start += chunkSize) {
+            bypass.getHistory(channel, start, a, chunkSize);
+            bypass.getHistory(other, start, b, chunkSize);
+            processKernel(kernel, a, b, a, b, chunkSize);
+        }
+    }
+}
+
+template<typename SampleType>
+void AudioProcessor::processPairFading(size_t pair, const SampleType* inA, const SampleType* inB,
+                                       SampleType* outA, SampleType* outB, int numSamples)
+{
+    // The new kernels work in place, so the old ones get a copy of the input.
+    auto processKernel = CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel);
+    constexpr int chunkSize = 64;
+    SampleType a[chunkSize];
+    SampleType b[chunkSize];
+    for (int start = 0; start < numSamples; start += chunkSize) {
+        int count = std::min(chunkSize, numSamples - start);
+        std::copy(inA + start, inA + start + count, a);
+        std::copy(inB + start, inB + start + count, b);
+        processKernel(fadingKernels[pair], a, b, a, b, count);
+        processKernel(kernels[pair], inA + start, inB + start, outA + start, outB + start, count);
+        crossfade.mix(a, outA + start, start, count);
+        if (outB != outA) { crossfade.mix(b, outB + start, start, count); }
+    }
+}
+
+juce::AudioProcessorEditor* AudioProcessor::createEditor()
+{
+    return new juce::GenericAudioProcessorEditor(*this);
+}
+
+void AudioProcessor::getStateInformation(juce::MemoryBlock& destData)
+{
+    auto& parameters = getParameters();
+    CompactState::Writer writer(parameters.size());
+    for (auto* parameter : parameters) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        writer.add(ranged->getParameterID().toRawUTF8(), ranged->convertFrom0to1(ranged->getValue()));
+    }
+    destData.replaceAll(writer.getBytes().data(), writer.getBytes().size());
+}
+
+void AudioProcessor::setStateInformation(const void* data, int sizeInBytes)
+{
+    // Sessions that were saved by older versions of the plug-in have XML.
+    if (!CompactState::isCompact(data, size_t(sizeInBytes))) {
+        std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
+        if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
+            apvts.replaceState(juce::ValueTree::fromXml(*xml));
+        }
+        return;
+    }
+
+    CompactState::Reader reader(data, size_t(sizeInBytes));
+    if (!reader.isValid()) { return; }
+
+    // Like replaceState() does with the XML, parameters that are not in the
+    // state go back to their default value.
+    for (auto* parameter : getParameters()) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        float value = ranged->convertFrom0to1(ranged->getDefaultValue());
+        reader.find(ranged->getParameterID().toRawUTF8(), value);
+        ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
+    }
+}
+
+juce::AudioProcessorValueTreeState::ParameterLayout AudioProcessor::createParameterLayout()
+{
+    juce::AudioProcessorValueTreeState::ParameterLayout layout;
+
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("Bypass", 1),
+        "Bypass",
+        false));
+
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+        juce::ParameterID("Input", 1),
+        "Input",
+        juce::NormalisableRange<float>(-12.0f, 36.0f, 0.01f),
+        0.0f,
+        juce::AudioParameterFloatAttributes().withLabel("dB")));
+
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+        juce::ParameterID("Output", 1),
+        "Output",
+        juce::NormalisableRange<float>(-60.0f, 0.0f, 0.01f),
+        0.0f,
+        juce::AudioParameterFloatAttributes().withLabel("dB")));
+
+    // By default, the chain is ClipSoftly into ClipOnly2.
+    const int defaultStages[] = { int(Stage::clipSoftly), int(Stage::clipOnly2), int(Stage::off), int(Stage::off) };
+
+    for (int i = 0; i < numStages; ++i) {
+        layout.add(std::make_unique<juce::AudioParameterChoice>(
+            juce::ParameterID(stageIDs[i], 1),
+            juce::String("Stage ") + juce::String(i + 1),
+            juce::StringArray { "Off", "ClipOnly", "ClipOnly2", "ClipSoftly" },
+            defaultStages[i],
+            juce::AudioParameterChoiceAttributes().withAutomatable(false)));
+    }
+
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("FastMath", 1),
+        "Fast Math",
+        false));
+
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("Dither", 1),
+        "Dither",
+        false));
+
+    return layout;
+}
+
+}  // namespace ClipChain
+
+// Only the plug-in projects define JucePlugin_Name. The other projects that
+// compile this file, such as the batch renderer, create the processor directly.
+#ifdef JucePlugin_Name
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new ClipChain::AudioProcessor();
+}
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../Shared/ClipChainKernel.h"
+#include "../../Shared/Bypass.h"
+#include "../../Shared/Crossfade.h"
+#include "../../Shared/GainRamp.h"
+#include "../../Shared/CacheAligned.h"
+#include "../../Shared/CompactState.h"
+#include "../../Shared/CpuDispatch.h"
+#include "../../Shared/FloatDither.h"
+
+namespace ClipChain {
+
+class alignas(CacheAligned::lineSize) AudioProcessor : public juce::AudioProcessor,
+                                                       private juce::AudioProcessorValueTreeState::Listener,
+                                                       private juce::AsyncUpdater
+{
+public:
+    AudioProcessor();
+    ~AudioProcessor() override;
+
+    juce::AudioProcessorParameter* getBypassParameter() const override;
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override;
+    void prepareToPlay(double sampleRate, int samplesPerBlock) override;
+    void releaseResources() override;
+    void reset() override;
+    void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
+
+    void getStateInformation(juce::MemoryBlock& destData) override;
+    void setStateInformation(const void* data, int sizeInBytes) override;
+    juce::AudioProcessorEditor* createEditor() override;
+
+    bool hasEditor() const override { return true; }
+    const juce::String getName() const override { return "ClipChain"; }
+    bool acceptsMidi() const override { return false; }
+    bool producesMidi() const override { return false; }
+    bool isMidiEffect() const override { return false; }
+    double getTailLengthSeconds() const override { return 0.0; }
+
+    int getNumPrograms() override { return 1; }
+    int getCurrentProgram() override { return 0; }
+    void setCurrentProgram(int index) override { }
+    const juce::String getProgramName(int index) override { return {}; }
+    void changeProgramName(int index, const juce::String& newName) override { }
+
+    // The instruction set that the kernels use, chosen in prepareToPlay().
+    CpuDispatch::Level getIsaLevel() const { return isaLevel; }
+
+    juce::AudioProcessorValueTreeState apvts { *this, nullptr, "Parameters", createParameterLayout() };
+
+private:
+    static constexpr int numStages = Kernel::maxStages;
+
+    juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
+    void update();
+    void resetState();
+
+    void getStageParameters(Stage* types) const;
+    int getLatencyFor(const Stage* types) const;
+    void setStages();
+    void switchStages();
+
+    template<typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+    template<typename SampleType>
+    void processSegment(juce::AudioBuffer<SampleType>& buffer);
+
+    // Starts the kernels over on the recent input.
+    template<typename SampleType>
+    void primeKernels(int numChannels);
+
+    // Runs one pair of channels through both the kernels for the new stages
+    // and the kernels for the old stages, and fades from the old to the new.
+    template<typename SampleType>
+    void processPairFading(size_t pair, const SampleType* inA, const SampleType* inB,
+                           SampleType* outA, SampleType* outB, int numSamples);
+
+    // Set by parameterChanged(), which can be called from any thread, and
+    // cleared by the audio thread when it reads the new values in update().
+    std::atomic<bool> parametersChanged { true };
+
+    std::atomic<float>* bypassParameter;
+    std::atomic<float>* inputParameter;
+    std::atomic<float>* outputParameter;
+    std::atomic<float>* fastMathParameter;
+    std::atomic<float>* ditherParameter;
+    std::atomic<float>* stageParameters[numStages];
+
+    bool dithering;
+    bool fastMath;
+    Stage stages[numStages] = { };
+    double sampleRate = 44100.0;
+
+    // The levels as linear gains, which move smoothly to their new value
+    // when the Input or Output parameter changes.
+    GainRamp inputLevel;
+    GainRamp outputLevel;
+
+    // The chain of clippers and their state, for each pair of channels.
+    CacheAligned::Vector<Kernel> kernels;
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+
+    // After a stage changes, these still have the chains with the old stages,
+    // to fade out from.
+    CacheAligned::Vector<Kernel> fadingKernels;
+    Crossfade crossfade;
+    bool kernelsNeedPriming = false;
+
+    // Delays the audio while bypassed and crossfades when switching.
+    Bypass bypass;
+
+    // Adds the Airwindows dither to the output, when the Dither parameter is on.
+    FloatDither dither;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioProcessor)
+};
+
+}  // namespace ClipChain
@@ -1,18 +1,58 @@
 #include "PluginProcessor.h"
 
+namespace ClipOnly {
+
 AudioProcessor::AudioProcessor() :
     juce::AudioProcessor(BusesProperties().withInput ("Input",  juce::AudioChannelSet::stereo(), true)
                                           .withOutput("Output", juce::AudioChannelSet::stereo(), true))
 {
+    bypassParameter = apvts.getRawParameterValue("Bypass");
+    inputParameter = apvts.getRawParameterValue("Input");
+    outputParameter = apvts.getRawParameterValue("Output");
+    ditherParameter = apvts.getRawParameterValue("Dither");
+
+    apvts.addParameterListener("Bypass", this);
+    apvts.addParameterListener("Input", this);
+    apvts.addParameterListener("Output", this);
+    apvts.addParameterListener("Dither", this);
 }
 
 AudioProcessor::~AudioProcessor()
 {
+    apvts.removeParameterListener("Bypass", this);
+    apvts.removeParameterListener("Input", this);
+    apvts.removeParameterListener("Output", this);
+    apvts.removeParameterListener("Dither", this);
 }
 
 void AudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
-    resetState();
+    // The channels are processed in pairs, one channel per lane of a DoublePair.
+    // With an odd number of channels, the last pair has only one real channel.
+    size_t numPairs = size_t(getTotalNumOutputChannels() + 1) / 2;
+    kernels.resize(numPairs);
+
+    for (auto& kernel : kernels) {
+        kernel.prepare(sampleRate);
+    }
+
+    // The kernels delay the audio by one sample, which is not reported to the
+    // host (see ClipOnlyKernel.h), but bypass must still match it.
+    bypass.prepare(sampleRate, getTotalNumOutputChannels());
+    bypass.setDelay(1);
+
+    // Use the best instruction set that this CPU has, unless a test forced
+    // a lower one. See CpuDispatch.h.
+    isaLevel = CpuDispatch::select();
+
+    update();
+    inputLevel.prepare(sampleRate);
+    outputLevel.prepare(sampleRate);
+    dither.prepare(getTotalNumOutputChannels());
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.prepare(getTotalNumOutputChannels());
+   #endif
 }
 
 void AudioProcessor::releaseResources()
@@ -31,29 +71,56 @@ juce::AudioProcessorParameter* AudioProcessor::getBypassParameter() const
 
 bool AudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
 {
-    return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo();
+    // Any number of channels is fine, as long as the input and output match.
+    auto mainOutput = layouts.getMainOutputChannelSet();
+    return !mainOutput.isDisabled() && mainOutput == layouts.getMainInputChannelSet();
 }
 
 void AudioProcessor::resetState()
 {
-    lastSampleL = 0.0f;
-    wasPosClipL = false;
-    wasNegClipL = false;
+    inputLevel.snapToTarget();
+    outputLevel.snapToTarget();
+
+    for (auto& kernel : kernels) {
+        kernel.reset();
+    }
 
-    lastSampleR = 0.0f;
-    wasPosClipR = false;
-    wasNegClipR = false;
+    bypass.reset();
+    dither.reset();
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.reset();
+   #endif
+}
+
+void AudioProcessor::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    parametersChanged.store(true);
 }
 
 void AudioProcessor::update()
 {
     // These parameters are not in the original plug-in but are useful for testing.
-    bypassed = apvts.getRawParameterValue("Bypass")->load();
-    inputLevel = juce::Decibels::decibelsToGain(apvts.getRawParameterValue("Input")->load());
-    outputLevel = juce::Decibels::decibelsToGain(apvts.getRawParameterValue("Output")->load());
+    bypass.setBypassed(bypassParameter->load());
+    inputLevel.setTarget(juce::Decibels::decibelsToGain(inputParameter->load()));
+    outputLevel.setTarget(juce::Decibels::decibelsToGain(outputParameter->load()));
+
+    // Not in the original plug-in: the Airwindows dither as an output stage.
+    dithering = ditherParameter->load();
 }
 
 void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+void AudioProcessor::processBlock(juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+template<typename SampleType>
+void AudioProcessor::process(juce::AudioBuffer<SampleType>& buffer)
 {
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels = getTotalNumInputChannels();
@@ -64,113 +131,101 @@ void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBu
         buffer.clear(i, 0, buffer.getNumSamples());
     }
 
-    update();
+    // Only look at the parameters again when one of them has changed.
+    if (parametersChanged.exchange(false)) { update(); }
+
+    // A crossfade in or out of bypass may end halfway through the block.
+    // Then the block is done in two parts, so that each part is either all
+    // crossfade or none of it.
+    int numSamples = buffer.getNumSamples();
+    for (int start = 0; start < numSamples; ) {
+        int count = bypass.getSegmentLength(numSamples - start);
+        juce::AudioBuffer<SampleType> segment(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, count);
+        processSegment(segment);
+        start += count;
+    }
+}
 
-    if (bypassed) { return; }
-
-    const float* inL = buffer.getReadPointer(0);
-    const float* inR = buffer.getReadPointer(1);
-    float* outL = buffer.getWritePointer(0);
-    float* outR = buffer.getWritePointer(1);
-
-    double hardness = 0.7390851332151606;  // x == cos(x)
-    double softness = 1.0 - hardness;      // 0.260915
-    double refclip = 0.9549925859;         // -0.2dB (is actually -0.4 dB!)
-
-    /*
-        How this works:
-
-        The output is delayed by one sample time, so that we can look ahead to
-        see if the next sample will clip or will stop clipping.
-
-        (By design, the plug-in does not declare this one sample of latency to
-        the host, as this makes it nicer to record through without having to deal
-        with latency compensation.)
-
-        The idea is to leave samples that are not clipping alone, and change only
-        those samples that go from not-clipping to clipping, and from clipping to
-        not-clipping, by "slowing down" the trajectory rather than doing a hard
-        transition.
-
-        The transition is rounded by blending between the last known non-clipping
-        value and the max level of 0.955 using a linear interpolation, which you
-        can also think of as a simple filter. Since we round off the hard corners,
-        the result is that the brightness of the high end is reduced when clipping.
-    */
-
-    for (int i = 0; i < buffer.getNumSamples(); ++i) {
-        float inputSampleL = inL[i] * inputLevel;
-        float inputSampleR = inR[i] * inputLevel;
-
-        if (inputSampleL >  4.0f) { inputSampleL =  4.0f; }
-        if (inputSampleL < -4.0f) { inputSampleL = -4.0f; }
-        if (inputSampleR >  4.0f) { inputSampleR =  4.0f; }
-        if (inputSampleR < -4.0f) { inputSampleR = -4.0f; }
-
-        // Are we currently clipping?
-        if (wasPosClipL) {
-            if (inputSampleL < lastSampleL) {
-                // The new sample is not clipping, transition towards it.
-                lastSampleL = inputSampleL * softness + refclip * hardness;
-            } else {
-                // Still clipping, keep moving towards to the max level.
-                lastSampleL = lastSampleL * hardness + refclip * softness;
-            }
-            wasPosClipL = false;
-        }
+template<typename SampleType>
+void AudioProcessor::processSegment(juce::AudioBuffer<SampleType>& buffer)
+{
+    int numChannels = std::min(buffer.getNumChannels(), int(kernels.size()) * 2);
+    int numSamples = buffer.getNumSamples();
+    SampleType* const* channels = buffer.getArrayOfWritePointers();
+
+    // Bypassed, the audio only gets the same delay as the kernels give it.
+    // There is no point in ramping a level that nobody hears.
+    if (bypass.isBypassed()) {
+        inputLevel.snapToTarget();
+        outputLevel.snapToTarget();
+        bypass.processBypassed(channels, numChannels, numSamples);
+        return;
+    }
 
-        // Look ahead: If the new sample will clip, ignore it and move
-        // the current non-clipping value a bit towards the max level.
-        if (inputSampleL > refclip) {
-            wasPosClipL = true;
-            inputSampleL = lastSampleL * softness + refclip * hardness;
-        }
+    // While a level is changing, the kernels use a level of 1 and the ramp is
+    // applied to the whole buffer instead, before or after the kernels. Once
+    // the ramp is done, the kernels apply the level themselves again.
+    bool inputRamping = inputLevel.isRamping();
+    bool outputRamping = outputLevel.isRamping();
+    for (auto& kernel : kernels) {
+        kernel.inputLevel = inputRamping ? 1.0 : inputLevel.getTarget();
+        kernel.outputLevel = outputRamping ? 1.0 : outputLevel.getTarget();
+    }
 
-        // Are we clipping in the negative direction?
-        if (wasNegClipL) {
-            if (inputSampleL > lastSampleL) {  // new sample is not clipping
-                lastSampleL = inputSampleL * softness - refclip * hardness;
-            } else {  // still clipping, still chasing the target
-                lastSampleL = lastSampleL * hardness - refclip * softness;
+    auto processKernel = CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel);
+
+    // Coming out of bypass, the kernels still have the state from before it.
+    // Start them over on the input of the last few milliseconds instead, so
+    // that the crossfade fades in what they would be putting out by now.
+    if (bypass.needsPriming()) {
+        constexpr int chunkSize = 64;
+        SampleType a[chunkSize];
+        SampleType b[chunkSize];
+        for (int channel = 0; channel < numChannels; channel += 2) {
+            auto& kernel = kernels[size_t(channel / 2)];
+            int other = std::min(channel + 1, numChannels - 1);
+            kernel.reset();
+            for (int start = 0; start < Bypass::historyLength; start += chunkSize) {
+                bypass.getHistory(channel, start, a, chunkSize);
+                bypass.getHistory(other, start, b, chunkSize);
+                processKernel(kernel, a, b, a, b, chunkSize);
             }
-            wasNegClipL = false;
-        }
-        if (inputSampleL < -refclip) {
-            wasNegClipL = true;
-            inputSampleL = lastSampleL * softness - refclip * hardness;
         }
+        bypass.clearPriming();
+    }
 
-        // Same logic for the right channel.
-        if (wasPosClipR) {
-            if (inputSampleR < lastSampleR) {
-                lastSampleR = inputSampleR * softness + refclip * hardness;
-            } else {
-                lastSampleR = lastSampleR * hardness + refclip * softness;
-            }
-            wasPosClipR = false;
-        }
-        if (inputSampleR > refclip) {
-            wasPosClipR = true;
-            inputSampleR = lastSampleR * softness + refclip * hardness;
-        }
-        if (wasNegClipR) {
-            if (inputSampleR > lastSampleR) {
-                lastSampleR = inputSampleR * softness - refclip * hardness;
-            } else {
-                lastSampleR = lastSampleR * hardness - refclip * softness;
-            }
-            wasNegClipR = false;
-        }
-        if (inputSampleR < -refclip) {
-            wasNegClipR = true;
-            inputSampleR = lastSampleR * softness - refclip * hardness;
-        }
+    bypass.pushInput(channels, numChannels, numSamples);
+
+    if (inputRamping) { inputLevel.process(channels, numChannels, numSamples); }
 
-        outL[i] = lastSampleL * outputLevel;
-        outR[i] = lastSampleR * outputLevel;
-        lastSampleL = inputSampleL;
-        lastSampleR = inputSampleR;
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.startProbes(kernels, numChannels, numSamples);
+   #endif
+
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        // With an odd number of channels, the last channel goes into both lanes.
+        // Both lanes then see the same input and compute the same output.
+        int other = std::min(channel + 1, numChannels - 1);
+        processKernel(kernels[size_t(channel / 2)], buffer.getReadPointer(channel), buffer.getReadPointer(other),
+                      buffer.getWritePointer(channel), buffer.getWritePointer(other), numSamples);
+    }
+
+    if (outputRamping) { outputLevel.process(channels, numChannels, numSamples); }
+    if (dithering) { dither.process(channels, numChannels, numSamples); }
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // What the kernels put out is the output, unless it gets ramped or
+    // dithered afterwards. Then the Meter has to look at it itself.
+    bool outputMeasured = !outputRamping && !dithering;
+    telemetry.addProbes(kernels, numChannels, outputMeasured);
+    if (outputMeasured) {
+        telemetry.finishBlock();
+    } else {
+        telemetry.measureOutput(channels, numChannels, numSamples);
     }
+   #endif
+
+    bypass.crossfade(channels, numChannels, numSamples);
 }
 
 juce::AudioProcessorEditor* AudioProcessor::createEditor()
@@ -180,14 +235,36 @@ juce::AudioProcessorEditor* AudioProcessor::createEditor()
 
 void AudioProcessor::getStateInformation(juce::MemoryBlock& destData)
 {
-    copyXmlToBinary(*apvts.copyState().createXml(), destData);
+    auto& parameters = getParameters();
+    CompactState::Writer writer(parameters.size());
+    for (auto* parameter : parameters) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        writer.add(ranged->getParameterID().toRawUTF8(), ranged->convertFrom0to1(ranged->getValue()));
+    }
+    destData.replaceAll(writer.getBytes().data(), writer.getBytes().size());
 }
 
 void AudioProcessor::setStateInformation(const void* data, int sizeInBytes)
 {
-    std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
-    if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
-        apvts.replaceState(juce::ValueTree::fromXml(*xml));
+    // Sessions that were saved by older versions of the plug-in have XML.
+    if (!CompactState::isCompact(data, size_t(sizeInBytes))) {
+        std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
+        if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
+            apvts.replaceState(juce::ValueTree::fromXml(*xml));
+        }
+        return;
+    }
+
+    CompactState::Reader reader(data, size_t(sizeInBytes));
+    if (!reader.isValid()) { return; }
+
+    // Like replaceState() does with the XML, parameters that are not in the
+    // state go back to their default value.
+    for (auto* parameter : getParameters()) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        float value = ranged->convertFrom0to1(ranged->getDefaultValue());
+        reader.find(ranged->getParameterID().toRawUTF8(), value);
+        ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
     }
 }
 
@@ -214,10 +291,21 @@ juce::AudioProcessorValueTreeState::ParameterLayout AudioProcessor::createParame
         0.0f,
         juce::AudioParameterFloatAttributes().withLabel("dB")));
 
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("Dither", 1),
+        "Dither",
+        false));
+
     return layout;
 }
 
+}  // namespace ClipOnly
+
+// Only the plug-in projects define JucePlugin_Name. The other projects that
+// compile this file, such as the batch renderer, create the processor directly.
+#ifdef JucePlugin_Name
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
-    return new AudioProcessor();
+    return new ClipOnly::AudioProcessor();
 }
+#endif
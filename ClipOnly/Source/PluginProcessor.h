@@ -1,8 +1,22 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Shared/ClipOnlyKernel.h"
+#include "../../Shared/Bypass.h"
+#include "../../Shared/GainRamp.h"
+#include "../../Shared/CacheAligned.h"
+#include "../../Shared/CompactState.h"
+#include "../../Shared/CpuDispatch.h"
+#include "../../Shared/FloatDither.h"
 
-class AudioProcessor : public juce::AudioProcessor
+#if AIRWINDOWS_CLIP_TELEMETRY
+    #include "../../Shared/ClipTelemetry.h"
+#endif
+
+namespace ClipOnly {
+
+class alignas(CacheAligned::lineSize) AudioProcessor : public juce::AudioProcessor,
+                                                       private juce::AudioProcessorValueTreeState::Listener
 {
 public:
     AudioProcessor();
@@ -14,13 +28,15 @@ public:
     void releaseResources() override;
     void reset() override;
     void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
 
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
     juce::AudioProcessorEditor* createEditor() override;
 
     bool hasEditor() const override { return true; }
-    const juce::String getName() const override { return JucePlugin_Name; }
+    const juce::String getName() const override { return "ClipOnly"; }
     bool acceptsMidi() const override { return false; }
     bool producesMidi() const override { return false; }
     bool isMidiEffect() const override { return false; }
@@ -32,25 +48,67 @@ public:
     const juce::String getProgramName(int index) override { return {}; }
     void changeProgramName(int index, const juce::String& newName) override { }
 
+    // The instruction set that the kernels use, chosen in prepareToPlay().
+    CpuDispatch::Level getIsaLevel() const { return isaLevel; }
+
     juce::AudioProcessorValueTreeState apvts { *this, nullptr, "Parameters", createParameterLayout() };
 
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Gets the statistics for the next block that was processed. Call this
+    // from one thread only, for example from a timer on the message thread.
+    bool popClipStats(ClipTelemetry::BlockStats& stats) { return telemetry.pop(stats); }
+   #endif
+
 private:
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // The kernels measure the audio for the telemetry as they process it.
+    using Kernel = ClipTelemetry::Measured<ClipOnly::Kernel>;
+   #endif
+
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
     void update();
     void resetState();
 
-    bool bypassed;
-    float inputLevel;
-    float outputLevel;
+    template<typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+    template<typename SampleType>
+    void processSegment(juce::AudioBuffer<SampleType>& buffer);
+
+    // Set by parameterChanged(), which can be called from any thread, and
+    // cleared by the audio thread when it reads the new values in update().
+    std::atomic<bool> parametersChanged { true };
 
-    float lastSampleL;
-    bool wasPosClipL;
-    bool wasNegClipL;
+    std::atomic<float>* bypassParameter;
+    std::atomic<float>* inputParameter;
+    std::atomic<float>* outputParameter;
+    std::atomic<float>* ditherParameter;
 
-    float lastSampleR;
-    bool wasPosClipR;
-    bool wasNegClipR;
+    bool dithering;
+
+    // The levels as linear gains, which move smoothly to their new value
+    // when the Input or Output parameter changes.
+    GainRamp inputLevel;
+    GainRamp outputLevel;
+
+    // The algorithm and its state, for each pair of channels.
+    CacheAligned::Vector<Kernel> kernels;
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+
+    // Delays the audio while bypassed and crossfades when switching.
+    Bypass bypass;
+
+    // Adds the Airwindows dither to the output, when the Dither parameter is on.
+    FloatDither dither;
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Counts the samples over 0.9549925859, which is the clip level.
+    ClipTelemetry::Meter telemetry { 0.9549925859 };
+   #endif
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioProcessor)
 };
+
+}  // namespace ClipOnly
@@ -1,8 +1,25 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Shared/ClipOnly2Kernel.h"
+#include "../../Shared/Bypass.h"
+#include "../../Shared/Crossfade.h"
+#include "../../Shared/GainRamp.h"
 
-class AudioProcessor : public juce::AudioProcessor
+#if AIRWINDOWS_CLIP_TELEMETRY
+    #include "../../Shared/ClipTelemetry.h"
+#endif
+#include "../../Shared/Oversampler.h"
+#include "../../Shared/CacheAligned.h"
+#include "../../Shared/CompactState.h"
+#include "../../Shared/CpuDispatch.h"
+#include "../../Shared/FloatDither.h"
+
+namespace ClipOnly2 {
+
+class alignas(CacheAligned::lineSize) AudioProcessor : public juce::AudioProcessor,
+                                                       private juce::AudioProcessorValueTreeState::Listener,
+                                                       private juce::AsyncUpdater
 {
 public:
     AudioProcessor();
@@ -14,13 +31,15 @@ public:
     void releaseResources() override;
     void reset() override;
     void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
 
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
     juce::AudioProcessorEditor* createEditor() override;
 
     bool hasEditor() const override { return true; }
-    const juce::String getName() const override { return JucePlugin_Name; }
+    const juce::String getName() const override { return "ClipOnly2"; }
     bool acceptsMidi() const override { return false; }
     bool producesMidi() const override { return false; }
     bool isMidiEffect() const override { return false; }
@@ -32,27 +51,119 @@ public:
     const juce::String getProgramName(int index) override { return {}; }
     void changeProgramName(int index, const juce::String& newName) override { }
 
+    // The instruction set that the kernels use, chosen in prepareToPlay().
+    CpuDispatch::Level getIsaLevel() const { return isaLevel; }
+
+    // The largest true peak of the output, as a linear gain, since the last
+    // call. Only measured when the TruePeak parameter is Meter or Limit, and
+    // levels below about -6 dB read as 0. This is the final output at the
+    // sample rate of the host, after the Output level and the dither. Call
+    // this from one thread only.
+    float popTruePeak() { return truePeak.exchange(0.0f); }
+
     juce::AudioProcessorValueTreeState apvts { *this, nullptr, "Parameters", createParameterLayout() };
 
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Gets the statistics for the next block that was processed. Call this
+    // from one thread only, for example from a timer on the message thread.
+    bool popClipStats(ClipTelemetry::BlockStats& stats) { return telemetry.pop(stats); }
+   #endif
+
 private:
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // The kernels measure the audio for the telemetry as they process it.
+    using Kernel = ClipTelemetry::Measured<ClipOnly2::Kernel>;
+   #endif
+
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
     void update();
     void resetState();
 
-    bool bypassed;
-    float inputLevel;
-    float outputLevel;
+    int getOversamplingParameter() const;
+    TruePeakMode getTruePeakParameter() const;
+    int getLatencyFor(int factor, TruePeakMode mode) const;
+    void setOversampling(int factor);
+    void switchKernels(int factor);
+
+    template<typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+    template<typename SampleType>
+    void processSegment(juce::AudioBuffer<SampleType>& buffer);
+
+    // Starts the kernels and oversamplers over on the recent input.
+    template<typename SampleType>
+    void primeKernels(int numChannels);
+
+    template<typename SampleType>
+    void measureTruePeak(juce::AudioBuffer<SampleType>& buffer);
+
+    // Runs one pair of channels through a kernel, and its oversampler if
+    // oversampling is on.
+    template<typename SampleType>
+    void processPair(Kernel& kernel, Oversampler& oversampler, const SampleType* inA, const SampleType* inB,
+                     SampleType* outA, SampleType* outB, int numSamples);
+
+    // The same, while fading from the kernels for the previous settings.
+    template<typename SampleType>
+    void processPairFading(size_t pair, const SampleType* inA, const SampleType* inB,
+                           SampleType* outA, SampleType* outB, int numSamples);
 
-    double lastSampleL;
-    double intermediateL[17];
-    bool wasPosClipL;
-    bool wasNegClipL;
+    // Set by parameterChanged(), which can be called from any thread, and
+    // cleared by the audio thread when it reads the new values in update().
+    std::atomic<bool> parametersChanged { true };
 
-    double lastSampleR;
-    double intermediateR[17];
-    bool wasPosClipR;
-    bool wasNegClipR;
+    std::atomic<float>* bypassParameter;
+    std::atomic<float>* inputParameter;
+    std::atomic<float>* outputParameter;
+    std::atomic<float>* oversamplingParameter;
+    std::atomic<float>* ditherParameter;
+    std::atomic<float>* truePeakParameter;
+
+    bool dithering;
+
+    // The levels as linear gains, which move smoothly to their new value
+    // when the Input or Output parameter changes.
+    GainRamp inputLevel;
+    GainRamp outputLevel;
+
+    double sampleRate = 44100.0;
+    int oversampling = 1;
+    TruePeakMode truePeakMode = TruePeakMode::off;
+
+    // The algorithm and its state, for each pair of channels.
+    CacheAligned::Vector<Kernel> kernels;
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+    CacheAligned::Vector<Oversampler> oversamplers;
+
+    // After the oversampling factor or the limit mode changes, these still
+    // have the kernels and oversamplers for the old settings, to fade out from.
+    CacheAligned::Vector<Kernel> fadingKernels;
+    CacheAligned::Vector<Oversampler> fadingOversamplers;
+    Crossfade crossfade;
+    bool kernelsNeedPriming = false;
+
+    // Delays the audio while bypassed and crossfades when switching.
+    Bypass bypass;
+
+    // Adds the Airwindows dither to the output, when the Dither parameter is on.
+    FloatDither dither;
+
+    // Measures the output, one meter for each pair of channels.
+    CacheAligned::Vector<TruePeak::Meter> truePeakMeters;
+
+    // Written by the audio thread and cleared by popTruePeak().
+    std::atomic<float> truePeak { 0.0f };
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Counts the samples over 0.9549925859, which is the clip level.
+    ClipTelemetry::Meter telemetry { 0.9549925859 };
+   #endif
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioProcessor)
 };
+
+}  // namespace ClipOnly2
@@ -1,18 +1,81 @@
 #include "PluginProcessor.h"
 
+namespace ClipSoftly {
+
 AudioProcessor::AudioProcessor() :
     juce::AudioProcessor(BusesProperties().withInput ("Input",  juce::AudioChannelSet::stereo(), true)
                                           .withOutput("Output", juce::AudioChannelSet::stereo(), true))
 {
+    bypassParameter = apvts.getRawParameterValue("Bypass");
+    inputParameter = apvts.getRawParameterValue("Input");
+    outputParameter = apvts.getRawParameterValue("Output");
+    fastMathParameter = apvts.getRawParameterValue("FastMath");
+    oversamplingParameter = apvts.getRawParameterValue("Oversampling");
+    ditherParameter = apvts.getRawParameterValue("Dither");
+
+    apvts.addParameterListener("Bypass", this);
+    apvts.addParameterListener("Input", this);
+    apvts.addParameterListener("Output", this);
+    apvts.addParameterListener("FastMath", this);
+    apvts.addParameterListener("Oversampling", this);
+    apvts.addParameterListener("Dither", this);
 }
 
 AudioProcessor::~AudioProcessor()
 {
+    cancelPendingUpdate();
+    apvts.removeParameterListener("Bypass", this);
+    apvts.removeParameterListener("Input", this);
+    apvts.removeParameterListener("Output", this);
+    apvts.removeParameterListener("FastMath", this);
+    apvts.removeParameterListener("Oversampling", this);
+    apvts.removeParameterListener("Dither", this);
 }
 
 void AudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
-    resetState();
+    this->sampleRate = sampleRate;
+
+    // The channels are processed in pairs, one channel per lane of a DoublePair.
+    // With an odd number of channels, the last pair has only one real channel.
+    size_t numPairs = size_t(getTotalNumOutputChannels() + 1) / 2;
+    kernels.resize(numPairs);
+    oversamplers.resize(numPairs);
+    fadingKernels.resize(numPairs);
+    fadingOversamplers.resize(numPairs);
+
+    // Use the best instruction set that this CPU has, unless a test forced
+    // a lower one. See CpuDispatch.h.
+    isaLevel = CpuDispatch::select();
+
+    // Allocate everything that 8x oversampling needs, so that switching the
+    // factor later on doesn't allocate.
+    for (auto& oversampler : oversamplers) {
+        oversampler.prepare(std::max(1, samplesPerBlock));
+    }
+    for (auto& oversampler : fadingOversamplers) {
+        oversampler.prepare(std::max(1, samplesPerBlock));
+    }
+
+    // Before setOversampling(), which sets the delay of the bypassed audio.
+    bypass.prepare(sampleRate, getTotalNumOutputChannels());
+    crossfade.prepare(sampleRate);
+    kernelsNeedPriming = false;
+
+    // The host may only be told about a new latency from here or from the
+    // message thread, not from processBlock().
+    int factor = getOversamplingParameter();
+    setOversampling(factor);
+    setLatencySamples(getLatencyFor(factor));
+
+    update();
+    inputLevel.prepare(sampleRate);
+    outputLevel.prepare(sampleRate);
+    dither.prepare(getTotalNumOutputChannels());
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.prepare(getTotalNumOutputChannels());
+   #endif
 }
 
 void AudioProcessor::releaseResources()
@@ -31,33 +94,137 @@ juce::AudioProcessorParameter* AudioProcessor::getBypassParameter() const
 
 bool AudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
 {
-    return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo();
+    // Any number of channels is fine, as long as the input and output match.
+    auto mainOutput = layouts.getMainOutputChannelSet();
+    return !mainOutput.isDisabled() && mainOutput == layouts.getMainInputChannelSet();
 }
 
 void AudioProcessor::resetState()
 {
-    lastSampleL = 0.0;
-    lastSampleR = 0.0;
+    inputLevel.snapToTarget();
+    outputLevel.snapToTarget();
+
+    for (auto& kernel : kernels) {
+        kernel.reset();
+    }
+    for (auto& oversampler : oversamplers) {
+        oversampler.reset();
+    }
+
+    bypass.reset();
+    crossfade.reset();
+    kernelsNeedPriming = false;
+    dither.reset();
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.reset();
+   #endif
+}
+
+int AudioProcessor::getOversamplingParameter() const
+{
+    // The choices are Off, 2x, 4x, and 8x.
+    return 1 << int(oversamplingParameter->load());
+}
+
+int AudioProcessor::getLatencyFor(int factor) const
+{
+    // The kernels' latency is their spacing at the higher rate. The
+    // oversampler rounds the total up to a whole number of samples.
+    return Oversampler::getLatencyFor(factor, Kernel::getSpacing(sampleRate * factor));
+}
+
+void AudioProcessor::setOversampling(int factor)
+{
+    oversampling = factor;
+
+    // The kernels run at the higher rate. Their delay line gets longer, so
+    // that it still lasts about as long as one sample at 44.1 kHz.
+    for (size_t pair = 0; pair < kernels.size(); ++pair) {
+        kernels[pair].prepare(sampleRate * factor);
+        oversamplers[pair].setFactor(factor, kernels[pair].getLatency());
+    }
 
-    for (int x = 0; x < 16; x++) {
-        intermediateL[x] = 0.0;
-        intermediateR[x] = 0.0;
+    // The bypassed audio gets the same latency.
+    if (!oversamplers.empty()) {
+        bypass.setDelay(oversamplers[0].getLatency());
     }
+}
+
+void AudioProcessor::switchOversampling(int factor)
+{
+    // Keep the kernels and filters for the old factor, with their state, to
+    // fade out from. The other set becomes the new one, and is primed on the
+    // recent input before the next block. None of this allocates.
+    std::swap(kernels, fadingKernels);
+    std::swap(oversamplers, fadingOversamplers);
+    setOversampling(factor);
+    kernelsNeedPriming = true;
+
+    // While fully bypassed, the old kernels aren't running, so there is
+    // nothing to fade from. Leaving bypass primes the kernels anyway.
+    if (bypass.isBypassed()) {
+        crossfade.reset();
+    } else {
+        crossfade.start();
+    }
+}
+
+void AudioProcessor::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    parametersChanged.store(true);
+
+    // Oversampling can't be automated, so this comes from the editor or from
+    // loading a state, not from the audio thread.
+    if (parameterID == "Oversampling") { triggerAsyncUpdate(); }
+}
 
-    // Used by Airwindows dithering, which I disabled for the JUCE version.
-    //fpdL = 1.0; while (fpdL < 16386) fpdL = rand()*UINT32_MAX;
-    //fpdR = 1.0; while (fpdR < 16386) fpdR = rand()*UINT32_MAX;
+void AudioProcessor::handleAsyncUpdate()
+{
+    // Tells the host about the latency of the new factor, on the message
+    // thread. The audio thread switches to it by itself in update().
+    setLatencySamples(getLatencyFor(getOversamplingParameter()));
 }
 
 void AudioProcessor::update()
 {
     // These parameters are not in the original plug-in but are useful for testing.
-    bypassed = apvts.getRawParameterValue("Bypass")->load();
-    inputLevel = juce::Decibels::decibelsToGain(apvts.getRawParameterValue("Input")->load());
-    outputLevel = juce::Decibels::decibelsToGain(apvts.getRawParameterValue("Output")->load());
+    bypass.setBypassed(bypassParameter->load());
+    inputLevel.setTarget(juce::Decibels::decibelsToGain(inputParameter->load()));
+    outputLevel.setTarget(juce::Decibels::decibelsToGain(outputParameter->load()));
+
+    // Also not in the original plug-in. Changing the factor doesn't allocate,
+    // and fades over from the old factor. handleAsyncUpdate() reports the new
+    // latency to the host.
+    int factor = getOversamplingParameter();
+    if (factor != oversampling) { switchOversampling(factor); }
+
+    // Not in the original plug-in either: trades exactness for speed.
+    fastMath = fastMathParameter->load();
+
+    for (auto& kernel : kernels) {
+        kernel.fastMath = fastMath;
+    }
+    for (auto& kernel : fadingKernels) {
+        kernel.fastMath = fastMath;
+    }
+
+    // Not in the original plug-in: the Airwindows dither as an output stage.
+    dithering = ditherParameter->load();
 }
 
 void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+void AudioProcessor::processBlock(juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    process(buffer);
+}
+
+template<typename SampleType>
+void AudioProcessor::process(juce::AudioBuffer<SampleType>& buffer)
 {
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels = getTotalNumInputChannels();
@@ -68,91 +235,157 @@ void AudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBu
         buffer.clear(i, 0, buffer.getNumSamples());
     }
 
-    update();
+    // Only look at the parameters again when one of them has changed.
+    if (parametersChanged.exchange(false)) { update(); }
+
+    // A crossfade in or out of bypass may end halfway through the block.
+    // Then the block is done in two parts, so that each part is either all
+    // crossfade or none of it.
+    int numSamples = buffer.getNumSamples();
+    for (int start = 0; start < numSamples; ) {
+        int count = bypass.getSegmentLength(numSamples - start);
+        juce::AudioBuffer<SampleType> segment(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start, count);
+        processSegment(segment);
+        start += count;
+    }
+}
+
+template<typename SampleType>
+void AudioProcessor::processSegment(juce::AudioBuffer<SampleType>& buffer)
+{
+    int numChannels = std::min(buffer.getNumChannels(), int(kernels.size()) * 2);
+    int numSamples = buffer.getNumSamples();
+    SampleType* const* channels = buffer.getArrayOfWritePointers();
+
+    // Bypassed, the audio only gets the same delay as the kernels give it.
+    // There is no point in ramping a level that nobody hears.
+    if (bypass.isBypassed()) {
+        inputLevel.snapToTarget();
+        outputLevel.snapToTarget();
+        bypass.processBypassed(channels, numChannels, numSamples);
+        return;
+    }
+
+    // While a level is changing, the kernels use a level of 1 and the ramp is
+    // applied to the whole buffer instead, before or after the kernels. Once
+    // the ramp is done, the kernels apply the level themselves again.
+    bool inputRamping = inputLevel.isRamping();
+    bool outputRamping = outputLevel.isRamping();
+    for (auto& kernel : kernels) {
+        kernel.inputLevel = inputRamping ? 1.0 : inputLevel.getTarget();
+        kernel.outputLevel = outputRamping ? 1.0 : outputLevel.getTarget();
+    }
+    for (auto& kernel : fadingKernels) {
+        kernel.inputLevel = inputRamping ? 1.0 : inputLevel.getTarget();
+        kernel.outputLevel = outputRamping ? 1.0 : outputLevel.getTarget();
+    }
+
+    // Coming out of bypass, the kernels and the oversampler filters still
+    // have the state from before it. Start them over on the input of the last
+    // few milliseconds instead, so that the crossfade fades in what they
+    // would be putting out by now. The same goes for the new kernels after
+    // the oversampling factor changes.
+    if (bypass.needsPriming()) {
+        crossfade.reset();
+        kernelsNeedPriming = true;
+        bypass.clearPriming();
+    }
+    if (kernelsNeedPriming) {
+        primeKernels<SampleType>(numChannels);
+        kernelsNeedPriming = false;
+    }
 
-    if (bypassed) { return; }
-
-    const float* inL = buffer.getReadPointer(0);
-    const float* inR = buffer.getReadPointer(1);
-    float* outL = buffer.getWritePointer(0);
-    float* outR = buffer.getWritePointer(1);
-
-    // Calculate the length of the delay line. Could go into prepareToPlay().
-    // At 44.1 and 48 kHz, the delay is only one sample. At higher sampling rates,
-    // the delay is longer and so the smoothing takes place over a longer time.
-    double overallscale = getSampleRate() / 44100.0;
-    int spacing = std::floor(overallscale);
-    if (spacing < 1) { spacing = 1; }
-    if (spacing > 16) { spacing = 16; }
-
-    for (int i = 0; i < buffer.getNumSamples(); ++i) {
-        double inputSampleL = inL[i] * inputLevel;
-        double inputSampleR = inR[i] * inputLevel;
-
-        // Used by Airwindows dithering, which I disabled for the JUCE version.
-        //if (std::abs(inputSampleL) < 1.18e-23) { inputSampleL = fpdL * 1.18e-17; }
-        //if (std::abs(inputSampleR) < 1.18e-23) { inputSampleR = fpdR * 1.18e-17; }
-
-        // Calculate the linear interpolation coefficient that's used to mix
-        // inputSample with lastSample. If we're not clipping, this is 1.0 and
-        // lastSample is ignored. However, the heavier inputSample clips, the
-        // more lastSample is blended in, which smoothens the transition.
-        // Think of softSpeed as the look-ahead value for how much to correct
-        // the next sample.
-        double softSpeed = std::abs(inputSampleL);
-        if (softSpeed < 1.0) { softSpeed = 1.0; } else { softSpeed = 1.0 / softSpeed; }
-
-        // Hard clip to -pi/2 and +pi/2 for the sin() waveshaper.
-        if (inputSampleL > 1.57079633) { inputSampleL = 1.57079633; }
-        if (inputSampleL < -1.57079633) { inputSampleL = -1.57079633; }
-
-        // Apply the waveshaper and scale to the clipping level of -0.4 dB.
-        inputSampleL = std::sin(inputSampleL) * 0.9549925859;
-
-        // Blend between the waveshaped input sample and the running value.
-        // This only uses lastSample when the input is too loud / clipping.
-        inputSampleL = inputSampleL * softSpeed + lastSampleL * (1.0 - softSpeed);
-
-        // As in ClipOnly2, this shifts the incoming sample into the delay line
-        // and puts the value that got shifted out into lastSample, so that on
-        // the next timestep we'll use that for smoothing. This delay exists so
-        // that on higher sampling rates, the high end is not overly bright.
-        intermediateL[spacing] = inputSampleL;
-        inputSampleL = lastSampleL;
-        for (int x = spacing; x > 0; x--) {
-            intermediateL[x - 1] = intermediateL[x];
+    bypass.pushInput(channels, numChannels, numSamples);
+
+    if (inputRamping) { inputLevel.process(channels, numChannels, numSamples); }
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.measureInput(channels, numChannels, numSamples, inputRamping ? 1.0 : inputLevel.getTarget());
+   #endif
+
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        // With an odd number of channels, the last channel goes into both lanes.
+        // Both lanes then see the same input and compute the same output.
+        int other = std::min(channel + 1, numChannels - 1);
+        size_t pair = size_t(channel / 2);
+        if (crossfade.isFading()) {
+            processPairFading(pair, buffer.getReadPointer(channel), buffer.getReadPointer(other),
+                              buffer.getWritePointer(channel), buffer.getWritePointer(other), numSamples);
+        } else {
+            processPair(kernels[pair], oversamplers[pair], buffer.getReadPointer(channel), buffer.getReadPointer(other),
+                        buffer.getWritePointer(channel), buffer.getWritePointer(other), numSamples);
         }
-        lastSampleL = intermediateL[0];
-
-        // Same for right channel.
-        softSpeed = std::abs(inputSampleR);
-        if (softSpeed < 1.0) { softSpeed = 1.0; } else { softSpeed = 1.0 / softSpeed; }
-        if (inputSampleR > 1.57079633) { inputSampleR = 1.57079633; }
-        if (inputSampleR < -1.57079633) { inputSampleR = -1.57079633; }
-        inputSampleR = std::sin(inputSampleR) * 0.9549925859;
-        inputSampleR = inputSampleR * softSpeed + lastSampleR * (1.0 - softSpeed);
-        intermediateR[spacing] = inputSampleR;
-        inputSampleR = lastSampleR;
-        for (int x = spacing; x > 0; x--) {
-            intermediateR[x - 1] = intermediateR[x];
+    }
+    crossfade.advance(numSamples);
+
+    if (outputRamping) { outputLevel.process(channels, numChannels, numSamples); }
+    if (dithering) { dither.process(channels, numChannels, numSamples); }
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    telemetry.measureOutput(channels, numChannels, numSamples);
+   #endif
+
+    bypass.crossfade(channels, numChannels, numSamples);
+}
+
+template<typename SampleType>
+void AudioProcessor::primeKernels(int numChannels)
+{
+    constexpr int chunkSize = 64;
+    SampleType a[chunkSize];
+    SampleType b[chunkSize];
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        auto& kernel = kernels[size_t(channel / 2)];
+        auto& oversampler = oversamplers[size_t(channel / 2)];
+        int other = std::min(channel + 1, numChannels - 1);
+        kernel.reset();
+        oversampler.reset();
+        for (int start = 0; start < Bypass::historyLength; start += chunkSize) {
+            bypass.getHistory(channel, start, a, chunkSize);
+            bypass.getHistory(other, start, b, chunkSize);
+            processPair(kernel, oversampler, a, b, a, b, chunkSize);
         }
-        lastSampleR = intermediateR[0];
+    }
+}
 
-        /*
-        // 32 bit stereo floating point dither. Disabled this for the JUCE
-        // version, since it's unrelated to the logic of the plug-in itself.
-        int expon; frexpf((float)inputSampleL, &expon);
-        fpdL ^= fpdL << 13; fpdL ^= fpdL >> 17; fpdL ^= fpdL << 5;
-        inputSampleL += ((double(fpdL)-uint32_t(0x7fffffff)) * 5.5e-36l * pow(2,expon+62));
-        frexpf((float)inputSampleR, &expon);
-        fpdR ^= fpdR << 13; fpdR ^= fpdR >> 17; fpdR ^= fpdR << 5;
-        inputSampleR += ((double(fpdR)-uint32_t(0x7fffffff)) * 5.5e-36l * pow(2,expon+62));
-        */
+template<typename SampleType>
+void AudioProcessor::processPair(Kernel& kernel, Oversampler& oversampler, const SampleType* inA, const SampleType* inB,
+                                 SampleType* outA, SampleType* outB, int numSamples)
+{
+    if (oversampler.getFactor() == 1) {
+        CpuDispatch::Kernel<Kernel, SampleType>::get(isaLevel)(kernel, inA, inB, outA, outB, numSamples);
+        return;
+    }
 
-        // At this point, inputSample holds the value that was shifted out
-        // of the delay line, so this has been delayed by `spacing` samples.
-        outL[i] = inputSampleL * outputLevel;
-        outR[i] = inputSampleR * outputLevel;
+    // The kernel runs on the oversampler's buffers, in double precision.
+    // Blocks larger than what the buffers were allocated for are split up.
+    auto processOversampled = CpuDispatch::Kernel<Kernel, double>::get(isaLevel);
+    for (int start = 0; start < numSamples; start += oversampler.getMaxBlockSize()) {
+        int count = std::min(numSamples - start, oversampler.getMaxBlockSize());
+        int length = oversampler.upsample(inA + start, inB + start, count);
+        double* bufferA = oversampler.getBufferA();
+        double* bufferB = oversampler.getBufferB();
+        processOversampled(kernel, bufferA, bufferB, bufferA, bufferB, length);
+        oversampler.downsample(outA + start, outB + start, count);
+    }
+}
+
+template<typename SampleType>
+void AudioProcessor::processPairFading(size_t pair, const SampleType* inA, const SampleType* inB,
+                                       SampleType* outA, SampleType* outB, int numSamples)
+{
+    // The new kernels work in place, so the old ones get a copy of the input.
+    constexpr int chunkSize = 64;
+    SampleType a[chunkSize];
+    SampleType b[chunkSize];
+    for (int start = 0; start < numSamples; start += chunkSize) {
+        int count = std::min(chunkSize, numSamples - start);
+        std::copy(inA + start, inA + start + count, a);
+        std::copy(inB + start, inB + start + count, b);
+        processPair(fadingKernels[pair], fadingOversamplers[pair], a, b, a, b, count);
+        processPair(kernels[pair], oversamplers[pair], inA + start, inB + start, outA + start, outB + start, count);
+        crossfade.mix(a, outA + start, start, count);
+        if (outB != outA) { crossfade.mix(b, outB + start, start, count); }
     }
 }
 
@@ -163,14 +396,36 @@ juce::AudioProcessorEditor* AudioProcessor::createEditor()
 
 void AudioProcessor::getStateInformation(juce::MemoryBlock& destData)
 {
-    copyXmlToBinary(*apvts.copyState().createXml(), destData);
+    auto& parameters = getParameters();
+    CompactState::Writer writer(parameters.size());
+    for (auto* parameter : parameters) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        writer.add(ranged->getParameterID().toRawUTF8(), ranged->convertFrom0to1(ranged->getValue()));
+    }
+    destData.replaceAll(writer.getBytes().data(), writer.getBytes().size());
 }
 
 void AudioProcessor::setStateInformation(const void* data, int sizeInBytes)
 {
-    std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
-    if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
-        apvts.replaceState(juce::ValueTree::fromXml(*xml));
+    // Sessions that were saved by older versions of the plug-in have XML.
+    if (!CompactState::isCompact(data, size_t(sizeInBytes))) {
+        std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
+        if (xml.get() != nullptr && xml->hasTagName(apvts.state.getType())) {
+            apvts.replaceState(juce::ValueTree::fromXml(*xml));
+        }
+        return;
+    }
+
+    CompactState::Reader reader(data, size_t(sizeInBytes));
+    if (!reader.isValid()) { return; }
+
+    // Like replaceState() does with the XML, parameters that are not in the
+    // state go back to their default value.
+    for (auto* parameter : getParameters()) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        float value = ranged->convertFrom0to1(ranged->getDefaultValue());
+        reader.find(ranged->getParameterID().toRawUTF8(), value);
+        ranged->setValueNotifyingHost(ranged->convertTo0to1(value));
     }
 }
 
@@ -197,10 +452,33 @@ juce::AudioProcessorValueTreeState::ParameterLayout AudioProcessor::createParame
         0.0f,
         juce::AudioParameterFloatAttributes().withLabel("dB")));
 
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("FastMath", 1),
+        "Fast Math",
+        false));
+
+    layout.add(std::make_unique<juce::AudioParameterChoice>(
+        juce::ParameterID("Oversampling", 1),
+        "Oversampling",
+        juce::StringArray { "Off", "2x", "4x", "8x" },
+        0,
+        juce::AudioParameterChoiceAttributes().withAutomatable(false)));
+
+    layout.add(std::make_unique<juce::AudioParameterBool>(
+        juce::ParameterID("Dither", 1),
+        "Dither",
+        false));
+
     return layout;
 }
 
+}  // namespace ClipSoftly
+
+// Only the plug-in projects define JucePlugin_Name. The other projects that
+// compile this file, such as the batch renderer, create the processor directly.
+#ifdef JucePlugin_Name
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
-    return new AudioProcessor();
+    return new ClipSoftly::AudioProcessor();
 }
+#endif
@@ -1,8 +1,25 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Shared/ClipSoftlyKernel.h"
+#include "../../Shared/Bypass.h"
+#include "../../Shared/Crossfade.h"
+#include "../../Shared/GainRamp.h"
 
-class AudioProcessor : public juce::AudioProcessor
+#if AIRWINDOWS_CLIP_TELEMETRY
+    #include "../../Shared/ClipTelemetry.h"
+#endif
+#include "../../Shared/Oversampler.h"
+#include "../../Shared/CacheAligned.h"
+#include "../../Shared/CompactState.h"
+#include "../../Shared/CpuDispatch.h"
+#include "../../Shared/FloatDither.h"
+
+namespace ClipSoftly {
+
+class alignas(CacheAligned::lineSize) AudioProcessor : public juce::AudioProcessor,
+                                                       private juce::AudioProcessorValueTreeState::Listener,
+                                                       private juce::AsyncUpdater
 {
 public:
     AudioProcessor();
@@ -14,13 +31,15 @@ public:
     void releaseResources() override;
     void reset() override;
     void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override { return true; }
 
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
     juce::AudioProcessorEditor* createEditor() override;
 
     bool hasEditor() const override { return true; }
-    const juce::String getName() const override { return JucePlugin_Name; }
+    const juce::String getName() const override { return "ClipSoftly"; }
     bool acceptsMidi() const override { return false; }
     bool producesMidi() const override { return false; }
     bool isMidiEffect() const override { return false; }
@@ -32,26 +51,97 @@ public:
     const juce::String getProgramName(int index) override { return {}; }
     void changeProgramName(int index, const juce::String& newName) override { }
 
+    // The instruction set that the kernels use, chosen in prepareToPlay().
+    CpuDispatch::Level getIsaLevel() const { return isaLevel; }
+
     juce::AudioProcessorValueTreeState apvts { *this, nullptr, "Parameters", createParameterLayout() };
 
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Gets the statistics for the next block that was processed. Call this
+    // from one thread only, for example from a timer on the message thread.
+    bool popClipStats(ClipTelemetry::BlockStats& stats) { return telemetry.pop(stats); }
+   #endif
+
 private:
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
 
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
     void update();
     void resetState();
 
-    bool bypassed;
-    float inputLevel;
-    float outputLevel;
+    int getOversamplingParameter() const;
+    int getLatencyFor(int factor) const;
+    void setOversampling(int factor);
+    void switchOversampling(int factor);
+
+    template<typename SampleType>
+    void process(juce::AudioBuffer<SampleType>& buffer);
+
+    template<typename SampleType>
+    void processSegment(juce::AudioBuffer<SampleType>& buffer);
+
+    // Starts the kernels and oversamplers over on the recent input.
+    template<typename SampleType>
+    void primeKernels(int numChannels);
+
+    // Runs one pair of channels through a kernel, and its oversampler if
+    // oversampling is on.
+    template<typename SampleType>
+    void processPair(Kernel& kernel, Oversampler& oversampler, const SampleType* inA, const SampleType* inB,
+                     SampleType* outA, SampleType* outB, int numSamples);
+
+    // The same, while fading from the previous oversampling factor.
+    template<typename SampleType>
+    void processPairFading(size_t pair, const SampleType* inA, const SampleType* inB,
+                           SampleType* outA, SampleType* outB, int numSamples);
 
-    double lastSampleL;
-    double intermediateL[17];
-    double lastSampleR;
-    double intermediateR[17];
+    // Set by parameterChanged(), which can be called from any thread, and
+    // cleared by the audio thread when it reads the new values in update().
+    std::atomic<bool> parametersChanged { true };
 
-    // Used by Airwindows dithering, which I disabled for the JUCE version.
-    //uint32_t fpdL;
-    //uint32_t fpdR;
+    std::atomic<float>* bypassParameter;
+    std::atomic<float>* inputParameter;
+    std::atomic<float>* outputParameter;
+    std::atomic<float>* fastMathParameter;
+    std::atomic<float>* oversamplingParameter;
+    std::atomic<float>* ditherParameter;
+
+    bool dithering;
+    bool fastMath;
+
+    // The levels as linear gains, which move smoothly to their new value
+    // when the Input or Output parameter changes.
+    GainRamp inputLevel;
+    GainRamp outputLevel;
+
+    double sampleRate = 44100.0;
+    int oversampling = 1;
+
+    // The algorithm and its state, for each pair of channels.
+    CacheAligned::Vector<Kernel> kernels;
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+    CacheAligned::Vector<Oversampler> oversamplers;
+
+    // After the oversampling factor changes, these still have the kernels and
+    // oversamplers for the old factor, to fade out from.
+    CacheAligned::Vector<Kernel> fadingKernels;
+    CacheAligned::Vector<Oversampler> fadingOversamplers;
+    Crossfade crossfade;
+    bool kernelsNeedPriming = false;
+
+    // Delays the audio while bypassed and crossfades when switching.
+    Bypass bypass;
+
+    // Adds the Airwindows dither to the output, when the Dither parameter is on.
+    FloatDither dither;
+
+   #if AIRWINDOWS_CLIP_TELEMETRY
+    // Counts the samples over 1.57079633, which is where the saturation is at its maximum.
+    ClipTelemetry::Meter telemetry { 1.57079633 };
+   #endif
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioProcessor)
 };
+
+}  // namespace ClipSoftly
@@ -0,0 +1,167 @@
+#include "AirwindowsKernels.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <variant>
+#include "BitShiftGainKernel.h"
+#include "ClipOnly2Kernel.h"
+#include "ClipOnlyKernel.h"
+#include "ClipSoftlyKernel.h"
+#include "CpuDispatch.h"
+
+// The C handle is simply whichever kernel was asked for. Every type takes up
+// the same amount of memory, so the caller doesn't need to know the type to
+// allocate it.
+struct airwindows_kernel
+{
+    std::variant<ClipOnly::Kernel, ClipOnly2::Kernel, ClipSoftly::Kernel, BitShiftGain::Kernel> kernel;
+
+    // The instruction set that process() uses, chosen when the kernel is created.
+    CpuDispatch::Level isaLevel = CpuDispatch::Level::generic;
+};
+
+namespace
+{
+    // The kernels count samples with an int, so very long buffers are split.
+    template<typename SampleType>
+    void processStereo(airwindows_kernel* handle, const SampleType* inA, const SampleType* inB,
+                       SampleType* outA, SampleType* outB, size_t numSamples)
+    {
+        std::visit([&](auto& kernel) {
+            using Kernel = std::decay_t<decltype(kernel)>;
+            auto process = CpuDispatch::Kernel<Kernel, SampleType>::get(handle->isaLevel);
+            while (numSamples > 0) {
+                int count = int(std::min(numSamples, size_t(INT_MAX)));
+                process(kernel, inA, inB, outA, outB, count);
+                inA += count; inB += count;
+                outA += count; outB += count;
+                numSamples -= size_t(count);
+            }
+        }, handle->kernel);
+    }
+}
+
+extern "C" {
+
+size_t airwindows_kernel_size(void)
+{
+    return sizeof(airwindows_kernel);
+}
+
+size_t airwindows_kernel_alignment(void)
+{
+    return alignof(airwindows_kernel);
+}
+
+airwindows_kernel* airwindows_kernel_init(void* memory, airwindows_kernel_type type, double sample_rate)
+{
+    if (memory == nullptr) { return nullptr; }
+    if (reinterpret_cast<std::uintptr_t>(memory) % alignof(airwindows_kernel) != 0) { return nullptr; }
+
+    airwindows_kernel* handle = new (memory) airwindows_kernel();
+    switch (type) {
+        case AIRWINDOWS_CLIPONLY: handle->kernel.emplace<ClipOnly::Kernel>(); break;
+        case AIRWINDOWS_CLIPONLY2: handle->kernel.emplace<ClipOnly2::Kernel>(); break;
+        case AIRWINDOWS_CLIPSOFTLY: handle->kernel.emplace<ClipSoftly::Kernel>(); break;
+        case AIRWINDOWS_BITSHIFTGAIN: handle->kernel.emplace<BitShiftGain::Kernel>(); break;
+        default: return nullptr;
+    }
+
+    std::visit([&](auto& kernel) { kernel.prepare(sample_rate); }, handle->kernel);
+    handle->isaLevel = CpuDispatch::select();
+    return handle;
+}
+
+void airwindows_kernel_reset(airwindows_kernel* handle)
+{
+    std::visit([](auto& kernel) { kernel.reset(); }, handle->kernel);
+}
+
+int airwindows_kernel_set_param(airwindows_kernel* handle, airwindows_param param, double value)
+{
+    if (auto* kernel = std::get_if<BitShiftGain::Kernel>(&handle->kernel)) {
+        if (param != AIRWINDOWS_PARAM_BIT_SHIFT) { return -1; }
+        kernel->bits = int(std::clamp(value, -32.0, 32.0));
+        return 0;
+    }
+
+    if (auto* kernel = std::get_if<ClipSoftly::Kernel>(&handle->kernel)) {
+        if (param == AIRWINDOWS_PARAM_FAST_MATH) {
+            kernel->fastMath = value != 0.0;
+            return 0;
+        }
+    }
+
+    if (param != AIRWINDOWS_PARAM_INPUT_GAIN && param != AIRWINDOWS_PARAM_OUTPUT_GAIN) { return -1; }
+
+    // The three clippers all have the same gain parameters.
+    return std::visit([&](auto& kernel) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(kernel)>, BitShiftGain::Kernel>) {
+            return -1;
+        } else {
+            if (param == AIRWINDOWS_PARAM_INPUT_GAIN) {
+                kernel.inputLevel = value;
+            } else {
+                kernel.outputLevel = value;
+            }
+            return 0;
+        }
+    }, handle->kernel);
+}
+
+int airwindows_kernel_latency(const airwindows_kernel* handle)
+{
+    return std::visit([](const auto& kernel) { return kernel.getLatency(); }, handle->kernel);
+}
+
+void airwindows_kernel_process_stereo_f32(airwindows_kernel* handle,
+                                          const float* in_left, const float* in_right,
+                                          float* out_left, float* out_right, size_t num_samples)
+{
+    processStereo(handle, in_left, in_right, out_left, out_right, num_samples);
+}
+
+void airwindows_kernel_process_stereo_f64(airwindows_kernel* handle,
+                                          const double* in_left, const double* in_right,
+                                          double* out_left, double* out_right, size_t num_samples)
+{
+    processStereo(handle, in_left, in_right, out_left, out_right, num_samples);
+}
+
+void airwindows_kernel_process_mono_f32(airwindows_kernel* handle,
+                                        const float* in, float* out, size_t num_samples)
+{
+    processStereo(handle, in, in, out, out, num_samples);
+}
+
+void airwindows_kernel_process_mono_f64(airwindows_kernel* handle,
+                                        const double* in, double* out, size_t num_samples)
+{
+    processStereo(handle, in, in, out, out, num_samples);
+}
+
+long long airwindows_kernel_process_pcm(airwindows_kernel* handle, void* data,
+                                        airwindows_pcm_format format, size_t num_samples)
+{
+    auto* kernel = std::get_if<BitShiftGain::Kernel>(&handle->kernel);
+    if (kernel == nullptr || format < AIRWINDOWS_PCM_INT16 || format > AIRWINDOWS_PCM_INT32) { return -1; }
+
+    // The C enum has the same order as BitShift::PCMFormat.
+    auto pcmFormat = BitShift::PCMFormat(format);
+    auto* bytes = static_cast<unsigned char*>(data);
+    long long numInexact = 0;
+
+    while (num_samples > 0) {
+        int count = int(std::min(num_samples, size_t(INT_MAX)));
+        auto result = kernel->processPCM(bytes, pcmFormat, count);
+        numInexact += result.numOverflows + result.numUnderflows;
+        bytes += size_t(count) * size_t(BitShift::bytesPerSample(pcmFormat));
+        num_samples -= size_t(count);
+    }
+    return numInexact;
+}
+
+}  // extern "C"
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+    C interface to the JUCE-free kernels, for hosts that aren't written in C++
+    or that don't want to compile the templates themselves. Compile
+    AirwindowsKernels.cpp along with the host to use it.
+
+    The caller provides the memory for a kernel, so nothing here allocates.
+    A kernel processes one or two channels. For more channels, use several
+    kernels. None of the functions lock, and the process functions are safe
+    to call from a real-time audio thread. A kernel may not be used from
+    more than one thread at a time.
+
+    Like the plug-ins, the kernels assume that denormals are flushed to zero.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum airwindows_kernel_type
+{
+    AIRWINDOWS_CLIPONLY = 0,
+    AIRWINDOWS_CLIPONLY2 = 1,
+    AIRWINDOWS_CLIPSOFTLY = 2,
+    AIRWINDOWS_BITSHIFTGAIN = 3
+} airwindows_kernel_type;
+
+typedef enum airwindows_param
+{
+    AIRWINDOWS_PARAM_INPUT_GAIN = 0,    /* linear gain, ClipOnly, ClipOnly2, ClipSoftly */
+    AIRWINDOWS_PARAM_OUTPUT_GAIN = 1,   /* linear gain, ClipOnly, ClipOnly2, ClipSoftly */
+    AIRWINDOWS_PARAM_FAST_MATH = 2,     /* 0 or 1, ClipSoftly */
+    AIRWINDOWS_PARAM_BIT_SHIFT = 3      /* -32 to 32, BitShiftGain */
+} airwindows_param;
+
+/* Integer PCM formats, for airwindows_kernel_process_pcm(). */
+typedef enum airwindows_pcm_format
+{
+    AIRWINDOWS_PCM_INT16 = 0,           /* int16_t */
+    AIRWINDOWS_PCM_INT24_IN_32 = 1,     /* int32_t from -2^23 to 2^23 - 1 */
+    AIRWINDOWS_PCM_INT24_PACKED = 2,    /* 3 bytes, little-endian */
+    AIRWINDOWS_PCM_INT32 = 3            /* int32_t */
+} airwindows_pcm_format;
+
+typedef struct airwindows_kernel airwindows_kernel;
+
+/* The number of bytes and the alignment of the memory for any kernel. */
+size_t airwindows_kernel_size(void);
+size_t airwindows_kernel_alignment(void);
+
+/*
+    Creates a kernel in the given memory, which must be at least
+    airwindows_kernel_size() bytes and aligned to airwindows_kernel_alignment().
+    Returns NULL if the type is unknown or the memory is not suitable. There is
+    no matching destroy function: the kernel owns no resources, so the caller
+    can simply free or reuse the memory. This also picks the instruction set
+    that the kernel runs with, see CpuDispatch.h. It reads the environment the
+    first time, so don't call it from the audio thread.
+*/
+airwindows_kernel* airwindows_kernel_init(void* memory, airwindows_kernel_type type, double sample_rate);
+
+/* Clears the state, for example after the audio was interrupted. */
+void airwindows_kernel_reset(airwindows_kernel* kernel);
+
+/* Returns 0 on success, or -1 if this type of kernel has no such parameter. */
+int airwindows_kernel_set_param(airwindows_kernel* kernel, airwindows_param param, double value);
+
+/* How many samples the output is delayed by, as the plug-in reports it. */
+int airwindows_kernel_latency(const airwindows_kernel* kernel);
+
+/*
+    Processes `num_samples` samples. The output may be the same as the input.
+    For mono, the kernel uses both of its lanes for the same channel.
+*/
+void airwindows_kernel_process_stereo_f32(airwindows_kernel* kernel,
+                                          const float* in_left, const float* in_right,
+                                          float* out_left, float* out_right, size_t num_samples);
+
+void airwindows_kernel_process_stereo_f64(airwindows_kernel* kernel,
+                                          const double* in_left, const double* in_right,
+                                          double* out_left, double* out_right, size_t num_samples);
+
+void airwindows_kernel_process_mono_f32(airwindows_kernel* kernel,
+                                        const float* in, float* out, size_t num_samples);
+
+void airwindows_kernel_process_mono_f64(airwindows_kernel* kernel,
+                                        const double* in, double* out, size_t num_samples);
+
+/*
+    BitShiftGain only: shifts `num_samples` integer samples in place, without
+    converting them to floating-point. The samples may be interleaved. Samples
+    that don't fit after the shift are saturated. Returns the number of samples
+    that did not come out as exactly `x * 2^bits`, or -1 if this is not a
+    BitShiftGain kernel or the format is unknown.
+*/
+long long airwindows_kernel_process_pcm(airwindows_kernel* kernel, void* data,
+                                        airwindows_pcm_format format, size_t num_samples);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define AIRWINDOWS_BITSHIFT_MXCSR 1
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    #define AIRWINDOWS_BITSHIFT_FPCR 1
+#endif
+
+/*
+    Exact gain changes in steps of 6 dB, as used by BitShiftGain.
+
+    Multiplying by a power of two only changes the exponent of a floating-point
+    number, not its mantissa, so the result is exactly `x * 2^bits`. The only
+    exceptions are results that don't fit in the exponent: they either become
+    infinity (overflow) or end up below the smallest normal number (underflow),
+    where they lose bits or get flushed to zero. apply() counts such samples,
+    so the caller can tell when the output is no longer exact.
+
+    The loops are simple enough for the compiler to vectorize them.
+
+    Plug-ins process audio with flush-to-zero and denormals-are-zero turned
+    on (juce::ScopedNoDenormals). Then a subnormal input reads as 0, so it
+    would come out as 0 without being counted, and results that should be
+    subnormal would also be flushed. apply() turns both modes off while it
+    runs, so that it behaves the same whatever mode the caller is in.
+*/
+namespace BitShift
+{
+    /*
+        Turns off flush-to-zero and denormals-are-zero, and restores the mode
+        from before when it goes out of scope. This reads and writes the
+        control register, which takes a few cycles, so do it once per block.
+        On other CPUs it does nothing.
+    */
+    class ScopedDenormalsAllowed
+    {
+    public:
+       #if AIRWINDOWS_BITSHIFT_MXCSR
+        // Bit 6 is denormals-are-zero and bit 15 is flush-to-zero.
+        ScopedDenormalsAllowed() noexcept : previous(_mm_getcsr())
+        {
+            _mm_setcsr(previous & ~0x8040u);
+        }
+        ~ScopedDenormalsAllowed() noexcept { _mm_setcsr(previous); }
+
+    private:
+        unsigned int previous;
+       #elif AIRWINDOWS_BITSHIFT_FPCR
+        // Bit 24 (FZ) does both on ARM.
+        ScopedDenormalsAllowed() noexcept
+        {
+            __asm__ __volatile__("mrs %0, fpcr" : "=r"(previous));
+            std::uint64_t allowed = previous & ~(std::uint64_t(1) << 24);
+            __asm__ __volatile__("msr fpcr, %0" : : "r"(allowed));
+        }
+        ~ScopedDenormalsAllowed() noexcept { __asm__ __volatile__("msr fpcr, %0" : : "r"(previous)); }
+
+    private:
+        std::uint64_t previous;
+       #endif
+    };
+
+    // The number of samples that didn't come out as exactly `x * 2^bits`.
+    struct Result
+    {
+        int numOverflows = 0;
+        int numUnderflows = 0;
+    };
+
+    /*
+        Multiplies the samples by 2^bits, in place. Does nothing when bits is 0.
+
+        A sample overflows when it is finite but the result is not. It underflows
+        when it is not zero but the result is smaller than the smallest normal
+        number. Infinity, NaN, and zero are not counted, since they come out the
+        same as they went in.
+
+        2^bits itself is only a normal number for shifts from -126 to +127
+        (for float), so larger shifts are done in several passes. That is still
+        exact: shifting up is exact as long as nothing overflows, even for
+        subnormal numbers, and when shifting down every step lies between the
+        input and the result, so if the result is a normal number, so is every
+        step. Shifts are clamped to the range where at least one finite sample
+        could still come out finite and non-zero; beyond that, everything
+        overflows or underflows anyway.
+    */
+    template<typename T>
+    Result apply(T* data, int numSamples, int bits) noexcept
+    {
+        Result result;
+        if (bits == 0) { return result; }
+
+        ScopedDenormalsAllowed denormalsAllowed;
+
+        using Limits = std::numeric_limits<T>;
+        constexpr int maxStep = Limits::max_exponent - 1;
+        constexpr int minStep = Limits::min_exponent - 1;
+        constexpr int maxBits = Limits::max_exponent - Limits::min_exponent + Limits::digits;
+        bits = std::max(-maxBits, std::min(bits, maxBits));
+
+        // A sample overflows when |x| * 2^bits >= 2^max_exponent, and underflows
+        // when |x| * 2^bits < the smallest normal number. Both limits are exact
+        // powers of two. With a large positive shift, the underflow limit itself
+        // underflows to 0, which correctly means that no sample can underflow;
+        // with a large negative shift, the overflow limit becomes infinity.
+        const T overflowLimit = std::ldexp(T(1), Limits::max_exponent - bits);
+        const T underflowLimit = std::ldexp(Limits::min(), -bits);
+        const T infinity = Limits::infinity();
+
+        int step = std::max(minStep, std::min(bits, maxStep));
+        T scale = std::ldexp(T(1), step);
+
+        int numOverflows = 0;
+        int numUnderflows = 0;
+
+        for (int i = 0; i < numSamples; ++i) {
+            T x = data[i];
+            T a = std::abs(x);
+            numOverflows += int((a >= overflowLimit) & (a < infinity));
+            numUnderflows += int((a < underflowLimit) & (a > T(0)));
+            data[i] = x * scale;
+        }
+
+        for (bits -= step; bits != 0; bits -= step) {
+            step = std::max(minStep, std::min(bits, maxStep));
+            scale = std::ldexp(T(1), step);
+            for (int i = 0; i < numSamples; ++i) {
+                data[i] *= scale;
+            }
+        }
+
+        result.numOverflows = numOverflows;
+        result.numUnderflows = numUnderflows;
+        return result;
+    }
+}
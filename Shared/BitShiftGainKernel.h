@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstring>
+#include "BitShift.h"
+#include "BitShiftPCM.h"
+
+/*
+    The BitShiftGain algorithm, without any JUCE.
+
+    There is no state apart from the number of bits, so a single Kernel can
+    process any number of channels. It doesn't allocate and doesn't lock.
+*/
+namespace BitShiftGain {
+
+struct Kernel
+{
+    // The gain in steps of 6 dB. Positive is louder, negative is quieter.
+    int bits = 0;
+
+    void prepare(double sampleRate) noexcept { }
+    void reset() noexcept { }
+    int getLatency() const noexcept { return 0; }
+
+    // Processes one channel. The output may be the same as the input.
+    // Returns how many samples could not be shifted exactly.
+    template<typename SampleType>
+    BitShift::Result process(const SampleType* in, SampleType* out, int numSamples) noexcept
+    {
+        if (in != out) { std::memcpy(out, in, size_t(numSamples) * sizeof(SampleType)); }
+        return BitShift::apply(out, numSamples, bits);
+    }
+
+    template<typename SampleType>
+    BitShift::Result process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                             int numSamples) noexcept
+    {
+        BitShift::Result result = process(inA, outA, numSamples);
+        if (outB != outA) {
+            BitShift::Result other = process(inB, outB, numSamples);
+            result.numOverflows += other.numOverflows;
+            result.numUnderflows += other.numUnderflows;
+        }
+        return result;
+    }
+
+    // Shifts integer PCM samples where they are, without going through
+    // floating-point. The samples may be interleaved. See BitShiftPCM.h.
+    BitShift::Result processPCM(void* data, BitShift::PCMFormat format, int numSamples) noexcept
+    {
+        return BitShift::applyPCM(data, format, numSamples, bits);
+    }
+};
+
+}  // namespace BitShiftGain
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "BitShift.h"
+#include "DoublePair.h"
+
+/*
+    BitShiftGain for integer PCM, without any JUCE.
+
+    With integer samples, a gain of 6 dB really is a bit shift, so there is no
+    need to convert the audio to floating-point and back. For a bulk gain trim
+    of integer files, those conversions cost more than the gain itself. These
+    functions shift the samples where they are, in the formats that WAV files
+    and audio drivers use:
+
+        int16        16-bit samples
+        int24in32    24-bit samples in the low bits of a 32-bit integer,
+                     sign-extended, so the range is -2^23 to 2^23 - 1
+        int24Packed  24-bit samples of 3 bytes each, little-endian, as in
+                     24-bit WAV files
+        int32        32-bit samples
+
+    Every sample gets the same treatment, so the samples can be interleaved,
+    and a whole WAV data chunk can be done in one call.
+
+    Unlike with floats, the result doesn't always fit:
+
+    - Shifting left, samples that go past the largest or smallest value of the
+      format are saturated to that value. These are counted as overflows.
+    - Shifting right, the bits that fall off the end are rounded rather than
+      cut off, so the result is the nearest integer to `x * 2^bits`, with
+      halves rounded up. That's the same as converting the exact result back
+      to an integer, apart from how ties are broken, and it doesn't add a DC
+      offset of half a step like a plain shift would. Samples that were not 0
+      but end up as 0 are counted as underflows.
+
+    Every other sample comes out as exactly `x * 2^bits`. Shifts beyond ±32
+    bits are clamped to ±32, which already saturates or zeroes any sample.
+
+    The shifting itself is done 4 samples at a time with SSE2 or NEON. The
+    16-bit and packed 24-bit formats are widened to 32 bits in small chunks
+    first, which the compiler vectorizes, and narrowed again afterwards.
+*/
+namespace BitShift
+{
+    enum class PCMFormat
+    {
+        int16,
+        int24in32,
+        int24Packed,
+        int32
+    };
+
+    constexpr int bytesPerSample(PCMFormat format) noexcept
+    {
+        return format == PCMFormat::int16 ? 2 : (format == PCMFormat::int24Packed ? 3 : 4);
+    }
+
+    /*
+        Shifts 32-bit samples that are between `lowest` and `highest`, in place.
+        This does the real work for all of the formats.
+    */
+    inline Result applyInt(std::int32_t* data, int numSamples, int bits,
+                           std::int32_t lowest, std::int32_t highest) noexcept
+    {
+        Result result;
+        if (bits == 0) { return result; }
+        if (bits > 32) { bits = 32; }
+        if (bits < -32) { bits = -32; }
+
+        int numOverflows = 0;
+        int numUnderflows = 0;
+        int i = 0;
+
+        if (bits > 0) {
+            // Anything above highest >> bits or below lowest >> bits, rounded
+            // towards zero, doesn't fit after the shift.
+            const auto highestIn = std::int32_t(std::int64_t(highest) >> bits);
+            const auto lowestIn = std::int32_t(-((-std::int64_t(lowest)) >> bits));
+
+           #if AIRWINDOWS_DOUBLEPAIR_SSE2
+            const __m128i count = _mm_cvtsi32_si128(bits);
+            const __m128i high = _mm_set1_epi32(highest);
+            const __m128i low = _mm_set1_epi32(lowest);
+            const __m128i highIn = _mm_set1_epi32(highestIn);
+            const __m128i lowIn = _mm_set1_epi32(lowestIn);
+            __m128i overflows = _mm_setzero_si128();
+
+            for (; i + 4 <= numSamples; i += 4) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i tooHigh = _mm_cmpgt_epi32(x, highIn);
+                __m128i tooLow = _mm_cmplt_epi32(x, lowIn);
+                __m128i y = _mm_andnot_si128(_mm_or_si128(tooHigh, tooLow), _mm_sll_epi32(x, count));
+                y = _mm_or_si128(y, _mm_or_si128(_mm_and_si128(tooHigh, high), _mm_and_si128(tooLow, low)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), y);
+
+                // The masks are -1 where true, so subtracting them counts.
+                overflows = _mm_sub_epi32(overflows, _mm_or_si128(tooHigh, tooLow));
+            }
+
+            alignas(16) std::int32_t counts[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(counts), overflows);
+            numOverflows = counts[0] + counts[1] + counts[2] + counts[3];
+           #elif AIRWINDOWS_DOUBLEPAIR_NEON
+            const int32x4_t count = vdupq_n_s32(bits);
+            const int32x4_t high = vdupq_n_s32(highest);
+            const int32x4_t low = vdupq_n_s32(lowest);
+            const int32x4_t highIn = vdupq_n_s32(highestIn);
+            const int32x4_t lowIn = vdupq_n_s32(lowestIn);
+            uint32x4_t overflows = vdupq_n_u32(0);
+
+            for (; i + 4 <= numSamples; i += 4) {
+                int32x4_t x = vld1q_s32(data + i);
+                uint32x4_t tooHigh = vcgtq_s32(x, highIn);
+                uint32x4_t tooLow = vcltq_s32(x, lowIn);
+                int32x4_t y = vbslq_s32(tooHigh, high, vbslq_s32(tooLow, low, vshlq_s32(x, count)));
+                vst1q_s32(data + i, y);
+                overflows = vsubq_u32(overflows, vorrq_u32(tooHigh, tooLow));
+            }
+
+            numOverflows = int(vaddvq_u32(overflows));
+           #endif
+
+            for (; i < numSamples; ++i) {
+                std::int32_t x = data[i];
+                if (x > highestIn) {
+                    data[i] = highest;
+                    ++numOverflows;
+                } else if (x < lowestIn) {
+                    data[i] = lowest;
+                    ++numOverflows;
+                } else {
+                    data[i] = std::int32_t(std::uint64_t(x) << bits);
+                }
+            }
+        } else {
+            bits = -bits;
+
+            // Rounding to nearest is adding half a step before the shift. That
+            // could overflow, so instead the last bit that falls off is added
+            // after the shift, which gives the same result.
+           #if AIRWINDOWS_DOUBLEPAIR_SSE2
+            const __m128i count = _mm_cvtsi32_si128(bits);
+            const __m128i countMinusOne = _mm_cvtsi32_si128(bits - 1);
+            const __m128i one = _mm_set1_epi32(1);
+            const __m128i zero = _mm_setzero_si128();
+            __m128i underflows = _mm_setzero_si128();
+
+            for (; i + 4 <= numSamples; i += 4) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i y = _mm_add_epi32(_mm_sra_epi32(x, count), _mm_and_si128(_mm_sra_epi32(x, countMinusOne), one));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), y);
+
+                __m128i lost = _mm_andnot_si128(_mm_cmpeq_epi32(x, zero), _mm_cmpeq_epi32(y, zero));
+                underflows = _mm_sub_epi32(underflows, lost);
+            }
+
+            alignas(16) std::int32_t counts[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(counts), underflows);
+            numUnderflows = counts[0] + counts[1] + counts[2] + counts[3];
+           #elif AIRWINDOWS_DOUBLEPAIR_NEON
+            // NEON has a rounding shift that does exactly this.
+            const int32x4_t count = vdupq_n_s32(-bits);
+            uint32x4_t underflows = vdupq_n_u32(0);
+
+            for (; i + 4 <= numSamples; i += 4) {
+                int32x4_t x = vld1q_s32(data + i);
+                int32x4_t y = vrshlq_s32(x, count);
+                vst1q_s32(data + i, y);
+
+                uint32x4_t lost = vandq_u32(vmvnq_u32(vceqzq_s32(x)), vceqzq_s32(y));
+                underflows = vsubq_u32(underflows, lost);
+            }
+
+            numUnderflows = int(vaddvq_u32(underflows));
+           #endif
+
+            for (; i < numSamples; ++i) {
+                std::int32_t x = data[i];
+                auto y = std::int32_t((std::int64_t(x) + (std::int64_t(1) << (bits - 1))) >> bits);
+                numUnderflows += int((x != 0) & (y == 0));
+                data[i] = y;
+            }
+        }
+
+        result.numOverflows = numOverflows;
+        result.numUnderflows = numUnderflows;
+        return result;
+    }
+
+    inline Result applyInt32(std::int32_t* data, int numSamples, int bits) noexcept
+    {
+        return applyInt(data, numSamples, bits, INT32_MIN, INT32_MAX);
+    }
+
+    inline Result applyInt24in32(std::int32_t* data, int numSamples, int bits) noexcept
+    {
+        return applyInt(data, numSamples, bits, -(1 << 23), (1 << 23) - 1);
+    }
+
+    inline Result applyInt16(std::int16_t* data, int numSamples, int bits) noexcept
+    {
+        Result result;
+        if (bits == 0) { return result; }
+
+        constexpr int chunkSize = 256;
+        std::int32_t chunk[chunkSize];
+
+        for (int start = 0; start < numSamples; start += chunkSize) {
+            int count = std::min(chunkSize, numSamples - start);
+            std::int16_t* samples = data + start;
+
+            for (int i = 0; i < count; ++i) {
+                chunk[i] = samples[i];
+            }
+            Result partial = applyInt(chunk, count, bits, INT16_MIN, INT16_MAX);
+            for (int i = 0; i < count; ++i) {
+                samples[i] = std::int16_t(chunk[i]);
+            }
+
+            result.numOverflows += partial.numOverflows;
+            result.numUnderflows += partial.numUnderflows;
+        }
+        return result;
+    }
+
+    inline Result applyInt24Packed(std::uint8_t* data, int numSamples, int bits) noexcept
+    {
+        Result result;
+        if (bits == 0) { return result; }
+
+        constexpr int chunkSize = 256;
+        std::int32_t chunk[chunkSize];
+
+        for (int start = 0; start < numSamples; start += chunkSize) {
+            int count = std::min(chunkSize, numSamples - start);
+            std::uint8_t* bytes = data + size_t(start) * 3;
+
+            // Reading 4 bytes at a time is a lot faster than putting the
+            // samples together byte by byte, but the very last sample can't
+            // do that without reading past the end. Putting the 3 bytes in the
+            // top of a 32-bit integer and shifting back down extends the sign.
+            int numWords = (start + count == numSamples) ? count - 1 : count;
+            for (int i = 0; i < numWords; ++i) {
+                std::uint32_t word;
+                std::memcpy(&word, bytes + i*3, 4);
+                chunk[i] = std::int32_t(word << 8) >> 8;
+            }
+            for (int i = numWords; i < count; ++i) {
+                std::uint32_t word = (std::uint32_t(bytes[i*3]) << 8)
+                                   | (std::uint32_t(bytes[i*3 + 1]) << 16)
+                                   | (std::uint32_t(bytes[i*3 + 2]) << 24);
+                chunk[i] = std::int32_t(word) >> 8;
+            }
+
+            Result partial = applyInt(chunk, count, bits, -(1 << 23), (1 << 23) - 1);
+
+            // Writing 4 bytes also changes the first byte of the next sample,
+            // but that sample is written next, so this only works up to the
+            // last sample of the chunk.
+            for (int i = 0; i < count - 1; ++i) {
+                auto word = std::uint32_t(chunk[i]);
+                std::memcpy(bytes + i*3, &word, 4);
+            }
+            bytes[(count - 1)*3] = std::uint8_t(chunk[count - 1]);
+            bytes[(count - 1)*3 + 1] = std::uint8_t(chunk[count - 1] >> 8);
+            bytes[(count - 1)*3 + 2] = std::uint8_t(chunk[count - 1] >> 16);
+
+            result.numOverflows += partial.numOverflows;
+            result.numUnderflows += partial.numUnderflows;
+        }
+        return result;
+    }
+
+    // Shifts `numSamples` samples of the given format, in place.
+    inline Result applyPCM(void* data, PCMFormat format, int numSamples, int bits) noexcept
+    {
+        switch (format) {
+            case PCMFormat::int16: return applyInt16(static_cast<std::int16_t*>(data), numSamples, bits);
+            case PCMFormat::int24in32: return applyInt24in32(static_cast<std::int32_t*>(data), numSamples, bits);
+            case PCMFormat::int24Packed: return applyInt24Packed(static_cast<std::uint8_t*>(data), numSamples, bits);
+            case PCMFormat::int32: return applyInt32(static_cast<std::int32_t*>(data), numSamples, bits);
+        }
+        return {};
+    }
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "CacheAligned.h"
+
+/*
+    Switches a plug-in in and out of bypass without a click.
+
+    The clippers delay their output by a few samples, and with oversampling
+    by tens of samples. If bypass simply leaves the buffer alone, the audio
+    jumps by that many samples when bypass is switched, which clicks, and
+    the bypassed signal no longer lines up with the latency that the host
+    compensates for. Here the bypassed audio gets the same delay as the
+    processed audio, and switching goes through a short crossfade between
+    the two. Since both have the same delay, they line up in the crossfade.
+
+    The plug-in uses it like this:
+
+        - While isBypassed(), call processBypassed() instead of the kernels.
+          This only delays the audio, which costs about as much as a memcpy.
+        - Otherwise call pushInput() before the kernels, and crossfade() after.
+        - When needsPriming() is true, the kernels were not running until now.
+          Reset them and run the input from getHistory() through them first,
+          so that their state is what it would have been had they been
+          running all along, then call clearPriming().
+        - A crossfade must not end halfway through a call, so the plug-in
+          splits its blocks with getSegmentLength().
+
+    Every sample that goes in is kept for `historyLength` samples, which is
+    how long the delay can be. It's also enough to fill the delay lines of
+    the kernels and the filters of the oversampler again when priming.
+    Nothing here allocates except prepare().
+*/
+class Bypass
+{
+public:
+    static constexpr int historyLength = 256;
+
+    // 10 ms is short enough that the switch sounds immediate, and long enough
+    // that it doesn't click.
+    void prepare(double sampleRate, int numChannels, double fadeSeconds = 0.01)
+    {
+        fadeLength = std::max(1, int(sampleRate * fadeSeconds));
+        channels = std::max(1, numChannels);
+        history.assign(size_t(channels * historyLength), 0.0);
+        dry.assign(size_t(channels * fadeLength), 0.0);
+        head.assign(size_t(historyLength), 0.0);
+        reset();
+    }
+
+    // Clears the history and finishes any crossfade that is going on.
+    void reset() noexcept
+    {
+        std::fill(history.begin(), history.end(), 0.0);
+        position = 0;
+        fadePosition = bypassed ? fadeLength : 0;
+        priming = false;
+    }
+
+    // The delay of the processed audio, at most historyLength samples.
+    void setDelay(int samples) noexcept
+    {
+        delay = std::min(std::max(samples, 0), historyLength);
+    }
+
+    // Starts a crossfade to the new state. The first call after prepare()
+    // jumps there instead, since there is nothing to fade from yet.
+    void setBypassed(bool shouldBeBypassed) noexcept
+    {
+        if (!initialized) {
+            initialized = true;
+            bypassed = shouldBeBypassed;
+            fadePosition = bypassed ? fadeLength : 0;
+            return;
+        }
+        if (shouldBeBypassed == bypassed) { return; }
+
+        // Coming out of a bypass that was complete, the kernels haven't seen
+        // any of the recent input.
+        if (!shouldBeBypassed && fadePosition == fadeLength) { priming = true; }
+        bypassed = shouldBeBypassed;
+    }
+
+    // Fully bypassed: the kernels don't need to run at all.
+    bool isBypassed() const noexcept { return bypassed && fadePosition == fadeLength; }
+    bool isFading() const noexcept { return fadePosition != (bypassed ? fadeLength : 0); }
+
+    bool needsPriming() const noexcept { return priming; }
+    void clearPriming() noexcept { priming = false; }
+
+    // How many of the next `numSamples` samples can go in one call: up to the
+    // end of the crossfade, if there is one.
+    int getSegmentLength(int numSamples) const noexcept
+    {
+        if (!isFading()) { return numSamples; }
+        int remaining = bypassed ? fadeLength - fadePosition : fadePosition;
+        return std::min(numSamples, remaining);
+    }
+
+    // Copies `count` samples of the input before the last call, oldest first,
+    // starting `start` samples after the oldest one that is kept.
+    template<typename T>
+    void getHistory(int channel, int start, T* dest, int count) const noexcept
+    {
+        const double* ring = history.data() + size_t(channel * historyLength);
+        int index = (position + start) % historyLength;
+
+        // The samples wrap around the end of the ring at most once.
+        int first = std::min(count, historyLength - index);
+        for (int i = 0; i < first; ++i) {
+            dest[i] = T(ring[index + i]);
+        }
+        for (int i = first; i < count; ++i) {
+            dest[i] = T(ring[i - first]);
+        }
+    }
+
+    // Delays the audio in place.
+    template<typename T>
+    void processBypassed(T* const* data, int numChannels, int numSamples) noexcept
+    {
+        numChannels = std::min(numChannels, channels);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            delayChannel(channel, data[channel], data[channel], numSamples);
+        }
+        position = (position + numSamples) % historyLength;
+    }
+
+    // Keeps the input, before the kernels overwrite it. In a crossfade, this
+    // also keeps the delayed input to fade to or from.
+    template<typename T>
+    void pushInput(const T* const* data, int numChannels, int numSamples) noexcept
+    {
+        numChannels = std::min(numChannels, channels);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            if (isFading()) {
+                delayChannel(channel, data[channel], dry.data() + size_t(channel * fadeLength), numSamples);
+            } else {
+                write(channel, data[channel], numSamples);
+            }
+        }
+        position = (position + numSamples) % historyLength;
+    }
+
+    /*
+        Mixes the delayed input that pushInput() kept into the processed
+        audio, and moves the crossfade forward. The gains go in a straight
+        line and add up to 1, which is right since the two signals are
+        mostly the same.
+    */
+    template<typename T>
+    void crossfade(T* const* data, int numChannels, int numSamples) noexcept
+    {
+        if (!isFading()) { return; }
+
+        const int step = bypassed ? 1 : -1;
+        const double scale = 1.0 / double(fadeLength);
+        numChannels = std::min(numChannels, channels);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            T* out = data[channel];
+            const double* in = dry.data() + size_t(channel * fadeLength);
+            for (int i = 0; i < numSamples; ++i) {
+                double gain = double(fadePosition + step * (i + 1)) * scale;
+                out[i] = T(double(out[i]) + (in[i] - double(out[i])) * gain);
+            }
+        }
+        fadePosition += step * numSamples;
+    }
+
+private:
+    // Adds the input to the history of the channel. Only the last
+    // historyLength samples matter.
+    template<typename T>
+    void write(int channel, const T* in, int numSamples) noexcept
+    {
+        double* ring = history.data() + size_t(channel * historyLength);
+        int skip = std::max(0, numSamples - historyLength);
+        int index = (position + skip) % historyLength;
+        int count = numSamples - skip;
+
+        int first = std::min(count, historyLength - index);
+        for (int i = 0; i < first; ++i) {
+            ring[index + i] = double(in[skip + i]);
+        }
+        for (int i = first; i < count; ++i) {
+            ring[i - first] = double(in[skip + i]);
+        }
+    }
+
+    // Writes the input delayed by `delay` samples to `out`, which may be the
+    // same as `in`, and adds the input to the history.
+    template<typename In, typename Out>
+    void delayChannel(int channel, const In* in, Out* out, int numSamples) noexcept
+    {
+        // The first samples that come out are still in the history. Grab
+        // them before write() replaces them.
+        int numHead = std::min(numSamples, delay);
+        getHistory(channel, historyLength - delay, head.data(), numHead);
+        write(channel, in, numSamples);
+
+        // The rest is the input itself, moved up by the delay. Going from the
+        // end backwards works in place.
+        if constexpr (std::is_same_v<In, Out>) {
+            if (numSamples > delay) {
+                std::memmove(out + delay, in, size_t(numSamples - delay) * sizeof(Out));
+            }
+        } else {
+            for (int i = numSamples - 1; i >= delay; --i) {
+                out[i] = Out(in[i - delay]);
+            }
+        }
+        for (int i = 0; i < numHead; ++i) {
+            out[i] = Out(head[size_t(i)]);
+        }
+    }
+
+    int fadeLength = 1;
+    int channels = 1;
+    int delay = 0;
+
+    // The input of every channel, historyLength samples each. The oldest
+    // sample is at `position`, which is also where the next one goes.
+    CacheAligned::Vector<double> history;
+    int position = 0;
+
+    // The delayed input during a crossfade, fadeLength samples per channel.
+    CacheAligned::Vector<double> dry;
+    CacheAligned::Vector<double> head;
+
+    bool initialized = false;
+    bool bypassed = false;
+    bool priming = false;
+
+    // How far the crossfade has gone towards bypass: 0 is processing and
+    // fadeLength is bypassed.
+    int fadePosition = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/*
+    Keeps the state of one plug-in instance out of the cache lines of any
+    other instance.
+
+    When a host runs many instances on several cores, two instances whose
+    state happens to sit next to each other in memory can end up sharing a
+    cache line, and then every write by one core throws that line out of the
+    cache of the other, even though they never touch each other's data.
+
+    Everything that the audio thread writes to during a block is allocated
+    with this: the kernels, oversamplers, meters, and the buffers of the
+    bypass delay and the dither. The memory starts on a cache line and takes
+    up whole cache lines, so nothing else ends up in the first or last one.
+    The processors themselves are aligned to a cache line for the same
+    reason.
+*/
+namespace CacheAligned
+{
+    // The size of a cache line on current x86 and ARM processors.
+    constexpr std::size_t lineSize = 64;
+
+    template<typename T>
+    struct Allocator
+    {
+        using value_type = T;
+
+        Allocator() noexcept = default;
+        template<typename U> Allocator(const Allocator<U>&) noexcept { }
+
+        T* allocate(std::size_t n)
+        {
+            return static_cast<T*>(::operator new(roundUp(n * sizeof(T)), std::align_val_t(lineSize)));
+        }
+
+        void deallocate(T* p, std::size_t n) noexcept
+        {
+            ::operator delete(p, roundUp(n * sizeof(T)), std::align_val_t(lineSize));
+        }
+
+        template<typename U> bool operator==(const Allocator<U>&) const noexcept { return true; }
+        template<typename U> bool operator!=(const Allocator<U>&) const noexcept { return false; }
+
+    private:
+        static std::size_t roundUp(std::size_t bytes) noexcept
+        {
+            return (bytes + lineSize - 1) / lineSize * lineSize;
+        }
+    };
+
+    template<typename T>
+    using Vector = std::vector<T, Allocator<T>>;
+}
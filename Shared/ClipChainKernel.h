@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <variant>
+#include "ClipOnlyKernel.h"
+#include "ClipOnly2Kernel.h"
+#include "ClipSoftlyKernel.h"
+
+/*
+    Several clippers in series, without any JUCE.
+
+    Mastering chains often put ClipSoftly in front of ClipOnly2 (Pop2 does the
+    same thing inside one plug-in). As separate plug-ins, every clipper makes
+    its own pass over the whole buffer. The chain instead works through the
+    buffer in sub-blocks that are small enough to stay in the L1 cache, and
+    runs all the stages on one sub-block before moving on to the next. Only
+    the first stage reads the input and only the last one is left to write
+    the output to memory.
+
+    The stages run exactly as they would as separate plug-ins, so the result
+    is bit-identical to putting those plug-ins one after the other. With float
+    buffers, that includes rounding to float between the stages.
+
+    The input level is applied by the first stage and the output level by the
+    last stage. The stages in between run at unity gain.
+
+    Like the other kernels, this holds the state for one or two channels, and
+    process() doesn't allocate or lock. Changing a stage doesn't allocate
+    either, since every stage has room for any of the clippers.
+*/
+namespace ClipChain {
+
+enum class Stage
+{
+    off,
+    clipOnly,
+    clipOnly2,
+    clipSoftly
+};
+
+struct Kernel
+{
+    static constexpr int maxStages = 4;
+
+    // The number of samples that all stages process before moving on.
+    static constexpr int subBlockSize = 64;
+
+    // Linear gains that are applied before the first stage and after the last.
+    double inputLevel = 1.0;
+    double outputLevel = 1.0;
+
+    // Fast Math for any ClipSoftly stages.
+    bool fastMath = false;
+
+    void prepare(double sampleRate) noexcept
+    {
+        this->sampleRate = sampleRate;
+        for (auto& stage : stages) {
+            std::visit([&](auto& kernel) { prepareKernel(kernel); }, stage);
+        }
+    }
+
+    void reset() noexcept
+    {
+        for (auto& stage : stages) {
+            std::visit([](auto& kernel) { resetKernel(kernel); }, stage);
+        }
+    }
+
+    // Replaces the clipper at the given position. If it's a different type of
+    // clipper than before, the new one starts out with a cleared state.
+    void setStage(int index, Stage type) noexcept
+    {
+        auto& stage = stages[index];
+        if (type == getStage(index)) { return; }
+
+        switch (type) {
+            case Stage::off: stage.emplace<std::monostate>(); break;
+            case Stage::clipOnly: stage.emplace<ClipOnly::Kernel>(); break;
+            case Stage::clipOnly2: stage.emplace<ClipOnly2::Kernel>(); break;
+            case Stage::clipSoftly: stage.emplace<ClipSoftly::Kernel>(); break;
+        }
+        std::visit([&](auto& kernel) { prepareKernel(kernel); }, stage);
+    }
+
+    Stage getStage(int index) const noexcept
+    {
+        return Stage(stages[index].index());
+    }
+
+    // The sum of the latencies of the stages, which the host only needs to
+    // hear about once. As in the ClipOnly plug-in, a ClipOnly stage doesn't
+    // count its one sample of delay.
+    int getLatency() const noexcept
+    {
+        int latency = 0;
+        for (const auto& stage : stages) {
+            latency += std::visit([](const auto& kernel) { return latencyOf(kernel); }, stage);
+        }
+        return latency;
+    }
+
+    // What getLatency() would be with a stage of this type at this sample
+    // rate, without having to set one up.
+    static int getLatencyFor(Stage type, double sampleRate) noexcept
+    {
+        switch (type) {
+            case Stage::clipOnly2: return ClipOnly2::Kernel::getSpacing(sampleRate);
+            case Stage::clipSoftly: return ClipSoftly::Kernel::getSpacing(sampleRate);
+            default: return 0;
+        }
+    }
+
+    // How much a stage of this type really delays the audio, which for a
+    // ClipOnly stage is one sample more than its latency.
+    static int getDelayFor(Stage type, double sampleRate) noexcept
+    {
+        return getLatencyFor(type, sampleRate) + (type == Stage::clipOnly ? 1 : 0);
+    }
+
+    // Processes two channels at once. The output may be the same as the input.
+    // For a single channel, pass the same pointers for both channels.
+    template<typename SampleType>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples) noexcept;
+
+    template<typename SampleType>
+    void process(const SampleType* in, SampleType* out, int numSamples) noexcept
+    {
+        process(in, in, out, out, numSamples);
+    }
+
+private:
+    using AnyKernel = std::variant<std::monostate, ClipOnly::Kernel, ClipOnly2::Kernel, ClipSoftly::Kernel>;
+
+    template<typename K>
+    void prepareKernel(K& kernel) noexcept { kernel.prepare(sampleRate); }
+    void prepareKernel(std::monostate&) noexcept { }
+
+    template<typename K>
+    static void resetKernel(K& kernel) noexcept { kernel.reset(); }
+    static void resetKernel(std::monostate&) noexcept { }
+
+    template<typename K>
+    static int latencyOf(const K& kernel) noexcept { return kernel.getLatency(); }
+    static int latencyOf(const std::monostate&) noexcept { return 0; }
+
+    AnyKernel stages[maxStages];
+    double sampleRate = 44100.0;
+};
+
+template<typename SampleType>
+void Kernel::process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                     int numSamples) noexcept
+{
+    // Find the stages that are in use, and give the input and output levels
+    // to the first and last of them.
+    AnyKernel* active[maxStages];
+    int numActive = 0;
+    for (auto& stage : stages) {
+        if (!std::holds_alternative<std::monostate>(stage)) {
+            active[numActive++] = &stage;
+        }
+    }
+
+    if (numActive == 0) {
+        for (int i = 0; i < numSamples; ++i) {
+            outA[i] = SampleType((inA[i] * inputLevel) * outputLevel);
+            outB[i] = SampleType((inB[i] * inputLevel) * outputLevel);
+        }
+        return;
+    }
+
+    for (int s = 0; s < numActive; ++s) {
+        std::visit([&](auto& kernel) {
+            if constexpr (!std::is_same_v<std::decay_t<decltype(kernel)>, std::monostate>) {
+                kernel.inputLevel = (s == 0) ? inputLevel : 1.0;
+                kernel.outputLevel = (s == numActive - 1) ? outputLevel : 1.0;
+                if constexpr (std::is_same_v<std::decay_t<decltype(kernel)>, ClipSoftly::Kernel>) {
+                    kernel.fastMath = fastMath;
+                }
+            }
+        }, *active[s]);
+    }
+
+    // The first stage reads from the input and writes the output buffer. The
+    // other stages work in place on the output, while it is still in cache.
+    for (int start = 0; start < numSamples; start += subBlockSize) {
+        int count = std::min(numSamples - start, subBlockSize);
+        const SampleType* fromA = inA + start;
+        const SampleType* fromB = inB + start;
+        SampleType* toA = outA + start;
+        SampleType* toB = outB + start;
+
+        for (int s = 0; s < numActive; ++s) {
+            std::visit([&](auto& kernel) {
+                if constexpr (!std::is_same_v<std::decay_t<decltype(kernel)>, std::monostate>) {
+                    kernel.process(fromA, fromB, toA, toB, count);
+                }
+            }, *active[s]);
+            fromA = toA;
+            fromB = toB;
+        }
+    }
+}
+
+}  // namespace ClipChain
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "DoublePair.h"
+#include "RingDelay.h"
+#include "TruePeak.h"
+#include "UnclippedSpans.h"
+
+/*
+    The ClipOnly2 algorithm, without any JUCE.
+
+    A Kernel holds the state for one or two channels. It doesn't allocate and
+    doesn't lock, so process() is safe to call from a real-time audio thread.
+    Call prepare() with the sample rate before processing, and reset() when
+    the audio is interrupted.
+
+    The ClipOnly2 plug-in is a thin wrapper around this, with one Kernel for
+    every pair of channels.
+*/
+namespace ClipOnly2 {
+
+// Not in the original plug-in. See Kernel::truePeakMode.
+enum class TruePeakMode
+{
+    off,     // the original algorithm
+    meter,   // also estimate the true peak of the output
+    limit    // also lower the clip level where the output would go over
+};
+
+struct Kernel
+{
+    // Length of the delay line in samples. This is 17 at 768 kHz.
+    static constexpr int maxSpacing = 17;
+
+    // Linear gains that are applied before and after clipping. These are not
+    // in the original plug-in but are useful for testing.
+    double inputLevel = 1.0;
+    double outputLevel = 1.0;
+
+    int spacing = 1;
+
+    // In the limit mode, tightens the clipping to keep the intersample peaks
+    // below the clip level. Off and meter are bit-exact with the original;
+    // the plug-in meters its final output itself. The limit mode adds 12
+    // samples of latency, so call prepare() again after changing the mode.
+    TruePeakMode truePeakMode = TruePeakMode::off;
+
+    // The state, one channel per lane. The clip flags are stored as masks
+    // with all bits set when the flag is true.
+    DoublePair lastSample;
+    DoublePair wasPosClip;
+    DoublePair wasNegClip;
+    RingDelay<DoublePair, maxSpacing> intermediate;
+
+    // The ceiling for the true peak is the clip level.
+    TruePeak::Lookahead lookahead { 0.9549925859 };
+
+    // The length of the delay line is however many samples equals one 44.1k
+    // sample, rounded down to an integer: 1 at 44.1 and 48 kHz, 2 at 88.2 and
+    // 96 kHz, and so on, up to 17 at 768 kHz.
+    static int getSpacing(double sampleRate) noexcept
+    {
+        double overallscale = sampleRate / 44100.0;
+        int spacing = int(std::floor(overallscale));
+        if (spacing < 1) { spacing = 1; }
+        if (spacing > maxSpacing) { spacing = maxSpacing; }
+        return spacing;
+    }
+
+    void prepare(double sampleRate) noexcept
+    {
+        spacing = getSpacing(sampleRate);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        lastSample = DoublePair();
+        wasPosClip = DoublePair();
+        wasNegClip = DoublePair();
+        intermediate.reset();
+        lookahead.reset();
+    }
+
+    // The output is delayed by `spacing` samples, plus the lookahead of the
+    // true-peak limit mode.
+    int getLatency() const noexcept
+    {
+        return spacing + (truePeakMode == TruePeakMode::limit ? TruePeak::Lookahead::latency : 0);
+    }
+
+    // Processes two channels at once. The output may be the same as the input.
+    // For a single channel, pass the same pointers for both channels.
+    template<typename SampleType>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples) noexcept
+    {
+        UnclippedSpans::NoProbe probe;
+        process(inA, inB, outA, outB, numSamples, probe);
+    }
+
+    template<typename SampleType>
+    void process(const SampleType* in, SampleType* out, int numSamples) noexcept
+    {
+        process(in, in, out, out, numSamples);
+    }
+
+    // The same, and tells the probe about every sample that goes in and out,
+    // for ClipTelemetry::Probe. In the true-peak limit mode the clipper sees
+    // the input late and scaled, so then the probe isn't told anything.
+    template<typename SampleType, typename Probe>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples, Probe& probe) noexcept;
+
+    template<typename SampleType, int Spacing, typename Probe>
+    void processSpacing(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                        int numSamples, Probe& probe) noexcept;
+
+    template<typename SampleType, int Spacing, bool Limit, typename Probe>
+    void processPair(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                     int numSamples, Probe& probe) noexcept;
+};
+
+template<typename SampleType, typename Probe>
+void Kernel::process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                     int numSamples, Probe& probe) noexcept
+{
+    /*
+        This works very much like ClipOnly, where samples that don't clip are
+        not changed, while edges between non-clipping and clipping are softened
+        using a simple interpolation filter.
+
+        The difference is that at higher sampling rates ClipOnly2 uses a longer
+        window for softening such transitions.
+
+        The latency at 44.1 or 48 kHz is 1 sample. At higher sampling rates the
+        latency is however many samples equals one 44.1k sample, rounded down to
+        an integer multiple. Unlike ClipOnly, this latency is reported to the
+        host (see getLatency).
+    */
+
+    // Each delay length has its own copy of the processing loop, so that the
+    // ring buffer's wrap-around is resolved at compile time.
+    switch (spacing) {
+        case 1: processSpacing<SampleType, 1>(inA, inB, outA, outB, numSamples, probe); break;
+        case 2: processSpacing<SampleType, 2>(inA, inB, outA, outB, numSamples, probe); break;
+        case 3: processSpacing<SampleType, 3>(inA, inB, outA, outB, numSamples, probe); break;
+        case 4: processSpacing<SampleType, 4>(inA, inB, outA, outB, numSamples, probe); break;
+        case 5: processSpacing<SampleType, 5>(inA, inB, outA, outB, numSamples, probe); break;
+        case 6: processSpacing<SampleType, 6>(inA, inB, outA, outB, numSamples, probe); break;
+        case 7: processSpacing<SampleType, 7>(inA, inB, outA, outB, numSamples, probe); break;
+        case 8: processSpacing<SampleType, 8>(inA, inB, outA, outB, numSamples, probe); break;
+        case 9: processSpacing<SampleType, 9>(inA, inB, outA, outB, numSamples, probe); break;
+        case 10: processSpacing<SampleType, 10>(inA, inB, outA, outB, numSamples, probe); break;
+        case 11: processSpacing<SampleType, 11>(inA, inB, outA, outB, numSamples, probe); break;
+        case 12: processSpacing<SampleType, 12>(inA, inB, outA, outB, numSamples, probe); break;
+        case 13: processSpacing<SampleType, 13>(inA, inB, outA, outB, numSamples, probe); break;
+        case 14: processSpacing<SampleType, 14>(inA, inB, outA, outB, numSamples, probe); break;
+        case 15: processSpacing<SampleType, 15>(inA, inB, outA, outB, numSamples, probe); break;
+        case 16: processSpacing<SampleType, 16>(inA, inB, outA, outB, numSamples, probe); break;
+        case 17: processSpacing<SampleType, 17>(inA, inB, outA, outB, numSamples, probe); break;
+    }
+}
+
+template<typename SampleType, int Spacing, typename Probe>
+void Kernel::processSpacing(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                            int numSamples, Probe& probe) noexcept
+{
+    if (truePeakMode == TruePeakMode::limit) {
+        UnclippedSpans::NoProbe noProbe;
+        processPair<SampleType, Spacing, true>(inA, inB, outA, outB, numSamples, noProbe);
+    } else {
+        processPair<SampleType, Spacing, false>(inA, inB, outA, outB, numSamples, probe);
+    }
+}
+
+template<typename SampleType, int Spacing, bool Limit, typename Probe>
+void Kernel::processPair(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                         int numSamples, Probe& probe) noexcept
+{
+    /*
+        Two channels are processed together, one per lane of a DoublePair.
+        Instead of if-statements, both outcomes of every decision are computed
+        and select() picks the right one for each channel. The arithmetic is
+        the same as in the scalar version, so the output is bit-identical.
+
+        The constants are hardcoded but are the same as in ClipOnly, e.g.
+        0.9549925859 is the reference level of -0.4 dB and 0.7058208 is
+        `refclip * hardness`.
+
+        The copying of unclipped spans below is the part that runs as a
+        separate vectorized pass. Once the audio clips, nearly all of the time
+        goes into the chain of selects that updates lastSample and the clip
+        flags, which has to go sample by sample. Applying the gain and the
+        clamp to [-4, 4] in a separate pass doesn't make that chain any shorter.
+
+        In the true-peak limit mode, the clipper runs 12 samples behind the
+        input, so that the lookahead can see intersample overs coming. Where
+        it predicts one, the samples around the over and the clip level for
+        them are lowered together. This mode doesn't copy unclipped spans,
+        since any sample may need to be turned down.
+    */
+
+    const DoublePair refHard = DoublePair::broadcast(0.7058208);
+    const DoublePair refSoft = DoublePair::broadcast(0.2491717);
+    const DoublePair posRefclip = DoublePair::broadcast(0.9549925859);
+    const DoublePair negRefclip = DoublePair::broadcast(-0.9549925859);
+    const DoublePair hard = DoublePair::broadcast(0.7390851);
+    const DoublePair soft = DoublePair::broadcast(0.2609148);
+    const DoublePair posLimit = DoublePair::broadcast(4.0);
+    const DoublePair negLimit = DoublePair::broadcast(-4.0);
+    const DoublePair inputGain = DoublePair::broadcast(inputLevel);
+    const DoublePair outputGain = DoublePair::broadcast(outputLevel);
+
+    DoublePair lastSample = this->lastSample;
+    DoublePair wasPosClip = this->wasPosClip;
+    DoublePair wasNegClip = this->wasNegClip;
+
+    const SampleType threshold = UnclippedSpans::thresholdFor<SampleType>(0.9549925859);
+
+    // Copying only pays off for longer spans. When a span is too short, the
+    // audio is probably clipping a lot, and the samples go through the clipper
+    // one by one for a while before we look for a span again.
+    const int minSpan = std::max(16, 2 * Spacing);
+    const int backoff = 32;
+
+    int i = 0;
+    int nextScan = 0;
+    while (i < numSamples) {
+        // While the clip flags are cleared, look for a span of samples that
+        // stay below the threshold. These samples come out unchanged, only
+        // delayed by `spacing` samples and multiplied by the output level.
+        int span = 0;
+        SampleType spanPeakA = 0;
+        SampleType spanPeakB = 0;
+        if (!Limit && i >= nextScan) {
+            if (!(wasPosClip | wasNegClip).anyTrue()) {
+                if constexpr (Probe::enabled) {
+                    span = UnclippedSpans::countBelow(inA + i, inB + i, numSamples - i, inputLevel, threshold,
+                                                      spanPeakA, spanPeakB);
+                } else {
+                    span = UnclippedSpans::countBelow(inA + i, inB + i, numSamples - i, inputLevel, threshold);
+                }
+            }
+            if (span < minSpan) { nextScan = i + backoff; }
+        }
+
+        if (span >= minSpan) {
+            // The last `Spacing` samples of the span are what the delay line
+            // should hold afterwards. Grab them before they get overwritten.
+            DoublePair tail[Spacing];
+            for (int k = 0; k < Spacing; ++k) {
+                int j = i + span - Spacing + k;
+                tail[k] = DoublePair::roundTo<SampleType>(DoublePair::set(inA[j], inB[j]) * inputGain);
+            }
+
+            UnclippedSpans::delayedCopy<SampleType>(inA + i, outA + i, Spacing, span - Spacing, inputLevel, outputLevel);
+            if (outB != outA) {
+                UnclippedSpans::delayedCopy<SampleType>(inB + i, outB + i, Spacing, span - Spacing, inputLevel, outputLevel);
+            }
+
+            if constexpr (Probe::enabled) {
+                // The tail comes out later, so for now it only counts towards
+                // the input peak.
+                DoublePair tailPeak;
+                for (int k = 0; k < Spacing; ++k) {
+                    tailPeak = DoublePair::max(tailPeak, DoublePair::abs(tail[k]));
+                }
+                SampleType outputPeakA = UnclippedSpans::outputPeak(spanPeakA, SampleType(tailPeak.first()),
+                                                                    outA + i + Spacing, span - Spacing, outputLevel);
+                SampleType outputPeakB = outputPeakA;
+                if (outB != outA) {
+                    outputPeakB = UnclippedSpans::outputPeak(spanPeakB, SampleType(tailPeak.second()),
+                                                             outB + i + Spacing, span - Spacing, outputLevel);
+                }
+                probe.unclipped(DoublePair::set(spanPeakA, spanPeakB), DoublePair::set(outputPeakA, outputPeakB));
+            }
+
+            // The first `Spacing` samples of the span output what was still
+            // in the delay line. What gets pushed doesn't matter here, since
+            // the delay line is filled with the tail of the span afterwards.
+            for (int end = i + Spacing; i < end; ++i) {
+                DoublePair outputSample = lastSample * outputGain;
+                lastSample = intermediate.push<Spacing>(DoublePair());
+                outA[i] = SampleType(outputSample.first());
+                outB[i] = SampleType(outputSample.second());
+                probe.output(DoublePair::roundTo<SampleType>(outputSample));
+            }
+
+            lastSample = tail[0];
+            intermediate.fill<Spacing>(tail + 1);
+            i += span - Spacing;
+        } else {
+            // Run the samples through the clipper one at a time.
+            int end = Limit ? numSamples : std::min(numSamples, nextScan);
+            for (; i < end; ++i) {
+                // The input gain is applied in the precision of the buffer. For
+                // float buffers that matches the original.
+                DoublePair inputSample = DoublePair::roundTo<SampleType>(DoublePair::set(inA[i], inB[i]) * inputGain);
+                probe.input(inputSample);
+
+                inputSample = DoublePair::min(inputSample, posLimit);
+                inputSample = DoublePair::max(inputSample, negLimit);
+
+                DoublePair hardLevel = refHard;
+                DoublePair softLevel = refSoft;
+                DoublePair posLevel = posRefclip;
+                DoublePair negLevel = negRefclip;
+
+                if constexpr (Limit) {
+                    // Scaling the sample and the four levels, which are all
+                    // proportional to the clip level, by the same amount scales
+                    // what comes out of the clipper by that amount too.
+                    DoublePair scale;
+                    inputSample = lookahead.push(inputSample, scale) * scale;
+                    hardLevel = refHard * scale;
+                    softLevel = refSoft * scale;
+                    posLevel = posRefclip * scale;
+                    negLevel = negRefclip * scale;
+                }
+
+                // Most samples don't clip. When neither channel is clipping or about
+                // to clip, the clip flags stay cleared and the sample passes through
+                // untouched, so we can skip the clipping logic altogether.
+                DoublePair clipping = wasPosClip | wasNegClip
+                                    | DoublePair::greaterThan(inputSample, posLevel)
+                                    | DoublePair::lessThan(inputSample, negLevel);
+
+                if (clipping.anyTrue()) {
+                    // Same logic as ClipOnly: if we were clipping, move lastSample towards
+                    // the new sample or towards the max level; if the new sample clips,
+                    // replace it by a value between lastSample and the max level.
+                    DoublePair towards = DoublePair::select(DoublePair::lessThan(inputSample, lastSample),
+                                                            hardLevel + inputSample * soft,
+                                                            softLevel + lastSample * hard);
+                    lastSample = DoublePair::select(wasPosClip, towards, lastSample);
+
+                    wasPosClip = DoublePair::greaterThan(inputSample, posLevel);
+                    inputSample = DoublePair::select(wasPosClip, hardLevel + lastSample * soft, inputSample);
+
+                    towards = DoublePair::select(DoublePair::greaterThan(inputSample, lastSample),
+                                                 inputSample * soft - hardLevel,
+                                                 lastSample * hard - softLevel);
+                    lastSample = DoublePair::select(wasNegClip, towards, lastSample);
+
+                    wasNegClip = DoublePair::lessThan(inputSample, negLevel);
+                    inputSample = DoublePair::select(wasNegClip, lastSample * soft - hardLevel, inputSample);
+                }
+
+                // Push the incoming sample into the delay line, and put the oldest value
+                // from the delay line into lastSample, so that on the next timestep we'll
+                // use that for smoothing. At 44.1 and 48 kHz, ClipOnly2 should give the
+                // same output as ClipOnly, since that also uses a delay of one sample.
+                // At higher sampling rates, the delay is longer and so the smoothing
+                // takes place over a longer time.
+                DoublePair outputSample = lastSample * outputGain;
+                lastSample = intermediate.push<Spacing>(inputSample);
+
+                // The output has been delayed by `spacing` samples.
+                outA[i] = SampleType(outputSample.first());
+                outB[i] = SampleType(outputSample.second());
+                probe.output(DoublePair::roundTo<SampleType>(outputSample));
+            }
+        }
+    }
+
+    this->lastSample = lastSample;
+    this->wasPosClip = wasPosClip;
+    this->wasNegClip = wasNegClip;
+}
+
+}  // namespace ClipOnly2
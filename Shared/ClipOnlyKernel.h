@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include "DoublePair.h"
+#include "UnclippedSpans.h"
+
+/*
+    The ClipOnly algorithm, without any JUCE.
+
+    A Kernel holds the state for one or two channels and has no other
+    dependencies, so it can be embedded in any host. It doesn't allocate and
+    doesn't lock, so process() is safe to call from a real-time audio thread.
+    Set the levels directly, and call reset() when the audio is interrupted.
+
+    The ClipOnly plug-in is a thin wrapper around this, with one Kernel for
+    every pair of channels.
+*/
+namespace ClipOnly {
+
+struct Kernel
+{
+    // Linear gains that are applied before and after clipping. These are not
+    // in the original plug-in but are useful for testing.
+    double inputLevel = 1.0;
+    double outputLevel = 1.0;
+
+    // The state, one channel per lane. When processing float buffers, the
+    // values in lastSample are rounded to float precision. The clip flags
+    // are stored as masks with all bits set when the flag is true.
+    DoublePair lastSample;
+    DoublePair wasPosClip;
+    DoublePair wasNegClip;
+
+    // ClipOnly doesn't depend on the sample rate.
+    void prepare(double sampleRate) noexcept
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        lastSample = DoublePair();
+        wasPosClip = DoublePair();
+        wasNegClip = DoublePair();
+    }
+
+    // The output is delayed by one sample, but by design ClipOnly does not
+    // report this to the host. See process() for why.
+    int getLatency() const noexcept { return 0; }
+
+    // Processes two channels at once. The output may be the same as the input.
+    // For a single channel, pass the same pointers for both channels.
+    template<typename SampleType>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples) noexcept
+    {
+        UnclippedSpans::NoProbe probe;
+        process(inA, inB, outA, outB, numSamples, probe);
+    }
+
+    // The same, and tells the probe about every sample that goes in and out,
+    // for ClipTelemetry::Probe.
+    template<typename SampleType, typename Probe>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples, Probe& probe) noexcept;
+
+    template<typename SampleType>
+    void process(const SampleType* in, SampleType* out, int numSamples) noexcept
+    {
+        process(in, in, out, out, numSamples);
+    }
+
+};
+
+template<typename SampleType, typename Probe>
+void Kernel::process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                     int numSamples, Probe& probe) noexcept
+{
+    double hardness = 0.7390851332151606;  // x == cos(x)
+    double softness = 1.0 - hardness;      // 0.260915
+    double refclip = 0.9549925859;         // -0.2dB (is actually -0.4 dB!)
+
+    /*
+        How this works:
+
+        The output is delayed by one sample time, so that we can look ahead to
+        see if the next sample will clip or will stop clipping.
+
+        (By design, the plug-in does not declare this one sample of latency to
+        the host, as this makes it nicer to record through without having to deal
+        with latency compensation.)
+
+        The idea is to leave samples that are not clipping alone, and change only
+        those samples that go from not-clipping to clipping, and from clipping to
+        not-clipping, by "slowing down" the trajectory rather than doing a hard
+        transition.
+
+        The transition is rounded by blending between the last known non-clipping
+        value and the max level of 0.955 using a linear interpolation, which you
+        can also think of as a simple filter. Since we round off the hard corners,
+        the result is that the brightness of the high end is reduced when clipping.
+    */
+
+    /*
+        Two channels are processed together, one per lane of a DoublePair.
+        Instead of if-statements, both outcomes of every decision are computed
+        and select() picks the right one for each channel, so the two channels
+        can take different branches in the same instruction.
+
+        For float buffers, the state has float precision, like in the original
+        plug-in, which is why the results are rounded to float precision wherever
+        the scalar version would store into a float variable. That keeps the
+        output bit-identical. For double buffers, nothing is rounded.
+    */
+
+    const DoublePair refHard = DoublePair::broadcast(refclip * hardness);
+    const DoublePair refSoft = DoublePair::broadcast(refclip * softness);
+    const DoublePair posRefclip = DoublePair::broadcast(refclip);
+    const DoublePair negRefclip = DoublePair::broadcast(-refclip);
+    const DoublePair hard = DoublePair::broadcast(hardness);
+    const DoublePair soft = DoublePair::broadcast(softness);
+    const DoublePair posLimit = DoublePair::broadcast(4.0);
+    const DoublePair negLimit = DoublePair::broadcast(-4.0);
+    const DoublePair inputGain = DoublePair::broadcast(inputLevel);
+    const DoublePair outputGain = DoublePair::broadcast(outputLevel);
+
+    DoublePair lastSample = this->lastSample;
+    DoublePair wasPosClip = this->wasPosClip;
+    DoublePair wasNegClip = this->wasNegClip;
+
+    const SampleType threshold = UnclippedSpans::thresholdFor<SampleType>(refclip);
+
+    // Copying only pays off for longer spans. When a span is too short, the
+    // audio is probably clipping a lot, and the samples go through the clipper
+    // one by one for a while before we look for a span again.
+    const int minSpan = 16;
+    const int backoff = 32;
+
+    int i = 0;
+    int nextScan = 0;
+    while (i < numSamples) {
+        // While the clip flags are cleared, look for a span of samples that
+        // stay below the threshold. These samples come out unchanged, only
+        // delayed by one sample and multiplied by the output level.
+        int span = 0;
+        SampleType spanPeakA = 0;
+        SampleType spanPeakB = 0;
+        if (i >= nextScan) {
+            if (!(wasPosClip | wasNegClip).anyTrue()) {
+                if constexpr (Probe::enabled) {
+                    span = UnclippedSpans::countBelow(inA + i, inB + i, numSamples - i, inputLevel, threshold,
+                                                      spanPeakA, spanPeakB);
+                } else {
+                    span = UnclippedSpans::countBelow(inA + i, inB + i, numSamples - i, inputLevel, threshold);
+                }
+            }
+            if (span < minSpan) { nextScan = i + backoff; }
+        }
+
+        if (span >= minSpan) {
+            // Grab the last sample of the span before it gets overwritten.
+            // It becomes lastSample for the next sample after the span.
+            int last = i + span - 1;
+            DoublePair newLastSample = DoublePair::roundTo<SampleType>(DoublePair::set(inA[last], inB[last]) * inputGain);
+
+            UnclippedSpans::delayedCopy<SampleType>(inA + i, outA + i, 1, span - 1, inputLevel, outputLevel);
+            if (outB != outA) {
+                UnclippedSpans::delayedCopy<SampleType>(inB + i, outB + i, 1, span - 1, inputLevel, outputLevel);
+            }
+
+            if constexpr (Probe::enabled) {
+                // All but the last sample of the span came out, and that one
+                // only counts towards the input peak for now.
+                SampleType outputPeakA = UnclippedSpans::outputPeak(spanPeakA, SampleType(std::abs(newLastSample.first())),
+                                                                    outA + i + 1, span - 1, outputLevel);
+                SampleType outputPeakB = outputPeakA;
+                if (outB != outA) {
+                    outputPeakB = UnclippedSpans::outputPeak(spanPeakB, SampleType(std::abs(newLastSample.second())),
+                                                             outB + i + 1, span - 1, outputLevel);
+                }
+                probe.unclipped(DoublePair::set(spanPeakA, spanPeakB), DoublePair::set(outputPeakA, outputPeakB));
+            }
+
+            // The first sample of the span outputs the old lastSample.
+            DoublePair outputSample = lastSample * outputGain;
+            outA[i] = SampleType(outputSample.first());
+            outB[i] = SampleType(outputSample.second());
+            probe.output(DoublePair::roundTo<SampleType>(outputSample));
+            lastSample = newLastSample;
+            i += span;
+        } else {
+            // Run the samples through the clipper one at a time.
+            int end = std::min(numSamples, nextScan);
+            for (; i < end; ++i) {
+                DoublePair inputSample = DoublePair::roundTo<SampleType>(DoublePair::set(inA[i], inB[i]) * inputGain);
+                probe.input(inputSample);
+
+                inputSample = DoublePair::min(inputSample, posLimit);
+                inputSample = DoublePair::max(inputSample, negLimit);
+
+                // Most samples don't clip. When neither channel is clipping or about
+                // to clip, the clip flags stay cleared and the sample passes through
+                // untouched, so we can skip the clipping logic altogether.
+                DoublePair clipping = wasPosClip | wasNegClip
+                                    | DoublePair::greaterThan(inputSample, posRefclip)
+                                    | DoublePair::lessThan(inputSample, negRefclip);
+
+                if (clipping.anyTrue()) {
+                    // Are we currently clipping? If the new sample is not clipping,
+                    // transition towards it. If we're still clipping, keep moving towards
+                    // the max level.
+                    DoublePair towards = DoublePair::select(DoublePair::lessThan(inputSample, lastSample),
+                                                            inputSample * soft + refHard,
+                                                            lastSample * hard + refSoft);
+                    lastSample = DoublePair::select(wasPosClip, DoublePair::roundTo<SampleType>(towards), lastSample);
+
+                    // Look ahead: If the new sample will clip, ignore it and move
+                    // the current non-clipping value a bit towards the max level.
+                    wasPosClip = DoublePair::greaterThan(inputSample, posRefclip);
+                    inputSample = DoublePair::select(wasPosClip,
+                                                     DoublePair::roundTo<SampleType>(lastSample * soft + refHard),
+                                                     inputSample);
+
+                    // Are we clipping in the negative direction?
+                    towards = DoublePair::select(DoublePair::greaterThan(inputSample, lastSample),
+                                                 inputSample * soft - refHard,
+                                                 lastSample * hard - refSoft);
+                    lastSample = DoublePair::select(wasNegClip, DoublePair::roundTo<SampleType>(towards), lastSample);
+
+                    wasNegClip = DoublePair::lessThan(inputSample, negRefclip);
+                    inputSample = DoublePair::select(wasNegClip,
+                                                     DoublePair::roundTo<SampleType>(lastSample * soft - refHard),
+                                                     inputSample);
+                }
+
+                DoublePair outputSample = lastSample * outputGain;
+                outA[i] = SampleType(outputSample.first());
+                outB[i] = SampleType(outputSample.second());
+                probe.output(DoublePair::roundTo<SampleType>(outputSample));
+                lastSample = inputSample;
+            }
+        }
+    }
+
+    this->lastSample = lastSample;
+    this->wasPosClip = wasPosClip;
+    this->wasNegClip = wasNegClip;
+}
+
+}  // namespace ClipOnly
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "DoublePair.h"
+#include "FastMath.h"
+#include "RingDelay.h"
+
+/*
+    The ClipSoftly algorithm, without any JUCE.
+
+    A Kernel holds the state for one or two channels. It doesn't allocate and
+    doesn't lock, so process() is safe to call from a real-time audio thread.
+    Call prepare() with the sample rate before processing, and reset() when
+    the audio is interrupted.
+
+    The ClipSoftly plug-in is a thin wrapper around this, with one Kernel for
+    every pair of channels.
+*/
+namespace ClipSoftly {
+
+struct Kernel
+{
+    // Length of the delay line in samples. This is 17 at 768 kHz.
+    static constexpr int maxSpacing = 17;
+
+    // Linear gains that are applied before and after clipping. These are not
+    // in the original plug-in but are useful for testing.
+    double inputLevel = 1.0;
+    double outputLevel = 1.0;
+
+    // Not in the original plug-in either: trades exactness for speed.
+    bool fastMath = false;
+
+    int spacing = 1;
+
+    // The state, one channel per lane.
+    DoublePair lastSample;
+    RingDelay<DoublePair, maxSpacing> intermediate;
+
+    // Used by Airwindows dithering, which I disabled for the JUCE version.
+    //uint32_t fpdL;
+    //uint32_t fpdR;
+
+    // Calculate the length of the delay line. At 44.1 and 48 kHz, the delay is
+    // only one sample. At higher sampling rates, the delay is longer and so the
+    // smoothing takes place over a longer time. At 768 kHz it is 17 samples.
+    static int getSpacing(double sampleRate) noexcept
+    {
+        double overallscale = sampleRate / 44100.0;
+        int spacing = int(std::floor(overallscale));
+        if (spacing < 1) { spacing = 1; }
+        if (spacing > maxSpacing) { spacing = maxSpacing; }
+        return spacing;
+    }
+
+    void prepare(double sampleRate) noexcept
+    {
+        spacing = getSpacing(sampleRate);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        lastSample = DoublePair();
+        intermediate.reset();
+
+        // Used by Airwindows dithering, which I disabled for the JUCE version.
+        //fpdL = 1.0; while (fpdL < 16386) fpdL = rand()*UINT32_MAX;
+        //fpdR = 1.0; while (fpdR < 16386) fpdR = rand()*UINT32_MAX;
+    }
+
+    // The output is delayed by `spacing` samples.
+    int getLatency() const noexcept { return spacing; }
+
+    // Processes two channels at once. The output may be the same as the input.
+    // For a single channel, pass the same pointers for both channels.
+    template<typename SampleType>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples) noexcept
+    {
+        if (fastMath) {
+            processSpacing<SampleType, true>(inA, inB, outA, outB, numSamples);
+        } else {
+            processSpacing<SampleType, false>(inA, inB, outA, outB, numSamples);
+        }
+    }
+
+    template<typename SampleType>
+    void process(const SampleType* in, SampleType* out, int numSamples) noexcept
+    {
+        process(in, in, out, out, numSamples);
+    }
+
+    template<typename SampleType, bool UseFastMath>
+    void processSpacing(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                        int numSamples) noexcept;
+
+    template<typename SampleType, int Spacing, bool UseFastMath>
+    void processPair(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                     int numSamples) noexcept;
+};
+
+template<typename SampleType, bool UseFastMath>
+void Kernel::processSpacing(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                            int numSamples) noexcept
+{
+    // Each delay length has its own copy of the processing loop, so that the
+    // ring buffer's wrap-around is resolved at compile time.
+    switch (spacing) {
+        case 1: processPair<SampleType, 1, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 2: processPair<SampleType, 2, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 3: processPair<SampleType, 3, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 4: processPair<SampleType, 4, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 5: processPair<SampleType, 5, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 6: processPair<SampleType, 6, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 7: processPair<SampleType, 7, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 8: processPair<SampleType, 8, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 9: processPair<SampleType, 9, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 10: processPair<SampleType, 10, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 11: processPair<SampleType, 11, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 12: processPair<SampleType, 12, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 13: processPair<SampleType, 13, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 14: processPair<SampleType, 14, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 15: processPair<SampleType, 15, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 16: processPair<SampleType, 16, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+        case 17: processPair<SampleType, 17, UseFastMath>(inA, inB, outA, outB, numSamples); break;
+    }
+}
+
+template<typename SampleType, int Spacing, bool UseFastMath>
+void Kernel::processPair(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                         int numSamples) noexcept
+{
+    /*
+        Two channels are processed together, one per lane of a DoublePair.
+        Instead of if-statements, both outcomes are computed and select() picks
+        the right one for each channel. The arithmetic is the same as in the
+        scalar version, and sin() is still computed by the standard library for
+        each lane, so the output is bit-identical.
+
+        With double buffers, the input gain is applied in double precision and
+        nothing gets rounded to float.
+
+        The exception is the Fast Math mode, which replaces sin() and the
+        division by the approximations from FastMath.h. Those are computed on
+        both lanes at once. Because the blend with lastSample never amplifies
+        an error, the output stays within 3.2e-9 of the exact version (before
+        it gets rounded to float), which is about -170 dB.
+
+        Only the blend with lastSample depends on the previous samples. It is
+        tempting to split the loop into stages: first gain, clamp, softSpeed,
+        and sin() for a sub-block of 64 samples into a scratch buffer, then the
+        blend, then the output gain. I measured that, and it was 10 to 20%
+        slower with exact math and no faster with Fast Math. The blend is just
+        a multiply and an add per sample, so the CPU already runs the
+        independent work of the next samples alongside it. The lanes of a
+        DoublePair are already full with the two channels, so the stages
+        couldn't use wider vectors either. All the split adds is the traffic
+        to and from the scratch buffers.
+    */
+
+    const DoublePair one = DoublePair::broadcast(1.0);
+    const DoublePair posLimit = DoublePair::broadcast(1.57079633);
+    const DoublePair negLimit = DoublePair::broadcast(-1.57079633);
+    const DoublePair refclip = DoublePair::broadcast(0.9549925859);
+    const DoublePair inputGain = DoublePair::broadcast(inputLevel);
+    const DoublePair outputGain = DoublePair::broadcast(outputLevel);
+
+    DoublePair lastSample = this->lastSample;
+
+    for (int i = 0; i < numSamples; ++i) {
+        // The input gain is applied in the precision of the buffer. For float
+        // buffers that matches the original.
+        DoublePair inputSample = DoublePair::roundTo<SampleType>(DoublePair::set(inA[i], inB[i]) * inputGain);
+
+        // Used by Airwindows dithering, which I disabled for the JUCE version.
+        //if (std::abs(inputSampleL) < 1.18e-23) { inputSampleL = fpdL * 1.18e-17; }
+        //if (std::abs(inputSampleR) < 1.18e-23) { inputSampleR = fpdR * 1.18e-17; }
+
+        // Calculate the linear interpolation coefficient that's used to mix
+        // inputSample with lastSample. If we're not clipping, this is 1.0 and
+        // lastSample is ignored. However, the heavier inputSample clips, the
+        // more lastSample is blended in, which smoothens the transition.
+        // Think of softSpeed as the look-ahead value for how much to correct
+        // the next sample.
+        DoublePair softSpeed = DoublePair::abs(inputSample);
+        if constexpr (UseFastMath) {
+            softSpeed = DoublePair::select(DoublePair::lessThan(softSpeed, one), one, FastMath::reciprocal(softSpeed));
+        } else {
+            softSpeed = DoublePair::select(DoublePair::lessThan(softSpeed, one), one, one / softSpeed);
+        }
+
+        // Hard clip to -pi/2 and +pi/2 for the sin() waveshaper.
+        inputSample = DoublePair::min(inputSample, posLimit);
+        inputSample = DoublePair::max(inputSample, negLimit);
+
+        // Apply the waveshaper and scale to the clipping level of -0.4 dB.
+        if constexpr (UseFastMath) {
+            inputSample = FastMath::sin(inputSample) * refclip;
+        } else {
+            inputSample = inputSample.map([](double x) { return std::sin(x); }) * refclip;
+        }
+
+        // Blend between the waveshaped input sample and the running value.
+        // This only uses lastSample when the input is too loud / clipping.
+        inputSample = inputSample * softSpeed + lastSample * (one - softSpeed);
+
+        // As in ClipOnly2, this pushes the incoming sample into the delay line
+        // and puts the oldest value from the delay line into lastSample, so that
+        // on the next timestep we'll use that for smoothing. This delay exists so
+        // that on higher sampling rates, the high end is not overly bright.
+        DoublePair newest = inputSample;
+        inputSample = lastSample;
+        lastSample = intermediate.push<Spacing>(newest);
+
+        /*
+        // 32 bit stereo floating point dither. Disabled this for the JUCE
+        // version, since it's unrelated to the logic of the plug-in itself.
+        // The Dither parameter adds it back as an output stage, see FloatDither.h.
+        int expon; frexpf((float)inputSampleL, &expon);
+        fpdL ^= fpdL << 13; fpdL ^= fpdL >> 17; fpdL ^= fpdL << 5;
+        inputSampleL += ((double(fpdL)-uint32_t(0x7fffffff)) * 5.5e-36l * pow(2,expon+62));
+        frexpf((float)inputSampleR, &expon);
+        fpdR ^= fpdR << 13; fpdR ^= fpdR >> 17; fpdR ^= fpdR << 5;
+        inputSampleR += ((double(fpdR)-uint32_t(0x7fffffff)) * 5.5e-36l * pow(2,expon+62));
+        */
+
+        // At this point, inputSample holds the value that was shifted out
+        // of the delay line, so this has been delayed by `spacing` samples.
+        DoublePair outputSample = inputSample * outputGain;
+        outA[i] = SampleType(outputSample.first());
+        outB[i] = SampleType(outputSample.second());
+    }
+
+    this->lastSample = lastSample;
+}
+
+}  // namespace ClipSoftly
@@ -0,0 +1,527 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+#include "CacheAligned.h"
+#include "DoublePair.h"
+#include "SpscRing.h"
+
+/*
+    Statistics about how hard a clipper is working, measured on the audio
+    thread and read by another thread, without any JUCE.
+
+    This is only compiled into the plug-ins when AIRWINDOWS_CLIP_TELEMETRY is
+    defined as 1, for example in the Projucer's preprocessor definitions.
+    Without it, the plug-ins don't contain any of this code.
+
+    For every block, the Meter looks at the input after the input level, which
+    is what the clipper sees, and at the output after the output level. A
+    sample counts as clipped when it goes over the point where the clipper
+    starts to limit it: the clip level of ClipOnly and ClipOnly2, or the point
+    where ClipSoftly is fully saturated.
+
+    ClipOnly and ClipOnly2 already look at every sample on its way in and out,
+    and mostly just copy the audio, so another pass over it to measure would
+    cost about as much as the clipping itself. Their kernels can measure as
+    they go instead, through a Probe (see Measured). Then the peaks of the
+    spans that don't clip come from the same pass that finds those spans, and
+    only the samples that go through the clipper one at a time are counted
+    one at a time. Where the kernel doesn't see what the host sees, such as with
+    oversampling, or with dither after it, the Meter scans the buffer instead.
+    Either way the numbers are the same, and the peaks are those of the
+    samples in the block.
+
+    The results go into a SpscRing that a message thread timer, or a metrics
+    exporter, can read from at its own pace. If it falls behind and the ring
+    fills up, the newest blocks are dropped, and the next block that does get
+    through says how many were lost.
+*/
+namespace ClipTelemetry {
+
+struct BlockStats
+{
+    // The position of the first sample of the block, counted from the last
+    // prepare() or reset().
+    std::uint64_t position = 0;
+    int numSamples = 0;
+
+    // The number of samples over the threshold, in all channels together.
+    int clippedSamples = 0;
+
+    // The number of runs of clipped samples that started in this block, and
+    // the longest run so far of any that were still going in it. A run that
+    // goes on into the next block is counted once, in the block where it
+    // started. These are per channel, so a run in both channels of a stereo
+    // signal counts twice.
+    int clipEvents = 0;
+    int longestRun = 0;
+
+    // The largest absolute value of any sample, before and after clipping.
+    float inputPeak = 0.0f;
+    float outputPeak = 0.0f;
+
+    // How many blocks before this one were lost because the ring was full.
+    int numDropped = 0;
+};
+
+/*
+    What a clipper kernel measures about itself for the Meter, for one pair of
+    channels, one channel per lane. The kernel calls these as it goes:
+
+        input()      with every sample that goes through the clipper one at a
+                     time, after the input level
+        output()     with every output sample that it works out one at a time
+        unclipped()  for a span of samples that it copies, with the span's
+                     input peak and the peak of the part that it puts out
+
+    The counts are kept as doubles so that everything stays in the lanes.
+*/
+struct Probe
+{
+    static constexpr bool enabled = true;
+
+    DoublePair threshold;
+    DoublePair inputPeak;
+    DoublePair outputPeak;
+    DoublePair clippedSamples;
+    DoublePair clipEvents;
+    DoublePair longestRun;
+
+    // How many samples in a row have been over the threshold.
+    DoublePair run;
+
+    void input(DoublePair x) noexcept
+    {
+        const DoublePair one = DoublePair::broadcast(1.0);
+        DoublePair magnitude = DoublePair::abs(x);
+        DoublePair over = DoublePair::greaterThan(magnitude, threshold);
+
+        // NaNs are ignored, since max() keeps the first argument then.
+        inputPeak = DoublePair::max(inputPeak, magnitude);
+        clippedSamples = clippedSamples + (over & one);
+        clipEvents = clipEvents + (over & DoublePair::lessThan(run, one) & one);
+        run = (run + one) & over;
+        longestRun = DoublePair::max(longestRun, run);
+    }
+
+    void output(DoublePair y) noexcept
+    {
+        outputPeak = DoublePair::max(outputPeak, DoublePair::abs(y));
+    }
+
+    void unclipped(DoublePair spanInputPeak, DoublePair spanOutputPeak) noexcept
+    {
+        inputPeak = DoublePair::max(inputPeak, spanInputPeak);
+        outputPeak = DoublePair::max(outputPeak, spanOutputPeak);
+        run = DoublePair();
+    }
+};
+
+/*
+    A kernel that measures itself with a Probe, for ClipOnly::Kernel and
+    ClipOnly2::Kernel. It works with CpuDispatch like the kernel does. The
+    plug-ins use this instead of the plain kernel when telemetry is on, and
+    hand their kernels to Meter::startProbes() and Meter::addProbes().
+*/
+template<typename KernelType>
+struct Measured : KernelType
+{
+    Probe probe;
+
+    template<typename SampleType>
+    void process(const SampleType* inA, const SampleType* inB, SampleType* outA, SampleType* outB,
+                 int numSamples) noexcept
+    {
+        KernelType::process(inA, inB, outA, outB, numSamples, probe);
+    }
+};
+
+class Meter
+{
+public:
+    // The number of blocks that can wait in the ring. At 64 samples per
+    // block and 44.1 kHz, that's about 1.5 seconds.
+    static constexpr int capacity = 1024;
+
+    explicit Meter(double threshold) noexcept : threshold(threshold) { }
+
+    // Allocates the state for this many channels. Not real-time safe.
+    void prepare(int numChannels)
+    {
+        runs.assign(size_t(std::max(0, numChannels)), 0);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        std::fill(runs.begin(), runs.end(), 0);
+        position = 0;
+    }
+
+    /*
+        Called on the audio thread with the samples that go into the clipper,
+        and the gain that the clipper still applies to them. This starts the
+        block. Use this or startProbes(), not both.
+    */
+    template<typename SampleType>
+    void measureInput(const SampleType* const* channels, int numChannels, int numSamples, double gain) noexcept;
+
+    /*
+        Starts the block when the kernels measure it themselves. Called on the
+        audio thread before they process it. `kernels` holds a Measured kernel
+        for every pair of channels.
+    */
+    template<typename Kernels>
+    void startProbes(Kernels& kernels, int numChannels, int numSamples) noexcept;
+
+    /*
+        Called on the audio thread after the kernels that startProbes() got
+        have processed the block. Adds what they measured about the input, and
+        with `withOutput`, the output peak too. That is only right when
+        nothing changes the output after the kernels, such as dither.
+    */
+    template<typename Kernels>
+    void addProbes(const Kernels& kernels, int numChannels, bool withOutput) noexcept;
+
+    // Called on the audio thread with the final output. This finishes the
+    // block and sends its statistics to the reader.
+    template<typename SampleType>
+    void measureOutput(const SampleType* const* channels, int numChannels, int numSamples) noexcept;
+
+    // Finishes the block without looking at the output, when addProbes() has
+    // already measured it.
+    void finishBlock() noexcept;
+
+    // Called on the reader's thread. Returns false when there is nothing new.
+    bool pop(BlockStats& stats) noexcept { return ring.pop(stats); }
+
+private:
+    // The samples are looked at in chunks of this many, one bit per sample.
+    static constexpr int chunkSize = 64;
+
+    // Returns the largest `|data[i] * gain|`, or `peak` if that's larger.
+    // NaNs are ignored.
+    template<typename SampleType>
+    static SampleType findPeak(const SampleType* data, int numSamples, SampleType gain, SampleType peak) noexcept;
+
+    /*
+        Returns a mask with bit i set if `|data[i] * gain| > threshold`, for
+        up to 64 samples, and raises `peak` to the largest `|data[i] * gain|`.
+        NaNs are ignored.
+    */
+    template<typename SampleType>
+    static std::uint64_t scan(const SampleType* data, int numSamples, SampleType gain, SampleType threshold,
+                              SampleType& peak) noexcept;
+
+    // Adds the clipped samples, clip events, and runs in one chunk to the
+    // block's statistics. `run` is the length of the run that was still going
+    // at the end of the previous chunk, and is updated for the next one.
+    void countRuns(std::uint64_t mask, int numSamples, int& run) noexcept;
+
+    void startBlock(int numSamples) noexcept;
+
+    static int popCount(std::uint64_t x) noexcept;
+    static int countTrailingZeros(std::uint64_t x) noexcept;  // x must not be 0
+    static int countLeadingZeros(std::uint64_t x) noexcept;   // x must not be 0
+
+    const double threshold;
+
+    // For each channel, how many samples in a row have been over the threshold.
+    CacheAligned::Vector<int> runs;
+
+    std::uint64_t position = 0;
+    int numDropped = 0;
+    BlockStats current;
+
+    SpscRing<BlockStats, capacity> ring;
+};
+
+template<typename SampleType>
+void Meter::measureInput(const SampleType* const* channels, int numChannels, int numSamples, double gain) noexcept
+{
+    startBlock(numSamples);
+
+    numChannels = std::min(numChannels, int(runs.size()));
+    const SampleType g = SampleType(gain);
+    const SampleType t = SampleType(threshold);
+    SampleType peak = 0;
+
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const SampleType* data = channels[channel];
+        int& run = runs[size_t(channel)];
+
+        // Most of the time nothing clips, and then there are no runs.
+        SampleType channelPeak = findPeak(data, numSamples, g, SampleType(0));
+        peak = std::max(peak, channelPeak);
+        if (channelPeak <= t) {
+            run = 0;
+            continue;
+        }
+
+        for (int start = 0; start < numSamples; start += chunkSize) {
+            int count = std::min(chunkSize, numSamples - start);
+            std::uint64_t mask = scan(data + start, count, g, t, peak);
+            if (mask == 0) {
+                run = 0;
+            } else {
+                countRuns(mask, count, run);
+            }
+        }
+    }
+
+    current.inputPeak = float(peak);
+}
+
+template<typename Kernels>
+void Meter::startProbes(Kernels& kernels, int numChannels, int numSamples) noexcept
+{
+    startBlock(numSamples);
+
+    // The runs go on from the previous block, which may have been scanned.
+    numChannels = std::min(numChannels, int(runs.size()));
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        int other = std::min(channel + 1, numChannels - 1);
+        Probe& probe = kernels[size_t(channel / 2)].probe;
+        probe = Probe();
+        probe.threshold = DoublePair::broadcast(threshold);
+        probe.run = DoublePair::set(double(runs[size_t(channel)]), double(runs[size_t(other)]));
+    }
+}
+
+template<typename Kernels>
+void Meter::addProbes(const Kernels& kernels, int numChannels, bool withOutput) noexcept
+{
+    numChannels = std::min(numChannels, int(runs.size()));
+    double inputPeak = current.inputPeak;
+    double outputPeak = current.outputPeak;
+
+    for (int channel = 0; channel < numChannels; channel += 2) {
+        int other = std::min(channel + 1, numChannels - 1);
+        const Probe& probe = kernels[size_t(channel / 2)].probe;
+
+        // With an odd number of channels, both lanes hold the last channel,
+        // which should only be counted once.
+        current.clippedSamples += int(probe.clippedSamples.first());
+        current.clipEvents += int(probe.clipEvents.first());
+        if (other != channel) {
+            current.clippedSamples += int(probe.clippedSamples.second());
+            current.clipEvents += int(probe.clipEvents.second());
+        }
+        current.longestRun = std::max(current.longestRun,
+                                      int(std::max(probe.longestRun.first(), probe.longestRun.second())));
+        runs[size_t(channel)] = int(probe.run.first());
+        runs[size_t(other)] = int(probe.run.second());
+
+        inputPeak = std::max(inputPeak, std::max(probe.inputPeak.first(), probe.inputPeak.second()));
+        outputPeak = std::max(outputPeak, std::max(probe.outputPeak.first(), probe.outputPeak.second()));
+    }
+
+    current.inputPeak = float(inputPeak);
+    if (withOutput) { current.outputPeak = float(outputPeak); }
+}
+
+template<typename SampleType>
+void Meter::measureOutput(const SampleType* const* channels, int numChannels, int numSamples) noexcept
+{
+    numChannels = std::min(numChannels, int(runs.size()));
+    SampleType peak = 0;
+    for (int channel = 0; channel < numChannels; ++channel) {
+        peak = findPeak(channels[channel], numSamples, SampleType(1), peak);
+    }
+    current.outputPeak = float(peak);
+
+    finishBlock();
+}
+
+inline void Meter::startBlock(int numSamples) noexcept
+{
+    current = BlockStats();
+    current.position = position;
+    current.numSamples = numSamples;
+}
+
+inline void Meter::finishBlock() noexcept
+{
+    current.numDropped = numDropped;
+    numDropped = ring.push(current) ? 0 : numDropped + 1;
+    position += std::uint64_t(current.numSamples);
+}
+
+template<typename SampleType>
+SampleType Meter::findPeak(const SampleType* data, int numSamples, SampleType gain, SampleType peak) noexcept
+{
+    int i = 0;
+
+    // Like scan(), but without the mask, and over the whole block at once.
+    if constexpr (sizeof(SampleType) == sizeof(float)) {
+       #if AIRWINDOWS_DOUBLEPAIR_SSE2
+        const __m128 g = _mm_set1_ps(gain);
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        __m128 peaks[4];
+        for (auto& p : peaks) { p = _mm_set1_ps(peak); }
+
+        for (; i + 16 <= numSamples; i += 16) {
+            for (int k = 0; k < 4; ++k) {
+                __m128 x = _mm_andnot_ps(signBit, _mm_mul_ps(_mm_loadu_ps(data + i + 4*k), g));
+                peaks[k] = _mm_max_ps(x, peaks[k]);
+            }
+        }
+
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, _mm_max_ps(_mm_max_ps(peaks[0], peaks[1]), _mm_max_ps(peaks[2], peaks[3])));
+        peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+       #elif AIRWINDOWS_DOUBLEPAIR_NEON
+        const float32x4_t g = vdupq_n_f32(gain);
+        float32x4_t peaks[4];
+        for (auto& p : peaks) { p = vdupq_n_f32(peak); }
+
+        for (; i + 16 <= numSamples; i += 16) {
+            for (int k = 0; k < 4; ++k) {
+                peaks[k] = vmaxnmq_f32(peaks[k], vabsq_f32(vmulq_f32(vld1q_f32(data + i + 4*k), g)));
+            }
+        }
+
+        peak = std::max(peak, vmaxnmvq_f32(vmaxnmq_f32(vmaxnmq_f32(peaks[0], peaks[1]), vmaxnmq_f32(peaks[2], peaks[3]))));
+       #endif
+    }
+
+    for (; i < numSamples; ++i) {
+        SampleType x = std::abs(data[i] * gain);
+        if (x > peak) { peak = x; }
+    }
+    return peak;
+}
+
+template<typename SampleType>
+std::uint64_t Meter::scan(const SampleType* data, int numSamples, SampleType gain, SampleType threshold,
+                          SampleType& peak) noexcept
+{
+    std::uint64_t mask = 0;
+    int i = 0;
+
+    // The float version does sixteen samples at a time, with four accumulators
+    // for the peak so that each max doesn't have to wait for the previous one.
+    if constexpr (sizeof(SampleType) == sizeof(float)) {
+       #if AIRWINDOWS_DOUBLEPAIR_SSE2
+        const __m128 g = _mm_set1_ps(gain);
+        const __m128 t = _mm_set1_ps(threshold);
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        __m128 peaks[4];
+        for (auto& p : peaks) { p = _mm_set1_ps(peak); }
+
+        for (; i + 16 <= numSamples; i += 16) {
+            int bits = 0;
+            for (int k = 0; k < 4; ++k) {
+                __m128 x = _mm_andnot_ps(signBit, _mm_mul_ps(_mm_loadu_ps(data + i + 4*k), g));
+                peaks[k] = _mm_max_ps(x, peaks[k]);
+                bits |= _mm_movemask_ps(_mm_cmpgt_ps(x, t)) << (4*k);
+            }
+            mask |= std::uint64_t(bits) << i;
+        }
+
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, _mm_max_ps(_mm_max_ps(peaks[0], peaks[1]), _mm_max_ps(peaks[2], peaks[3])));
+        peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+       #elif AIRWINDOWS_DOUBLEPAIR_NEON
+        const float32x4_t g = vdupq_n_f32(gain);
+        const float32x4_t t = vdupq_n_f32(threshold);
+        const uint32x4_t laneBits = { 1, 2, 4, 8 };
+        float32x4_t peaks[4];
+        for (auto& p : peaks) { p = vdupq_n_f32(peak); }
+
+        for (; i + 16 <= numSamples; i += 16) {
+            std::uint32_t bits = 0;
+            for (int k = 0; k < 4; ++k) {
+                float32x4_t x = vabsq_f32(vmulq_f32(vld1q_f32(data + i + 4*k), g));
+                peaks[k] = vmaxnmq_f32(peaks[k], x);
+                bits |= vaddvq_u32(vandq_u32(vcgtq_f32(x, t), laneBits)) << (4*k);
+            }
+            mask |= std::uint64_t(bits) << i;
+        }
+
+        peak = std::max(peak, vmaxnmvq_f32(vmaxnmq_f32(vmaxnmq_f32(peaks[0], peaks[1]), vmaxnmq_f32(peaks[2], peaks[3]))));
+       #endif
+    }
+
+    for (; i < numSamples; ++i) {
+        SampleType x = std::abs(data[i] * gain);
+        if (x > peak) { peak = x; }
+        mask |= std::uint64_t(x > threshold ? 1 : 0) << i;
+    }
+    return mask;
+}
+
+inline void Meter::countRuns(std::uint64_t mask, int numSamples, int& run) noexcept
+{
+    current.clippedSamples += popCount(mask);
+
+    // A run starts at every set bit whose previous bit is clear. For the first
+    // bit, the previous one is the last sample of the previous chunk.
+    std::uint64_t previous = (mask << 1) | std::uint64_t(run > 0 ? 1 : 0);
+    current.clipEvents += popCount(mask & ~previous);
+
+    const std::uint64_t all = numSamples == chunkSize ? ~std::uint64_t(0) : (std::uint64_t(1) << numSamples) - 1;
+    if (mask == all) {
+        run += numSamples;
+        current.longestRun = std::max(current.longestRun, run);
+        return;
+    }
+
+    // A run from the previous chunk that goes on into this one ends at the
+    // first clear bit.
+    if ((mask & 1) != 0) {
+        current.longestRun = std::max(current.longestRun, run + countTrailingZeros(~mask));
+    }
+
+    // The longest run inside the chunk: every step shortens all runs by one,
+    // until none are left.
+    int longest = 0;
+    for (std::uint64_t m = mask; m != 0; m &= m << 1) {
+        longest += 1;
+    }
+    current.longestRun = std::max(current.longestRun, longest);
+
+    // The run that goes on into the next chunk, if any. Shifting the last
+    // sample to the top bit fills the bits below the chunk with zeros.
+    run = countLeadingZeros(~(mask << (chunkSize - numSamples)));
+}
+
+inline int Meter::popCount(std::uint64_t x) noexcept
+{
+   #if defined(_MSC_VER)
+    return int(__popcnt64(x));
+   #else
+    return __builtin_popcountll(x);
+   #endif
+}
+
+inline int Meter::countTrailingZeros(std::uint64_t x) noexcept
+{
+   #if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return int(index);
+   #else
+    return __builtin_ctzll(x);
+   #endif
+}
+
+inline int Meter::countLeadingZeros(std::uint64_t x) noexcept
+{
+   #if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - int(index);
+   #else
+    return __builtin_clzll(x);
+   #endif
+}
+
+}  // namespace ClipTelemetry
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #define AIRWINDOWS_CPU_DISPATCH 1
+#endif
+
+/*
+    Runs a kernel with the best instruction set that the CPU supports.
+
+    The plug-ins are compiled for a baseline CPU: SSE2 on x86-64. The kernels
+    are also compiled for these higher levels, and the plug-in picks one in
+    prepareToPlay(), based on what CPUID says the CPU can do:
+
+        generic  the baseline, and the only level on ARM and with MSVC
+        sse4     SSE4.2 and POPCNT
+        avx2     AVX2
+        avx512   AVX-512 F, BW, DQ, and VL
+
+    This doesn't need separate source files with their own compiler flags.
+    Instead, a small function per level has a target attribute and the
+    flatten attribute, which makes the compiler inline the whole kernel into
+    it and compile that code for the target. Nothing that is compiled for a
+    higher level ends up outside these functions, so the baseline code can't
+    accidentally use instructions that the CPU doesn't have.
+
+    The kernels are written with SSE2 intrinsics, which the higher levels
+    encode with VEX or EVEX, and the simple loops (the fast path copies, the
+    bit shifts) are vectorized wider. FMA is not used: it changes how the
+    results are rounded, and every level must give exactly the same output.
+
+    For testing, a level can be forced with force() or with the environment
+    variable AIRWINDOWS_ISA, for example AIRWINDOWS_ISA=sse4. A forced level
+    that the CPU doesn't support is lowered to the best level that it does.
+*/
+namespace CpuDispatch
+{
+    enum class Level
+    {
+        generic,
+        sse4,
+        avx2,
+        avx512
+    };
+
+    constexpr int numLevels = 4;
+
+    inline const char* getName(Level level) noexcept
+    {
+        switch (level) {
+            case Level::generic: return "generic";
+            case Level::sse4: return "sse4";
+            case Level::avx2: return "avx2";
+            case Level::avx512: return "avx512";
+        }
+        return "generic";
+    }
+
+    // Looks up a level by its name. Returns false if there is no such level.
+    inline bool parse(const char* name, Level& level) noexcept
+    {
+        for (int i = 0; i < numLevels; ++i) {
+            if (std::strcmp(name, getName(Level(i))) == 0) {
+                level = Level(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The best level that this CPU and the OS support.
+    inline Level detect() noexcept
+    {
+       #if AIRWINDOWS_CPU_DISPATCH
+        // This reads CPUID, and for AVX also checks that the OS saves the
+        // wider registers on a context switch.
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+                && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+            return Level::avx512;
+        }
+        if (__builtin_cpu_supports("avx2")) { return Level::avx2; }
+        if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) { return Level::sse4; }
+       #endif
+        return Level::generic;
+    }
+
+    namespace detail
+    {
+        // -1 when no level is forced.
+        inline std::atomic<int>& forcedLevel() noexcept
+        {
+            static std::atomic<int> level { -1 };
+            return level;
+        }
+
+        inline int getEnvironmentLevel() noexcept
+        {
+            static const int level = [] {
+                Level parsed;
+                const char* name = std::getenv("AIRWINDOWS_ISA");
+                return (name != nullptr && parse(name, parsed)) ? int(parsed) : -1;
+            }();
+            return level;
+        }
+    }
+
+    // Makes the plug-ins use this level from their next prepareToPlay().
+    inline void force(Level level) noexcept
+    {
+        detail::forcedLevel().store(int(level));
+    }
+
+    // Goes back to using the best level again.
+    inline void clearForcedLevel() noexcept
+    {
+        detail::forcedLevel().store(-1);
+    }
+
+    // The level to use: the forced one if there is one, but never higher than
+    // what the CPU supports. Call this from prepareToPlay(), not from the
+    // audio thread, since the first call reads the environment.
+    inline Level select() noexcept
+    {
+        static const Level best = detect();
+        int forced = detail::forcedLevel().load();
+        if (forced < 0) { forced = detail::getEnvironmentLevel(); }
+        if (forced < 0 || forced > int(best)) { return best; }
+        return Level(forced);
+    }
+
+   #if AIRWINDOWS_CPU_DISPATCH
+    #if defined(__clang__)
+        #define AIRWINDOWS_TARGET(isa) __attribute__((target(isa), flatten))
+    #else
+        // GCC may fuse multiply-adds across the inlined operators of
+        // DoublePair, so that is turned off explicitly. Clang only fuses
+        // within a single expression, which the kernels don't rely on.
+        #define AIRWINDOWS_TARGET(isa) __attribute__((target(isa), flatten, optimize("fp-contract=off")))
+    #endif
+   #endif
+
+    /*
+        The two-channel process() of a kernel, compiled once for every level.
+        Works with any kernel that has `process(inA, inB, outA, outB, n)`.
+
+            auto function = CpuDispatch::Kernel<ClipOnly::Kernel, float>::get(level);
+            function(kernel, inA, inB, outA, outB, numSamples);
+    */
+    template<typename KernelType, typename SampleType>
+    struct Kernel
+    {
+        using Result = decltype(std::declval<KernelType&>().process(
+            std::declval<const SampleType*>(), std::declval<const SampleType*>(),
+            std::declval<SampleType*>(), std::declval<SampleType*>(), 0));
+
+        using Function = Result (*)(KernelType&, const SampleType*, const SampleType*,
+                                    SampleType*, SampleType*, int);
+
+        static Result generic(KernelType& kernel, const SampleType* inA, const SampleType* inB,
+                              SampleType* outA, SampleType* outB, int numSamples) noexcept
+        {
+            return kernel.process(inA, inB, outA, outB, numSamples);
+        }
+
+       #if AIRWINDOWS_CPU_DISPATCH
+        AIRWINDOWS_TARGET("sse4.2,popcnt")
+        static Result sse4(KernelType& kernel, const SampleType* inA, const SampleType* inB,
+                           SampleType* outA, SampleType* outB, int numSamples) noexcept
+        {
+            return kernel.process(inA, inB, outA, outB, numSamples);
+        }
+
+        AIRWINDOWS_TARGET("avx2")
+        static Result avx2(KernelType& kernel, const SampleType* inA, const SampleType* inB,
+                           SampleType* outA, SampleType* outB, int numSamples) noexcept
+        {
+            return kernel.process(inA, inB, outA, outB, numSamples);
+        }
+
+        AIRWINDOWS_TARGET("avx512f,avx512bw,avx512dq,avx512vl")
+        static Result avx512(KernelType& kernel, const SampleType* inA, const SampleType* inB,
+                             SampleType* outA, SampleType* outB, int numSamples) noexcept
+        {
+            return kernel.process(inA, inB, outA, outB, numSamples);
+        }
+       #endif
+
+        static Function get(Level level) noexcept
+        {
+           #if AIRWINDOWS_CPU_DISPATCH
+            switch (level) {
+                case Level::generic: return generic;
+                case Level::sse4: return sse4;
+                case Level::avx2: return avx2;
+                case Level::avx512: return avx512;
+            }
+           #endif
+            return generic;
+        }
+    };
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+
+/*
+    Fades from the output of an old configuration to that of a new one, for
+    settings that can't simply be ramped, such as the oversampling factor.
+
+    The plug-in keeps a second set of kernels for this. When the setting
+    changes, it swaps the two sets, so that the old kernels with all their
+    state become the ones to fade out from, and sets up the other set for the
+    new setting. It primes the new kernels on the recent input from Bypass,
+    so that their filters and delay lines don't start out empty, then calls
+    start(). While isFading(), it runs the input through both sets and mixes
+    the outputs with mix().
+
+    If the two configurations have a different latency, the outputs don't
+    line up, so the fade is audible as a short blur rather than a click.
+*/
+class Crossfade
+{
+public:
+    // 10 ms, the same as a bypass crossfade.
+    void prepare(double sampleRate, double fadeSeconds = 0.01) noexcept
+    {
+        fadeLength = std::max(1, int(sampleRate * fadeSeconds));
+        reset();
+    }
+
+    // Finishes any fade that is going on.
+    void reset() noexcept { position = fadeLength; }
+
+    void start() noexcept { position = 0; }
+    bool isFading() const noexcept { return position < fadeLength; }
+
+    /*
+        Mixes `numSamples` samples of the old output into `out`, which holds
+        the new output, starting `offset` samples into the current block.
+        The gains go in a straight line and add up to 1.
+    */
+    template<typename T>
+    void mix(const T* old, T* out, int offset, int numSamples) const noexcept
+    {
+        const double scale = 1.0 / double(fadeLength);
+        for (int i = 0; i < numSamples; ++i) {
+            double gain = std::min(1.0, double(position + offset + i + 1) * scale);
+            out[i] = T(double(old[i]) + (double(out[i]) - double(old[i])) * gain);
+        }
+    }
+
+    // Moves the fade forward, at the end of every block.
+    void advance(int numSamples) noexcept
+    {
+        position = std::min(fadeLength, position + numSamples);
+    }
+
+private:
+    int fadeLength = 1;
+
+    // How far the fade has gone: 0 is all old and fadeLength is all new.
+    int position = 1;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AIRWINDOWS_DOUBLEPAIR_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #include <arm_neon.h>
+    #define AIRWINDOWS_DOUBLEPAIR_NEON 1
+#endif
+
+/*
+    Two doubles that are processed together, one per lane. The clippers use
+    this to run the left and right channels through the same instructions,
+    since the two channels never interact.
+
+    Comparisons return a mask with all bits set in the lanes where the test
+    is true. Instead of branching, the kernels compute both outcomes and use
+    select() to pick one per lane. Every operation rounds exactly like the
+    scalar double operation it replaces, so the output is bit-identical to
+    the scalar code (as long as the compiler does not fuse multiply-adds).
+
+    This uses SSE2 on x86, NEON on 64-bit ARM, and plain C++ elsewhere.
+*/
+struct DoublePair
+{
+#if AIRWINDOWS_DOUBLEPAIR_SSE2
+    __m128d v;
+
+    DoublePair() : v(_mm_setzero_pd()) { }
+    explicit DoublePair(__m128d x) : v(x) { }
+
+    static DoublePair broadcast(double x) { return DoublePair(_mm_set1_pd(x)); }
+    static DoublePair set(double a, double b) { return DoublePair(_mm_set_pd(b, a)); }
+
+    double first() const { return _mm_cvtsd_f64(v); }
+    double second() const { return _mm_cvtsd_f64(_mm_unpackhi_pd(v, v)); }
+
+    friend DoublePair operator+(DoublePair a, DoublePair b) { return DoublePair(_mm_add_pd(a.v, b.v)); }
+    friend DoublePair operator-(DoublePair a, DoublePair b) { return DoublePair(_mm_sub_pd(a.v, b.v)); }
+    friend DoublePair operator*(DoublePair a, DoublePair b) { return DoublePair(_mm_mul_pd(a.v, b.v)); }
+    friend DoublePair operator/(DoublePair a, DoublePair b) { return DoublePair(_mm_div_pd(a.v, b.v)); }
+
+    friend DoublePair operator&(DoublePair a, DoublePair b) { return DoublePair(_mm_and_pd(a.v, b.v)); }
+    friend DoublePair operator|(DoublePair a, DoublePair b) { return DoublePair(_mm_or_pd(a.v, b.v)); }
+
+    static DoublePair lessThan(DoublePair a, DoublePair b) { return DoublePair(_mm_cmplt_pd(a.v, b.v)); }
+    static DoublePair greaterThan(DoublePair a, DoublePair b) { return DoublePair(_mm_cmpgt_pd(a.v, b.v)); }
+
+    // Picks a where the mask is set, b where it is not.
+    static DoublePair select(DoublePair mask, DoublePair a, DoublePair b)
+    {
+        return DoublePair(_mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v)));
+    }
+
+    static DoublePair abs(DoublePair a)
+    {
+        return DoublePair(_mm_andnot_pd(_mm_set1_pd(-0.0), a.v));
+    }
+
+    // Rounds both lanes to the nearest float, like storing into a float would.
+    static DoublePair roundToFloat(DoublePair a)
+    {
+        return DoublePair(_mm_cvtps_pd(_mm_cvtpd_ps(a.v)));
+    }
+
+    // Approximation of 1/a with at least 12 bits of precision.
+    static DoublePair reciprocalEstimate(DoublePair a)
+    {
+        return DoublePair(_mm_cvtps_pd(_mm_rcp_ps(_mm_cvtpd_ps(a.v))));
+    }
+
+    bool anyTrue() const { return _mm_movemask_pd(v) != 0; }
+
+    // These pick b when either lane is NaN, just like the select() versions.
+    static DoublePair min(DoublePair a, DoublePair b) { return DoublePair(_mm_min_pd(b.v, a.v)); }
+    static DoublePair max(DoublePair a, DoublePair b) { return DoublePair(_mm_max_pd(b.v, a.v)); }
+
+#elif AIRWINDOWS_DOUBLEPAIR_NEON
+    float64x2_t v;
+
+    DoublePair() : v(vdupq_n_f64(0.0)) { }
+    explicit DoublePair(float64x2_t x) : v(x) { }
+
+    static DoublePair broadcast(double x) { return DoublePair(vdupq_n_f64(x)); }
+    static DoublePair set(double a, double b) { return DoublePair(vsetq_lane_f64(b, vdupq_n_f64(a), 1)); }
+
+    double first() const { return vgetq_lane_f64(v, 0); }
+    double second() const { return vgetq_lane_f64(v, 1); }
+
+    friend DoublePair operator+(DoublePair a, DoublePair b) { return DoublePair(vaddq_f64(a.v, b.v)); }
+    friend DoublePair operator-(DoublePair a, DoublePair b) { return DoublePair(vsubq_f64(a.v, b.v)); }
+    friend DoublePair operator*(DoublePair a, DoublePair b) { return DoublePair(vmulq_f64(a.v, b.v)); }
+    friend DoublePair operator/(DoublePair a, DoublePair b) { return DoublePair(vdivq_f64(a.v, b.v)); }
+
+    friend DoublePair operator&(DoublePair a, DoublePair b)
+    {
+        return DoublePair(vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(a.v), vreinterpretq_u64_f64(b.v))));
+    }
+    friend DoublePair operator|(DoublePair a, DoublePair b)
+    {
+        return DoublePair(vreinterpretq_f64_u64(vorrq_u64(vreinterpretq_u64_f64(a.v), vreinterpretq_u64_f64(b.v))));
+    }
+
+    static DoublePair lessThan(DoublePair a, DoublePair b) { return DoublePair(vreinterpretq_f64_u64(vcltq_f64(a.v, b.v))); }
+    static DoublePair greaterThan(DoublePair a, DoublePair b) { return DoublePair(vreinterpretq_f64_u64(vcgtq_f64(a.v, b.v))); }
+
+    static DoublePair select(DoublePair mask, DoublePair a, DoublePair b)
+    {
+        return DoublePair(vbslq_f64(vreinterpretq_u64_f64(mask.v), a.v, b.v));
+    }
+
+    static DoublePair abs(DoublePair a) { return DoublePair(vabsq_f64(a.v)); }
+
+    static DoublePair roundToFloat(DoublePair a) { return DoublePair(vcvt_f64_f32(vcvt_f32_f64(a.v))); }
+
+    // The NEON estimate only has 8 bits, so do one Newton-Raphson step here
+    // to get the same precision as SSE.
+    static DoublePair reciprocalEstimate(DoublePair a)
+    {
+        float64x2_t r = vrecpeq_f64(a.v);
+        return DoublePair(vmulq_f64(r, vrecpsq_f64(a.v, r)));
+    }
+
+    bool anyTrue() const { return vmaxvq_u32(vreinterpretq_u32_f64(v)) != 0; }
+
+    static DoublePair min(DoublePair a, DoublePair b) { return select(lessThan(b, a), b, a); }
+    static DoublePair max(DoublePair a, DoublePair b) { return select(greaterThan(b, a), b, a); }
+
+#else
+    double v[2];
+
+    DoublePair() : v { 0.0, 0.0 } { }
+
+    static DoublePair broadcast(double x) { return set(x, x); }
+    static DoublePair set(double a, double b) { DoublePair r; r.v[0] = a; r.v[1] = b; return r; }
+
+    double first() const { return v[0]; }
+    double second() const { return v[1]; }
+
+    friend DoublePair operator+(DoublePair a, DoublePair b) { return set(a.v[0] + b.v[0], a.v[1] + b.v[1]); }
+    friend DoublePair operator-(DoublePair a, DoublePair b) { return set(a.v[0] - b.v[0], a.v[1] - b.v[1]); }
+    friend DoublePair operator*(DoublePair a, DoublePair b) { return set(a.v[0] * b.v[0], a.v[1] * b.v[1]); }
+    friend DoublePair operator/(DoublePair a, DoublePair b) { return set(a.v[0] / b.v[0], a.v[1] / b.v[1]); }
+
+    friend DoublePair operator&(DoublePair a, DoublePair b) { return fromBits(bits(a, 0) & bits(b, 0), bits(a, 1) & bits(b, 1)); }
+    friend DoublePair operator|(DoublePair a, DoublePair b) { return fromBits(bits(a, 0) | bits(b, 0), bits(a, 1) | bits(b, 1)); }
+
+    static DoublePair lessThan(DoublePair a, DoublePair b) { return fromBools(a.v[0] < b.v[0], a.v[1] < b.v[1]); }
+    static DoublePair greaterThan(DoublePair a, DoublePair b) { return fromBools(a.v[0] > b.v[0], a.v[1] > b.v[1]); }
+
+    static DoublePair select(DoublePair mask, DoublePair a, DoublePair b)
+    {
+        return set(bits(mask, 0) ? a.v[0] : b.v[0], bits(mask, 1) ? a.v[1] : b.v[1]);
+    }
+
+    static DoublePair abs(DoublePair a) { return set(std::abs(a.v[0]), std::abs(a.v[1])); }
+
+    static DoublePair roundToFloat(DoublePair a) { return set(double(float(a.v[0])), double(float(a.v[1]))); }
+
+    static DoublePair reciprocalEstimate(DoublePair a) { return set(1.0 / a.v[0], 1.0 / a.v[1]); }
+
+    bool anyTrue() const { return bits(*this, 0) != 0 || bits(*this, 1) != 0; }
+
+    static DoublePair min(DoublePair a, DoublePair b) { return select(lessThan(b, a), b, a); }
+    static DoublePair max(DoublePair a, DoublePair b) { return select(greaterThan(b, a), b, a); }
+
+    static std::uint64_t bits(DoublePair a, int lane)
+    {
+        std::uint64_t b;
+        std::memcpy(&b, &a.v[lane], sizeof(b));
+        return b;
+    }
+
+    static DoublePair fromBits(std::uint64_t a, std::uint64_t b)
+    {
+        DoublePair r;
+        std::memcpy(&r.v[0], &a, sizeof(a));
+        std::memcpy(&r.v[1], &b, sizeof(b));
+        return r;
+    }
+#endif
+
+    // Rounds to the precision of T, so roundTo<float>() is the same as
+    // roundToFloat() and roundTo<double>() does nothing. This lets the kernels
+    // round their state to float when processing float buffers, like the
+    // original plug-ins do, but keep full precision for double buffers.
+    template<typename T>
+    static DoublePair roundTo(DoublePair a)
+    {
+        if constexpr (sizeof(T) == sizeof(float)) {
+            return roundToFloat(a);
+        } else {
+            return a;
+        }
+    }
+
+    // Builds a mask from two booleans, for loading the clip flags.
+    static DoublePair fromBools(bool a, bool b)
+    {
+        std::uint64_t allBits = ~std::uint64_t(0);
+        double x, y;
+        std::uint64_t ba = a ? allBits : 0;
+        std::uint64_t bb = b ? allBits : 0;
+        std::memcpy(&x, &ba, sizeof(x));
+        std::memcpy(&y, &bb, sizeof(y));
+        return set(x, y);
+    }
+
+    // Reads back a mask lane as a boolean, for storing the clip flags.
+    bool firstTrue() const { double x = first(); std::uint64_t b; std::memcpy(&b, &x, sizeof(b)); return b != 0; }
+    bool secondTrue() const { double x = second(); std::uint64_t b; std::memcpy(&b, &x, sizeof(b)); return b != 0; }
+
+    // Applies a scalar function to each lane, for things like std::sin()
+    // that have no vector equivalent that rounds exactly the same way.
+    template<typename F>
+    DoublePair map(F f) const { return set(f(first()), f(second())); }
+
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "DoublePair.h"
+
+/*
+    Cheaper replacements for std::sin() and division, used by the opt-in
+    "Fast Math" mode of ClipSoftly. Unlike the standard library functions,
+    these work on both lanes of a DoublePair at once and don't need a call.
+
+    They are not bit-exact, which is why the exact versions are the default.
+*/
+namespace FastMath
+{
+    /*
+        Odd minimax polynomial of degree 9 for sin(x) on [-pi/2, pi/2].
+        The coefficients were fitted with the Remez exchange algorithm.
+        The largest absolute error on that range is 3.34e-9.
+
+        Outside this range the error grows quickly, so clamp the input first.
+    */
+    inline DoublePair sin(DoublePair x)
+    {
+        const DoublePair c1 = DoublePair::broadcast( 0.99999997658988304);
+        const DoublePair c3 = DoublePair::broadcast(-0.16666647634640289);
+        const DoublePair c5 = DoublePair::broadcast( 0.0083328998233604176);
+        const DoublePair c7 = DoublePair::broadcast(-0.00019800897763281068);
+        const DoublePair c9 = DoublePair::broadcast( 2.5904885014339021e-06);
+
+        DoublePair x2 = x * x;
+        DoublePair p = c9;
+        p = p * x2 + c7;
+        p = p * x2 + c5;
+        p = p * x2 + c3;
+        p = p * x2 + c1;
+        return p * x;
+    }
+
+    /*
+        Approximation of 1/x. Starts from the hardware reciprocal estimate
+        (12 bits or better) and doubles the number of correct bits with each
+        Newton-Raphson step. After two steps the relative error is below 1e-13.
+        The estimate is made in single precision, so x must be in the range
+        of a float.
+    */
+    inline DoublePair reciprocal(DoublePair x)
+    {
+        const DoublePair two = DoublePair::broadcast(2.0);
+
+        DoublePair r = DoublePair::reciprocalEstimate(x);
+        r = r * (two - x * r);
+        r = r * (two - x * r);
+        return r;
+    }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "CacheAligned.h"
+#include "DoublePair.h"
+
+/*
+    The Airwindows 32-bit floating-point dither, without any JUCE.
+
+    Many Airwindows plug-ins end with this:
+
+        int expon; frexpf((float)inputSampleL, &expon);
+        fpdL ^= fpdL << 13; fpdL ^= fpdL >> 17; fpdL ^= fpdL << 5;
+        inputSampleL += ((double(fpdL)-uint32_t(0x7fffffff)) * 5.5e-36l * pow(2,expon+62));
+
+    fpdL is a xorshift random number generator. The noise it adds is spread
+    evenly between about -0.91 and +0.91 of the smallest step that a float of
+    that size can take, so it scales with the level of the sample. The JUCE
+    versions of the plug-ins left this out, but it can be turned on with the
+    Dither parameter.
+
+    The original calls frexpf() and pow() for every sample, which costs more
+    than many of the clippers themselves. Here, the power of two is made by
+    copying the exponent bits of the float straight into a new float. Each
+    channel has four generators that take turns, so that four samples can be
+    done at once with SIMD. Each generator is the same xorshift as in the
+    original, so the noise has the same distribution.
+
+    Some details differ from the original:
+
+    - The dither is applied to the finished output, which has already been
+      rounded to float, rather than to the double-precision sample inside
+      the clipper.
+    - For a sample of exactly 0 the noise is the same as in the original,
+      but for denormals and values below about 1e-31 the noise is somewhat
+      larger, since it's never smaller than for 1e-31. The original never
+      sees such values, because it replaces them with noise at the start.
+    - The original turns its dither off for double precision, and so does
+      this class.
+
+    The generators don't depend on how the audio is split into blocks, so
+    the same input gives the same output at any block size.
+*/
+class FloatDither
+{
+public:
+    // Allocates the generators. Not real-time safe.
+    void prepare(int numChannels)
+    {
+        states.resize(size_t(std::max(0, numChannels)) * numLanes);
+        reset();
+    }
+
+    // Starts the generators from the same seeds again.
+    void reset() noexcept
+    {
+        // Any seed but 0 works. These come from a simple LCG, and are well
+        // above 16386, like the seeds in the original.
+        std::uint32_t seed = 0x9E3779B9u;
+        for (auto& state : states) {
+            seed = seed * 1664525u + 1013904223u;
+            state = seed | 0x10000000u;
+        }
+    }
+
+    void process(float* const* channels, int numChannels, int numSamples) noexcept;
+
+    // The original plug-ins have the 64-bit version of the dither commented
+    // out, so double precision audio is left alone.
+    void process(double* const*, int, int) noexcept { }
+
+private:
+    static constexpr int numLanes = 4;
+
+    // (fpd - 0x7fffffff) * 5.5e-36 * 2^(e + 62) where frexpf gives e, is the
+    // same as r * 5.5e-36 * 2^86 * 2^(E - 150), where r = fpd - 2^31 and E
+    // is the float's biased exponent. This is 5.5e-36 * 2^86.
+    static constexpr float noiseScale = 4.2554189e-10f;
+
+    static std::uint32_t next(std::uint32_t& state) noexcept
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // One sample, exactly like one lane of the SIMD code.
+    static float ditherSample(float x, std::uint32_t& state) noexcept
+    {
+        float r = float(std::int32_t(next(state) ^ 0x80000000u));
+
+        std::uint32_t bits;
+        std::memcpy(&bits, &x, 4);
+        std::uint32_t exponent = (bits >> 23) & 0xFF;
+        if (exponent == 0) { exponent = 126; }       // frexpf gives 0 for 0
+        if (exponent < 24) { exponent = 24; }        // keep 2^(E - 150) normal
+
+        std::uint32_t powerBits = (exponent - 23) << 23;
+        float power;
+        std::memcpy(&power, &powerBits, 4);
+        return x + (r * noiseScale) * power;
+    }
+
+    void processChannel(float* data, std::uint32_t* lanes, int numSamples) noexcept;
+
+    // numLanes generators for each channel.
+    CacheAligned::Vector<std::uint32_t> states;
+};
+
+inline void FloatDither::process(float* const* channels, int numChannels, int numSamples) noexcept
+{
+    numChannels = std::min(numChannels, int(states.size() / numLanes));
+    for (int channel = 0; channel < numChannels; ++channel) {
+        processChannel(channels[channel], states.data() + size_t(channel) * numLanes, numSamples);
+    }
+}
+
+inline void FloatDither::processChannel(float* data, std::uint32_t* lanes, int numSamples) noexcept
+{
+    int i = 0;
+
+   #if AIRWINDOWS_DOUBLEPAIR_SSE2
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    const __m128i signBit = _mm_set1_epi32(int(0x80000000u));
+    const __m128i exponentMask = _mm_set1_epi32(0xFF);
+    const __m128 scale = _mm_set1_ps(noiseScale);
+
+    for (; i + numLanes <= numSamples; i += numLanes) {
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+        __m128 r = _mm_cvtepi32_ps(_mm_xor_si128(state, signBit));
+
+        // SSE2 has no integer max, so the two corrections are selects.
+        __m128 x = _mm_loadu_ps(data + i);
+        __m128i exponent = _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(x), 23), exponentMask);
+        __m128i isZero = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+        exponent = _mm_or_si128(_mm_andnot_si128(isZero, exponent), _mm_and_si128(isZero, _mm_set1_epi32(126)));
+        __m128i isSmall = _mm_cmplt_epi32(exponent, _mm_set1_epi32(24));
+        exponent = _mm_or_si128(_mm_andnot_si128(isSmall, exponent), _mm_and_si128(isSmall, _mm_set1_epi32(24)));
+        __m128 power = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(exponent, _mm_set1_epi32(23)), 23));
+
+        _mm_storeu_ps(data + i, _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(r, scale), power)));
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), state);
+   #elif AIRWINDOWS_DOUBLEPAIR_NEON
+    uint32x4_t state = vld1q_u32(lanes);
+    const uint32x4_t signBit = vdupq_n_u32(0x80000000u);
+    const float32x4_t scale = vdupq_n_f32(noiseScale);
+
+    for (; i + numLanes <= numSamples; i += numLanes) {
+        state = veorq_u32(state, vshlq_n_u32(state, 13));
+        state = veorq_u32(state, vshrq_n_u32(state, 17));
+        state = veorq_u32(state, vshlq_n_u32(state, 5));
+        float32x4_t r = vcvtq_f32_s32(vreinterpretq_s32_u32(veorq_u32(state, signBit)));
+
+        float32x4_t x = vld1q_f32(data + i);
+        uint32x4_t exponent = vandq_u32(vshrq_n_u32(vreinterpretq_u32_f32(x), 23), vdupq_n_u32(0xFF));
+        exponent = vbslq_u32(vceqq_u32(exponent, vdupq_n_u32(0)), vdupq_n_u32(126), exponent);
+        exponent = vmaxq_u32(exponent, vdupq_n_u32(24));
+        float32x4_t power = vreinterpretq_f32_u32(vshlq_n_u32(vsubq_u32(exponent, vdupq_n_u32(23)), 23));
+
+        vst1q_f32(data + i, vaddq_f32(x, vmulq_f32(vmulq_f32(r, scale), power)));
+    }
+
+    vst1q_u32(lanes, state);
+   #endif
+
+    // The rest of the samples, or all of them without SIMD, take the
+    // generators in turn, starting with the first. Afterwards, the generators
+    // are rotated so that the next block starts with the one whose turn it is.
+    // That way the output doesn't depend on the block size.
+    int start = i;
+    for (; i < numSamples; ++i) {
+        data[i] = ditherSample(data[i], lanes[(i - start) % numLanes]);
+    }
+    std::rotate(lanes, lanes + (numSamples - start) % numLanes, lanes + numLanes);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+
+/*
+    Smooths changes to a linear gain, so that automating the Input or Output
+    level doesn't cause zipper noise.
+
+    When the target changes, the gain moves there in a straight line over a
+    fixed amount of time, starting from wherever it is at that moment. Once it
+    gets there, isRamping() is false and the plug-in can pass the gain to the
+    kernel as a constant again, which keeps the output bit-exact with the
+    original plug-in when nothing is being automated.
+
+    The same ramp is applied to every channel, so process() does all of them
+    before moving the ramp forward.
+*/
+class GainRamp
+{
+public:
+    // 20 ms is long enough to avoid clicks and short enough to follow fast
+    // automation closely.
+    void prepare(double sampleRate, double rampSeconds = 0.02) noexcept
+    {
+        rampLength = std::max(1, int(sampleRate * rampSeconds));
+        snapToTarget();
+    }
+
+    // Jumps to the target, for example after a reset.
+    void snapToTarget() noexcept
+    {
+        current = target;
+        step = 0.0;
+        remaining = 0;
+    }
+
+    void setTarget(double gain) noexcept
+    {
+        if (gain == target) { return; }
+        target = gain;
+        step = (target - current) / double(rampLength);
+        remaining = rampLength;
+    }
+
+    double getTarget() const noexcept { return target; }
+    bool isRamping() const noexcept { return remaining > 0; }
+
+    /*
+        Multiplies the first `numSamples` samples of every channel by the gain,
+        and moves the ramp forward by that many samples. If the ramp ends
+        before the end of the block, the rest of the block gets the target.
+
+        Each gain is computed from the start of the block as `start + step * i`
+        rather than by adding up the steps, so the loop has no dependency from
+        one sample to the next and the compiler can vectorize it.
+    */
+    template<typename T>
+    void process(T* const* channels, int numChannels, int numSamples) noexcept
+    {
+        const int rampSamples = std::min(numSamples, remaining);
+        const T start = T(current);
+        const T delta = T(step);
+        const T end = T(target);
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            T* data = channels[channel];
+            for (int i = 0; i < rampSamples; ++i) {
+                data[i] *= start + delta * T(i);
+            }
+            for (int i = rampSamples; i < numSamples; ++i) {
+                data[i] *= end;
+            }
+        }
+
+        remaining -= rampSamples;
+        if (remaining == 0) {
+            current = target;
+        } else {
+            current += step * double(rampSamples);
+        }
+    }
+
+private:
+    double current = 1.0;
+    double target = 1.0;
+    double step = 0.0;
+    int remaining = 0;
+    int rampLength = 1;
+};
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "CacheAligned.h"
+#include "DoublePair.h"
+
+/*
+    Oversampling by 2x, 4x, or 8x, so that the clippers can run at a higher
+    sample rate and the harmonics they create don't alias.
+
+    Every factor of two is a stage with two half-band FIR filters: one that
+    interpolates on the way up and one that removes everything above the
+    lower rate's Nyquist frequency on the way back down. In a half-band filter
+    every other coefficient is zero, except for the center one, which is 0.5.
+    Split into its two polyphase branches, one branch is then a plain delay
+    and the other is a symmetric FIR. Each stage only needs `numPairs`
+    multiplies per sample at the lower rate, in either direction.
+
+    The two channels of a pair go through the same instructions, one per lane
+    of a DoublePair, just like in the clippers.
+
+    The first stage does the hard work: it needs a narrow transition band
+    around the original Nyquist frequency. The later stages only have to
+    remove images far above the audio band, so they can be much shorter.
+    With these designs, everything up to 20 kHz at 44.1 kHz passes with less
+    than 0.0001 dB of ripple. Each stage rejects images and aliases by at
+    least 95 dB. Through all three stages at 8x, the worst case is about 90 dB.
+*/
+template<int NumPairs>
+class HalfBandStage
+{
+public:
+    // The filters add up four products at a time, so that the additions
+    // don't all have to wait for each other.
+    static_assert(NumPairs % 4 == 0, "the number of coefficient pairs must be a multiple of 4");
+
+    static constexpr int numPairs = NumPairs;
+
+    /*
+        Kaiser-windowed half-band filter with `NumPairs` pairs of nonzero
+        coefficients around the center tap, so `4 * NumPairs - 1` taps in
+        total. Only one coefficient of each symmetric pair is stored.
+    */
+    explicit HalfBandStage(double beta)
+    {
+
+        auto besselI0 = [](double x) {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; term > 1e-17 * sum; ++k) {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+
+        const double pi = 3.14159265358979323846;
+        double sum = 0.0;
+        for (int j = 0; j < numPairs; ++j) {
+            double d = 2.0 * j + 1.0;  // distance from the center tap
+            double r = d / (2.0 * numPairs);
+            double window = besselI0(beta * std::sqrt(1.0 - r * r)) / besselI0(beta);
+            coeffs[j] = std::sin(pi * d / 2.0) / (pi * d) * window;
+            sum += coeffs[j];
+        }
+
+        // Make the gain at DC exactly 1. The center tap adds 0.5, and every
+        // coefficient appears twice.
+        for (int j = 0; j < numPairs; ++j) {
+            coeffs[j] *= 0.25 / sum;
+        }
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < 4 * numPairs; ++i) {
+            upHistory[i] = DoublePair();
+            downEven[i] = DoublePair();
+            downOdd[i] = DoublePair();
+        }
+        upPos = 0;
+        downPos = 0;
+    }
+
+    // Delay of the way up plus the way down, in samples at the higher rate.
+    static constexpr int getLatency()
+    {
+        return 4 * numPairs - 1;
+    }
+
+    // Turns one sample at the lower rate into two samples at the higher rate.
+    void upsample(DoublePair x, DoublePair* out) noexcept
+    {
+        write(upHistory, upPos, x);
+        upPos = advance(upPos);
+        const DoublePair* w = upHistory + upPos;
+
+        // The even output is the input delayed, the odd output is halfway
+        // between two input samples. The gain of 2 makes up for the zeros
+        // that upsampling stuffs in between the samples.
+        DoublePair sum = filter(w);
+        out[0] = w[numPairs - 1];
+        out[1] = sum + sum;
+    }
+
+    // Turns two samples at the higher rate into one sample at the lower rate.
+    DoublePair downsample(const DoublePair* in) noexcept
+    {
+        write(downEven, downPos, in[0]);
+        write(downOdd, downPos, in[1]);
+        downPos = advance(downPos);
+        const DoublePair* even = downEven + downPos;
+        const DoublePair* odd = downOdd + downPos;
+
+        return filter(even) + odd[numPairs - 1] * DoublePair::broadcast(0.5);
+    }
+
+private:
+    // The symmetric branch of the filter, around the middle of the history.
+    DoublePair filter(const DoublePair* w) const noexcept
+    {
+        const DoublePair* right = w + numPairs;
+        const DoublePair* left = w + numPairs - 1;
+        DoublePair sum0, sum1, sum2, sum3;
+        for (int j = 0; j < numPairs; j += 4) {
+            sum0 = sum0 + (right[j] + left[-j]) * DoublePair::broadcast(coeffs[j]);
+            sum1 = sum1 + (right[j + 1] + left[-j - 1]) * DoublePair::broadcast(coeffs[j + 1]);
+            sum2 = sum2 + (right[j + 2] + left[-j - 2]) * DoublePair::broadcast(coeffs[j + 2]);
+            sum3 = sum3 + (right[j + 3] + left[-j - 3]) * DoublePair::broadcast(coeffs[j + 3]);
+        }
+        return (sum0 + sum1) + (sum2 + sum3);
+    }
+
+    /*
+        The histories hold the last `2 * numPairs` values, oldest first. Every
+        value is written twice, `2 * numPairs` slots apart, so the filter can
+        always read them as one contiguous array without wrapping around,
+        starting at the position after the newest value.
+    */
+    void write(DoublePair* history, int pos, DoublePair x) noexcept
+    {
+        history[pos] = x;
+        history[pos + 2 * numPairs] = x;
+    }
+
+    int advance(int pos) const noexcept
+    {
+        return pos + 1 == 2 * numPairs ? 0 : pos + 1;
+    }
+
+    double coeffs[numPairs];
+
+    DoublePair upHistory[4 * numPairs];
+    DoublePair downEven[4 * numPairs];
+    DoublePair downOdd[4 * numPairs];
+    int upPos = 0;
+    int downPos = 0;
+};
+
+/*
+    Runs a pair of channels through up to three half-band stages.
+
+    Usage: call prepare() from prepareToPlay, which allocates everything that
+    is needed for 8x. After that, setFactor() can switch between 1x, 2x, 4x,
+    and 8x without allocating. Then for every block of at most maxBlockSize
+    samples: upsample(), process getBufferA() and getBufferB() at the higher
+    rate, and downsample().
+
+    The stages delay the audio by a fractional number of samples at the
+    original rate. To keep the latency a whole number of samples, the
+    oversampled audio is delayed by up to `factor - 1` extra samples. This
+    takes into account the latency of the processing at the higher rate,
+    which is passed to setFactor().
+*/
+class Oversampler
+{
+public:
+    static constexpr int maxStages = 3;
+    static constexpr int maxFactor = 1 << maxStages;
+
+    void prepare(int maxBlockSize)
+    {
+        this->maxBlockSize = maxBlockSize;
+        size_t size = size_t(maxBlockSize) * maxFactor;
+        work1.resize(size);
+        work2.resize(size);
+        bufferA.resize(size);
+        bufferB.resize(size);
+        reset();
+    }
+
+    void reset()
+    {
+        stage1.reset();
+        stage2.reset();
+        stage3.reset();
+        for (auto& value : padding) {
+            value = DoublePair();
+        }
+        paddingPos = 0;
+    }
+
+    // The factor must be 1, 2, 4, or 8. The inner latency is that of the
+    // processing at the higher rate, in samples at the higher rate.
+    void setFactor(int factor, int innerLatency)
+    {
+        this->factor = factor;
+        numStages = numStagesFor(factor);
+
+        int total = getTotalLatency(factor, innerLatency);
+        paddingLength = (factor - total % factor) % factor;
+        latency = (total + paddingLength) / factor;
+
+        reset();
+    }
+
+    // The latency that setFactor() gives, without changing anything, so that
+    // another thread can call this while the audio thread is processing.
+    static int getLatencyFor(int factor, int innerLatency)
+    {
+        return (getTotalLatency(factor, innerLatency) + factor - 1) / factor;
+    }
+
+    int getFactor() const { return factor; }
+    int getMaxBlockSize() const { return maxBlockSize; }
+
+    // Total latency in samples at the original rate, including the inner latency.
+    int getLatency() const { return latency; }
+
+    double* getBufferA() { return bufferA.data(); }
+    double* getBufferB() { return bufferB.data(); }
+
+    // Returns the number of samples at the higher rate.
+    template<typename SampleType>
+    int upsample(const SampleType* inA, const SampleType* inB, int numSamples) noexcept
+    {
+        DoublePair* in = work1.data();
+        DoublePair* out = work2.data();
+
+        for (int i = 0; i < numSamples; ++i) {
+            in[i] = DoublePair::set(double(inA[i]), double(inB[i]));
+        }
+
+        int length = numSamples;
+        if (numStages >= 1) { upsampleStage(stage1, in, out, length); std::swap(in, out); length *= 2; }
+        if (numStages >= 2) { upsampleStage(stage2, in, out, length); std::swap(in, out); length *= 2; }
+        if (numStages >= 3) { upsampleStage(stage3, in, out, length); std::swap(in, out); length *= 2; }
+
+        for (int i = 0; i < length; ++i) {
+            DoublePair x = delay(in[i]);
+            bufferA[size_t(i)] = x.first();
+            bufferB[size_t(i)] = x.second();
+        }
+        return length;
+    }
+
+    // Takes the processed samples from getBufferA() and getBufferB().
+    template<typename SampleType>
+    void downsample(SampleType* outA, SampleType* outB, int numSamples) noexcept
+    {
+        DoublePair* in = work1.data();
+        DoublePair* out = work2.data();
+
+        int length = numSamples * factor;
+        for (int i = 0; i < length; ++i) {
+            in[i] = DoublePair::set(bufferA[size_t(i)], bufferB[size_t(i)]);
+        }
+
+        if (numStages >= 3) { length /= 2; downsampleStage(stage3, in, out, length); std::swap(in, out); }
+        if (numStages >= 2) { length /= 2; downsampleStage(stage2, in, out, length); std::swap(in, out); }
+        if (numStages >= 1) { length /= 2; downsampleStage(stage1, in, out, length); std::swap(in, out); }
+
+        // With an odd number of channels, both lanes hold the same channel
+        // and outA and outB are the same buffer.
+        for (int i = 0; i < numSamples; ++i) {
+            outA[i] = SampleType(in[i].first());
+            outB[i] = SampleType(in[i].second());
+        }
+    }
+
+private:
+    template<typename Stage>
+    static void upsampleStage(Stage& stage, const DoublePair* in, DoublePair* out, int length) noexcept
+    {
+        for (int i = 0; i < length; ++i) {
+            stage.upsample(in[i], out + 2 * i);
+        }
+    }
+
+    // The output has half as many samples as the input.
+    template<typename Stage>
+    static void downsampleStage(Stage& stage, const DoublePair* in, DoublePair* out, int length) noexcept
+    {
+        for (int i = 0; i < length; ++i) {
+            out[i] = stage.downsample(in + 2 * i);
+        }
+    }
+
+    DoublePair delay(DoublePair x) noexcept
+    {
+        if (paddingLength == 0) { return x; }
+        DoublePair y = padding[paddingPos];
+        padding[paddingPos] = x;
+        if (++paddingPos == paddingLength) { paddingPos = 0; }
+        return y;
+    }
+
+    // The first stage is the one closest to the original sample rate.
+    using Stage1 = HalfBandStage<36>;
+    using Stage2 = HalfBandStage<8>;
+    using Stage3 = HalfBandStage<4>;
+
+    static int numStagesFor(int factor)
+    {
+        int stages = 0;
+        while ((1 << stages) < factor) { ++stages; }
+        return stages;
+    }
+
+    // Adds up all delays in samples at the highest rate. Every stage runs at
+    // half the rate of the stage after it.
+    static int getTotalLatency(int factor, int innerLatency)
+    {
+        const int stageLatency[maxStages] = { Stage1::getLatency(), Stage2::getLatency(), Stage3::getLatency() };
+        const int stages = numStagesFor(factor);
+        int total = innerLatency;
+        for (int s = 0; s < stages; ++s) {
+            total += stageLatency[s] << (stages - 1 - s);
+        }
+        return total;
+    }
+
+    Stage1 stage1 { 10.0 };
+    Stage2 stage2 { 10.0 };
+    Stage3 stage3 { 9.5 };
+    int numStages = 0;
+    int factor = 1;
+    int maxBlockSize = 0;
+    int latency = 0;
+
+    DoublePair padding[maxFactor];
+    int paddingLength = 0;
+    int paddingPos = 0;
+
+    CacheAligned::Vector<DoublePair> work1;
+    CacheAligned::Vector<DoublePair> work2;
+    CacheAligned::Vector<double> bufferA;
+    CacheAligned::Vector<double> bufferB;
+};
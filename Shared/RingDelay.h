@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+    Fixed-capacity ring buffer used as the delay line in ClipOnly2 and ClipSoftly.
+
+    The original Airwindows code keeps an array of `spacing + 1` samples and
+    shifts every element down by one slot on each new sample. Here the samples
+    stay where they were written and only the read/write position moves, so the
+    cost per sample no longer depends on the length of the delay.
+
+    The length is a template argument of push(), so that the compiler can turn
+    the wrap-around into a single compare (or remove it when the length is 1).
+    Always call reset() before switching to a different length.
+*/
+template<typename T, int Capacity>
+class RingDelay
+{
+public:
+    void reset(T value = T())
+    {
+        for (int i = 0; i < Capacity; ++i) {
+            buffer[i] = value;
+        }
+        pos = 0;
+    }
+
+    // Writes the new value into the delay line and returns the oldest value
+    // that is still in there, i.e. the one written `Length - 1` calls ago.
+    // With a length of 1 this simply returns the value that was just written.
+    template<int Length>
+    T push(T value) noexcept
+    {
+        static_assert(Length >= 1 && Length <= Capacity, "invalid delay length");
+
+        // Nothing needs to be stored for a delay of one sample.
+        if constexpr (Length == 1) {
+            return value;
+        }
+
+        buffer[pos] = value;
+        if (++pos == Length) { pos = 0; }
+        return buffer[pos];
+    }
+
+    // Replaces the contents of the delay line with `Length - 1` values, oldest
+    // first. Afterwards, the delay line behaves as if those values had been
+    // pushed one after the other: the next push() returns values[0].
+    template<int Length>
+    void fill(const T* values) noexcept
+    {
+        static_assert(Length >= 1 && Length <= Capacity, "invalid delay length");
+
+        for (int i = 1; i < Length; ++i) {
+            buffer[i] = values[i - 1];
+        }
+        pos = 0;
+    }
+
+private:
+    T buffer[Capacity];
+    int pos = 0;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+    A fixed-size queue for passing values from one thread to one other thread,
+    for example from the audio thread to the message thread.
+
+    Both push() and pop() finish in a fixed number of steps, whatever the
+    other thread is doing: they don't lock, allocate, or retry. When the queue
+    is full, push() simply returns false and the value is lost, so the audio
+    thread never has to wait for a slow reader.
+
+    Only one thread may call push() and only one thread may call pop(). The
+    two positions live in separate cache lines, so the writer and the reader
+    don't slow each other down by sharing one.
+*/
+template<typename T, int Capacity>
+class SpscRing
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Called by the writer. Returns false if the queue is full.
+    bool push(const T& value) noexcept
+    {
+        std::uint32_t writePos = head.load(std::memory_order_relaxed);
+        if (writePos - tail.load(std::memory_order_acquire) == std::uint32_t(Capacity)) { return false; }
+
+        items[writePos & mask] = value;
+        head.store(writePos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the reader. Returns false if the queue is empty.
+    bool pop(T& value) noexcept
+    {
+        std::uint32_t readPos = tail.load(std::memory_order_relaxed);
+        if (readPos == head.load(std::memory_order_acquire)) { return false; }
+
+        value = items[readPos & mask];
+        tail.store(readPos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t mask = std::uint32_t(Capacity - 1);
+
+    // The positions only ever count up and wrap around at 2^32. The number of
+    // values in the queue is always head - tail.
+    alignas(64) std::atomic<std::uint32_t> head { 0 };
+    alignas(64) std::atomic<std::uint32_t> tail { 0 };
+    alignas(64) T items[Capacity];
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "DoublePair.h"
+#include "UnclippedSpans.h"
+
+/*
+    Estimates the true peak of a signal: the highest level of the continuous
+    waveform that a DAC reconstructs from the samples, which can be higher
+    than any of the samples themselves. Such intersample overs are what a
+    true-peak meter, as in ITU-R BS.1770, looks for.
+
+    Like such a meter, this upsamples by 4 and takes the largest value. The
+    upsampling is a polyphase interpolator: each of the points 1/4, 1/2, and
+    3/4 of the way from one sample to the next is a weighted sum of the 12
+    samples around it, the same length as the BS.1770 filter. The weights are
+    a Kaiser-windowed sinc (beta 5). On sine waves up to 0.42 times the sample
+    rate, the estimate is at most 0.05 dB above what ideal 4x interpolation
+    gives. Like any 4x meter, it can read up to about 0.4 dB low near the top
+    of the band, where the peak may fall between the upsampled points.
+
+    Clipped audio has harmonics all the way up to half the sample rate, and
+    there a short filter reads low too. On the output of ClipOnly2, this is
+    within 0.15 dB of a long reference filter for sine waves, but for white
+    noise, which is about as bad as it gets, it reads 1 to 1.5 dB low.
+
+    Most samples are nowhere near the ceiling, and then there is no need to
+    interpolate at all: no interpolated point can be more than maxGain times
+    the largest sample of the 12 that it's made of. The estimate only does the
+    work where one of these samples is above `ceiling / maxGain`, and the
+    peak it gives is exact (as far as the estimate goes) up from that level.
+*/
+namespace TruePeak
+{
+    constexpr int numTaps = 12;
+
+    // Row p gives the point (p + 1)/4 of the way from x[n] to x[n + 1], as a
+    // sum over x[n - 5] ... x[n + 6]. Each row adds up to 1.
+    constexpr double coefficients[3][numTaps] = {
+        { -0.0048795552122845431, 0.014719555272445391, -0.034300831940798623, 0.072401956694227318,
+          -0.16344709553391543, 0.89777545415466453, 0.29008368691563302, -0.10608427634900365,
+          0.050049278465353328, -0.022932813638973534, 0.0088858058531099907, -0.0022711646804578216 },
+        { -0.0048438698900604956, 0.016329486995672268, -0.039836273402200306, 0.085150469560677497,
+          -0.18444532553539081, 0.62764551227130183, 0.62764551227130183, -0.18444532553539081,
+          0.085150469560677497, -0.039836273402200306, 0.016329486995672268, -0.0048438698900604956 },
+        { -0.0022711646804578216, 0.0088858058531099907, -0.022932813638973534, 0.050049278465353328,
+          -0.10608427634900365, 0.29008368691563302, 0.89777545415466453, -0.16344709553391543,
+          0.072401956694227318, -0.034300831940798623, 0.014719555272445391, -0.0048795552122845431 },
+    };
+
+    // The largest sum of absolute coefficients of any row is 1.9165, rounded
+    // up here so that the level below which nothing can go over is safe.
+    constexpr double maxGain = 1.92;
+
+    /*
+        The largest absolute value of the three points between window[5] and
+        window[6], where the window holds 12 consecutive samples.
+    */
+    inline DoublePair peakBetween(const DoublePair* window) noexcept
+    {
+        // The three points and the even and odd taps are summed separately,
+        // which makes six short chains of additions instead of three long
+        // ones that each have to wait for the previous addition.
+        DoublePair even[3];
+        DoublePair odd[3];
+        for (int p = 0; p < 3; ++p) {
+            even[p] = window[0] * DoublePair::broadcast(coefficients[p][0]);
+            odd[p] = window[1] * DoublePair::broadcast(coefficients[p][1]);
+        }
+        for (int k = 2; k < numTaps; k += 2) {
+            for (int p = 0; p < 3; ++p) {
+                even[p] = even[p] + window[k] * DoublePair::broadcast(coefficients[p][k]);
+                odd[p] = odd[p] + window[k + 1] * DoublePair::broadcast(coefficients[p][k + 1]);
+            }
+        }
+        DoublePair peak = DoublePair::abs(even[0] + odd[0]);
+        peak = DoublePair::max(peak, DoublePair::abs(even[1] + odd[1]));
+        return DoublePair::max(peak, DoublePair::abs(even[2] + odd[2]));
+    }
+
+    /*
+        Measures the true peak of two channels, one per lane, such as a
+        plug-in's final output. The reading lags 6 samples behind the input,
+        which doesn't matter for a meter. It doesn't allocate or lock.
+    */
+    class Meter
+    {
+    public:
+        explicit Meter(double ceiling) : nearLevel(ceiling / maxGain) { }
+
+        void reset() noexcept
+        {
+            for (auto& x : window) { x = DoublePair(); }
+            position = 0;
+            sinceNear = numTaps;
+            peak = DoublePair();
+        }
+
+        // The largest true peak since the last call to resetPeak(), per lane.
+        DoublePair getPeak() const noexcept { return peak; }
+        void resetPeak() noexcept { peak = DoublePair(); }
+
+        template<typename SampleType>
+        void process(const SampleType* a, const SampleType* b, int numSamples) noexcept
+        {
+            const SampleType quiet = UnclippedSpans::thresholdFor<SampleType>(nearLevel);
+            const DoublePair near = DoublePair::broadcast(nearLevel);
+
+            int i = 0;
+            while (i < numSamples) {
+                // Once the window holds only quiet samples, skip ahead to the
+                // next sample that isn't quiet. Such spans can't go over, and
+                // their samples are all below the peak that counts.
+                if (sinceNear >= numTaps) {
+                    int span = UnclippedSpans::countBelow(a + i, b + i, numSamples - i, 1.0, quiet);
+                    if (span >= numTaps) {
+                        i += span;
+                        for (int k = 0; k < numTaps; ++k) {
+                            window[k] = window[k + numTaps] = DoublePair::set(a[i - numTaps + k], b[i - numTaps + k]);
+                        }
+                        position = 0;
+                        continue;
+                    }
+                }
+
+                DoublePair x = DoublePair::set(a[i], b[i]);
+                window[position] = window[position + numTaps] = x;
+                position = (position == numTaps - 1) ? 0 : position + 1;
+
+                DoublePair level = DoublePair::abs(x);
+                sinceNear = DoublePair::greaterThan(level, near).anyTrue() ? 0 : sinceNear + 1;
+                if (sinceNear < numTaps) {
+                    peak = DoublePair::max(peak, DoublePair::max(level, peakBetween(window + position)));
+                }
+                ++i;
+            }
+        }
+
+    private:
+        double nearLevel;
+
+        // The last 12 samples, twice, so that they are always in one piece:
+        // oldest first, they are window[position] ... window[position + 11].
+        DoublePair window[2 * numTaps];
+        int position = 0;
+
+        // How many samples ago the last sample above nearLevel was.
+        int sinceNear = numTaps;
+
+        DoublePair peak;
+    };
+
+    /*
+        Delays a signal by 12 samples, so that a clipper can see an intersample
+        over coming before it has to decide what to do with the samples around
+        it. For every sample that goes in, push() predicts the peak between the
+        samples 5 and 6 back if the signal were hard-clipped at the ceiling.
+        Where that peak is over, the 12 samples it is made of should all be
+        lowered by `ceiling / peak`. push() returns the sample from 12 samples
+        back, and in `scale` the lowest factor of the overs that this sample
+        is one of the 12 samples of, plus the next over on either side, or 1
+        when there are none.
+
+        Only lowering the two samples on either side of an over is not enough:
+        the samples around them are then lowered less, and with the negative
+        weights of the interpolator, the peak ends up higher than predicted.
+
+        The prediction is for a hard clip because the clipper's output is not
+        known yet. Softer clipping overshoots less, so the prediction errs on
+        the side of lowering the level a little too much.
+    */
+    class Lookahead
+    {
+    public:
+        static constexpr int hold = 6;
+        static constexpr int latency = numTaps / 2 + hold;
+
+        explicit Lookahead(double ceilingLevel) : ceiling(ceilingLevel), nearLevel(ceilingLevel / maxGain) { }
+
+        void reset() noexcept
+        {
+            for (auto& x : window) { x = DoublePair(); }
+            for (auto& x : scales) { x = DoublePair::broadcast(1.0); }
+            position = 0;
+            scalePosition = 0;
+            sinceNear = numTaps;
+            sinceOver = numScales;
+        }
+
+        DoublePair push(DoublePair x, DoublePair& scale) noexcept
+        {
+            const DoublePair one = DoublePair::broadcast(1.0);
+
+            window[position] = window[position + windowSize] = x;
+            position = (position == windowSize - 1) ? 0 : position + 1;
+
+            // Oldest first, the last 13 samples are now window[position] and
+            // up. The newest 12 of those are what the prediction looks at.
+            const DoublePair* recent = window + position + windowSize - numTaps;
+
+            sinceNear = DoublePair::greaterThan(DoublePair::abs(x), DoublePair::broadcast(nearLevel)).anyTrue()
+                      ? 0 : sinceNear + 1;
+
+            if (sinceNear < numTaps) {
+                const DoublePair posCeiling = DoublePair::broadcast(ceiling);
+                const DoublePair negCeiling = DoublePair::broadcast(-ceiling);
+                DoublePair clipped[numTaps];
+                for (int k = 0; k < numTaps; ++k) {
+                    clipped[k] = DoublePair::max(DoublePair::min(recent[k], posCeiling), negCeiling);
+                }
+                DoublePair peak = peakBetween(clipped);
+                DoublePair over = DoublePair::greaterThan(peak, posCeiling);
+                if (over.anyTrue()) {
+                    addScale(DoublePair::select(over, posCeiling / DoublePair::select(over, peak, one), one));
+                    sinceOver = 0;
+                } else if (sinceOver < numScales) {
+                    addScale(one);
+                    ++sinceOver;
+                }
+            } else if (sinceOver < numScales) {
+                addScale(one);
+                ++sinceOver;
+            }
+
+            // Once the last over has left the scales, they are all 1.
+            scale = one;
+            if (sinceOver < numScales) {
+                for (int k = 0; k < numScales; ++k) {
+                    scale = DoublePair::min(scale, scales[k]);
+                }
+            }
+            return window[position];
+        }
+
+    private:
+        // The sample that comes out plus the 12 after it.
+        static constexpr int windowSize = latency + 1;
+
+        // The overs whose 12 samples include the sample that comes out, plus
+        // one on either side.
+        static constexpr int numScales = 2 * hold + 2;
+
+        // The order of the scales doesn't matter, only which ones are there.
+        void addScale(DoublePair newScale) noexcept
+        {
+            scales[scalePosition] = newScale;
+            scalePosition = (scalePosition == numScales - 1) ? 0 : scalePosition + 1;
+        }
+
+        double ceiling;
+        double nearLevel;
+
+        // The last 13 samples, twice, like in Meter.
+        DoublePair window[2 * windowSize];
+        int position = 0;
+
+        DoublePair scales[numScales];
+        int scalePosition = 0;
+
+        // How many samples ago the last sample above nearLevel went in, and
+        // how many scales were added since the last over.
+        int sinceNear = numTaps;
+        int sinceOver = numScales;
+    };
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "DoublePair.h"
+
+/*
+    Helpers for the fast path in ClipOnly and ClipOnly2.
+
+    These clippers leave samples that don't clip alone: apart from the delay
+    and the output gain, such samples come out exactly as they went in. In
+    typical program material, almost all samples are like that. Rather than
+    running every sample through the clipping logic, the clippers look for
+    spans of samples that stay below the threshold, and copy those spans in
+    one go.
+*/
+namespace UnclippedSpans
+{
+    /*
+        The clippers can report what they see and put out, for ClipTelemetry,
+        through a probe that they call for every sample and every span. This
+        one doesn't measure anything and compiles away, so the clippers don't
+        get any slower when nobody is measuring. See ClipTelemetry::Probe for
+        what the calls mean.
+    */
+    struct NoProbe
+    {
+        static constexpr bool enabled = false;
+
+        void input(DoublePair) noexcept { }
+        void output(DoublePair) noexcept { }
+        void unclipped(DoublePair, DoublePair) noexcept { }
+    };
+
+    /*
+        Returns the largest float x for which `double(x) <= threshold`.
+
+        The clippers round the input to float and then compare it against the
+        threshold in double precision. Comparing the float against this value
+        instead gives exactly the same answer.
+    */
+    inline float floatThreshold(double threshold)
+    {
+        float x = float(threshold);
+        if (double(x) > threshold) { x = std::nextafter(x, 0.0f); }
+        return x;
+    }
+
+    /*
+        The threshold to pass to countBelow(). When processing double buffers,
+        the clippers don't round to float, so then it's simply the threshold.
+    */
+    template<typename T>
+    T thresholdFor(double threshold)
+    {
+        if constexpr (sizeof(T) == sizeof(float)) {
+            return floatThreshold(threshold);
+        } else {
+            return T(threshold);
+        }
+    }
+
+    namespace detail
+    {
+        // The largest of four floats.
+       #if AIRWINDOWS_DOUBLEPAIR_SSE2
+        inline float horizontalMax(__m128 x)
+        {
+            x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+            x = _mm_max_ss(x, _mm_shuffle_ps(x, x, 1));
+            return _mm_cvtss_f32(x);
+        }
+       #endif
+
+        // See countBelow(). With FindPeaks, also raises peakA and peakB to
+        // the largest magnitude in the span.
+        template<bool FindPeaks>
+        int countBelow(const float* a, const float* b, int numSamples, double gain, float threshold,
+                       float& peakA, float& peakB)
+        {
+            int i = 0;
+
+            /*
+                The samples are checked sixteen at a time, with a single
+                branch, and then four at a time to find the group of four that
+                ends the span. The peaks only take in groups that are entirely
+                in the span, so that they are updated after the check.
+            */
+           #if AIRWINDOWS_DOUBLEPAIR_SSE2
+            const __m128 t = _mm_set1_ps(threshold);
+            const __m128 signBit = _mm_set1_ps(-0.0f);
+            __m128 peaksA = _mm_setzero_ps();
+            __m128 peaksB = _mm_setzero_ps();
+
+            auto count = [&](auto load) {
+                for (; i + 16 <= numSamples; i += 16) {
+                    __m128 xa[4];
+                    __m128 xb[4];
+                    __m128 below = _mm_cmpeq_ps(t, t);
+                    for (int k = 0; k < 4; ++k) {
+                        xa[k] = load(a + i + 4*k);
+                        xb[k] = load(b + i + 4*k);
+                        below = _mm_and_ps(below, _mm_and_ps(_mm_cmple_ps(xa[k], t), _mm_cmple_ps(xb[k], t)));
+                    }
+                    if (_mm_movemask_ps(below) != 0xF) { break; }
+                    if constexpr (FindPeaks) {
+                        peaksA = _mm_max_ps(peaksA, _mm_max_ps(_mm_max_ps(xa[0], xa[1]), _mm_max_ps(xa[2], xa[3])));
+                        peaksB = _mm_max_ps(peaksB, _mm_max_ps(_mm_max_ps(xb[0], xb[1]), _mm_max_ps(xb[2], xb[3])));
+                    }
+                }
+                for (; i + 4 <= numSamples; i += 4) {
+                    __m128 xa = load(a + i);
+                    __m128 xb = load(b + i);
+                    __m128 below = _mm_and_ps(_mm_cmple_ps(xa, t), _mm_cmple_ps(xb, t));
+                    if (_mm_movemask_ps(below) != 0xF) { break; }
+                    if constexpr (FindPeaks) {
+                        peaksA = _mm_max_ps(peaksA, xa);
+                        peaksB = _mm_max_ps(peaksB, xb);
+                    }
+                }
+            };
+
+            // Without a gain, there is nothing to round. Otherwise, the four
+            // floats are widened to double, multiplied, and rounded back.
+            if (gain == 1.0) {
+                count([&](const float* x) { return _mm_andnot_ps(signBit, _mm_loadu_ps(x)); });
+            } else {
+                const __m128d g = _mm_set1_pd(gain);
+                count([&](const float* x) {
+                    __m128 v = _mm_loadu_ps(x);
+                    __m128 low = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(v), g));
+                    __m128 high = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), g));
+                    return _mm_andnot_ps(signBit, _mm_movelh_ps(low, high));
+                });
+            }
+
+            if constexpr (FindPeaks) {
+                peakA = std::max(peakA, horizontalMax(peaksA));
+                peakB = std::max(peakB, horizontalMax(peaksB));
+            }
+           #elif AIRWINDOWS_DOUBLEPAIR_NEON
+            const float32x4_t t = vdupq_n_f32(threshold);
+            float32x4_t peaksA = vdupq_n_f32(0.0f);
+            float32x4_t peaksB = vdupq_n_f32(0.0f);
+
+            auto count = [&](auto load) {
+                for (; i + 16 <= numSamples; i += 16) {
+                    float32x4_t xa[4];
+                    float32x4_t xb[4];
+                    uint32x4_t below = vdupq_n_u32(~0u);
+                    for (int k = 0; k < 4; ++k) {
+                        xa[k] = load(a + i + 4*k);
+                        xb[k] = load(b + i + 4*k);
+                        below = vandq_u32(below, vandq_u32(vcleq_f32(xa[k], t), vcleq_f32(xb[k], t)));
+                    }
+                    if (vminvq_u32(below) == 0) { break; }
+                    if constexpr (FindPeaks) {
+                        peaksA = vmaxq_f32(peaksA, vmaxq_f32(vmaxq_f32(xa[0], xa[1]), vmaxq_f32(xa[2], xa[3])));
+                        peaksB = vmaxq_f32(peaksB, vmaxq_f32(vmaxq_f32(xb[0], xb[1]), vmaxq_f32(xb[2], xb[3])));
+                    }
+                }
+                for (; i + 4 <= numSamples; i += 4) {
+                    float32x4_t xa = load(a + i);
+                    float32x4_t xb = load(b + i);
+                    uint32x4_t below = vandq_u32(vcleq_f32(xa, t), vcleq_f32(xb, t));
+                    if (vminvq_u32(below) == 0) { break; }
+                    if constexpr (FindPeaks) {
+                        peaksA = vmaxq_f32(peaksA, xa);
+                        peaksB = vmaxq_f32(peaksB, xb);
+                    }
+                }
+            };
+
+            if (gain == 1.0) {
+                count([&](const float* x) { return vabsq_f32(vld1q_f32(x)); });
+            } else {
+                const float64x2_t g = vdupq_n_f64(gain);
+                count([&](const float* x) {
+                    float32x4_t v = vld1q_f32(x);
+                    float32x2_t low = vcvt_f32_f64(vmulq_f64(vcvt_f64_f32(vget_low_f32(v)), g));
+                    float32x2_t high = vcvt_f32_f64(vmulq_f64(vcvt_high_f64_f32(v), g));
+                    return vabsq_f32(vcombine_f32(low, high));
+                });
+            }
+
+            if constexpr (FindPeaks) {
+                peakA = std::max(peakA, vmaxvq_f32(peaksA));
+                peakB = std::max(peakB, vmaxvq_f32(peaksB));
+            }
+           #endif
+
+            // Finish the last few samples, or find exactly where the span ends
+            // within the group of four that stopped the loop above.
+            for (; i < numSamples; ++i) {
+                float xa = std::abs(float(double(a[i]) * gain));
+                float xb = std::abs(float(double(b[i]) * gain));
+                if (!(xa <= threshold && xb <= threshold)) { break; }
+                if constexpr (FindPeaks) {
+                    peakA = std::max(peakA, xa);
+                    peakB = std::max(peakB, xb);
+                }
+            }
+            return i;
+        }
+
+        template<bool FindPeaks>
+        int countBelow(const double* a, const double* b, int numSamples, double gain, double threshold,
+                       double& peakA, double& peakB)
+        {
+            int i = 0;
+
+            // Here each DoublePair holds two consecutive samples of one channel.
+            // A sample exactly at the threshold (or NaN) stops this loop early,
+            // and the loop below then decides what to do with it.
+            const DoublePair g = DoublePair::broadcast(gain);
+            const DoublePair t = DoublePair::broadcast(threshold);
+            DoublePair peaksA;
+            DoublePair peaksB;
+
+            for (; i + 2 <= numSamples; i += 2) {
+                DoublePair xa = DoublePair::abs(DoublePair::set(a[i], a[i + 1]) * g);
+                DoublePair xb = DoublePair::abs(DoublePair::set(b[i], b[i + 1]) * g);
+                DoublePair below = DoublePair::lessThan(xa, t) & DoublePair::lessThan(xb, t);
+                if (!(below.firstTrue() && below.secondTrue())) { break; }
+                if constexpr (FindPeaks) {
+                    peaksA = DoublePair::max(peaksA, xa);
+                    peaksB = DoublePair::max(peaksB, xb);
+                }
+            }
+
+            if constexpr (FindPeaks) {
+                peakA = std::max(peakA, std::max(peaksA.first(), peaksA.second()));
+                peakB = std::max(peakB, std::max(peaksB.first(), peaksB.second()));
+            }
+
+            for (; i < numSamples; ++i) {
+                double xa = std::abs(a[i] * gain);
+                double xb = std::abs(b[i] * gain);
+                if (!(xa <= threshold && xb <= threshold)) { break; }
+                if constexpr (FindPeaks) {
+                    peakA = std::max(peakA, xa);
+                    peakB = std::max(peakB, xb);
+                }
+            }
+            return i;
+        }
+    }
+
+    /*
+        Counts how many samples at the start of `a` and `b` stay below the
+        threshold after applying the gain, i.e. `|a[i] * gain| <= threshold`
+        and the same for b[i]. Stops at the first sample in either channel
+        that is above the threshold (or is NaN).
+
+        The gain is applied the way the clippers do it: the product is taken
+        in double precision and then rounded to the precision of the samples.
+        Multiplying in float instead would round differently whenever the
+        gain is not exactly a float, and then the span would not end at the
+        same sample as in the clipper, so the output would depend on how the
+        host splits up the blocks.
+    */
+    template<typename T>
+    int countBelow(const T* a, const T* b, int numSamples, double gain, T threshold)
+    {
+        T peakA = 0;
+        T peakB = 0;
+        return detail::countBelow<false>(a, b, numSamples, gain, threshold, peakA, peakB);
+    }
+
+    /*
+        The same, and also raises `peakA` and `peakB` to the largest
+        `|a[i] * gain|` and `|b[i] * gain|` in the span, rounded the same way.
+        That's the input peak of the span as the clipper sees it, and costs a
+        few more instructions per sixteen samples.
+    */
+    template<typename T>
+    int countBelow(const T* a, const T* b, int numSamples, double gain, T threshold, T& peakA, T& peakB)
+    {
+        return detail::countBelow<true>(a, b, numSamples, gain, threshold, peakA, peakB);
+    }
+
+    /*
+        Writes `in[i] * inputLevel * outputLevel` to `out[i + delay]`, for the
+        first `numSamples` samples of `in`, rounded exactly like the clippers
+        do it for a sample that doesn't clip: the input level is applied in
+        double precision and rounded to the sample type, and then the same
+        for the output level. That way the result doesn't depend on whether
+        a sample went through here or through the clipper, whatever the gains.
+
+        The input and output may be the same buffer, so the samples are moved
+        first and scaled afterwards.
+    */
+    template<typename T>
+    void delayedCopy(const T* in, T* out, int delay, int numSamples, double inputLevel, double outputLevel)
+    {
+        std::memmove(out + delay, in, size_t(numSamples) * sizeof(T));
+
+        T* dest = out + delay;
+        for (int i = 0; i < numSamples; ++i) {
+            dest[i] = T(double(T(double(dest[i]) * inputLevel)) * outputLevel);
+        }
+    }
+
+    /*
+        Returns the largest `|data[i]|`, for samples that are not NaN.
+
+        Without the sign bit, the bit patterns of such numbers are in the same
+        order as their magnitudes, so comparing them as integers finds the
+        peak. Unlike std::max() on floating point, the compiler vectorizes
+        that.
+    */
+    template<typename T>
+    T peakOf(const T* data, int numSamples)
+    {
+        using Bits = std::conditional_t<sizeof(T) == sizeof(std::uint32_t), std::uint32_t, std::uint64_t>;
+        const Bits magnitudeBits = ~Bits(0) >> 1;
+
+        Bits peakBits = 0;
+        for (int i = 0; i < numSamples; ++i) {
+            Bits bits;
+            std::memcpy(&bits, &data[i], sizeof(T));
+            peakBits = std::max(peakBits, Bits(bits & magnitudeBits));
+        }
+
+        T peak;
+        std::memcpy(&peak, &peakBits, sizeof(T));
+        return peak;
+    }
+
+    /*
+        The peak of the `numSamples` samples that delayedCopy() wrote to `out`,
+        given the input peak of the whole span from countBelow() and the peak
+        of the samples at its end that stayed behind in the delay. Rounding
+        keeps the magnitudes in order, so when the span's peak was copied,
+        the output peak follows from it, and only otherwise does this have to
+        look at the output.
+    */
+    template<typename T>
+    T outputPeak(T spanPeak, T tailPeak, const T* out, int numSamples, double outputLevel)
+    {
+        if (tailPeak < spanPeak) {
+            return T(double(spanPeak) * std::abs(outputLevel));
+        }
+        return peakOf(out, numSamples);
+    }
+}
@@ -0,0 +1,763 @@
+/*
+    Command-line tool that runs audio files through one of the plug-ins, without
+    a host or a GUI. The files are rendered in parallel, one file per thread,
+    and the tool reports how long this took.
+
+    Usage:
+        BatchRender <plug-in> [options] <file> [<file> ...]
+
+    Options:
+        --param <id>=<value>  Set a parameter in its own units, e.g. Input=12.
+                              This option can be used more than once.
+        --threads <n>         Number of worker threads. Default: one per core.
+        --block-size <n>      Samples per call to processBlock. Default: 512.
+        --block-size random   Use a different block size on every call, picked
+                              at random between 1 and 512 (or the size given by
+                              another --block-size option). The sizes are the
+                              same on every run.
+        --output-dir <dir>    Where to write the results. Default: next to the
+                              input file. The output is always a WAV file named
+                              `<input>-<plug-in>.wav`.
+        --compare <dir>       Compare the output against the files with the
+                              same names in this folder, for example the output
+                              of an earlier version of the plug-in.
+        --tolerance <x>       Largest difference that --compare accepts.
+                              Default: 0, meaning the output must be bit-exact.
+        --mmap                Read and write the files through memory maps, a
+                              window at a time, so that the memory use doesn't
+                              grow with the length of the files. Files whose
+                              format can't be memory-mapped are rendered as
+                              usual.
+        --integer             BitShiftGain only: shift the samples of 16, 24,
+                              and 32-bit integer WAV files directly, without
+                              converting them to float and back. Other files
+                              are rendered as usual.
+        --isa <level>         Run the kernels with this instruction set:
+                              generic, sse4, avx2, or avx512. Default: the best
+                              one that the CPU supports.
+        --isa all             Render the files once for every instruction set
+                              that the CPU supports. Use with --compare to
+                              check that they all give the same output.
+
+    To create a set of test files to run through the plug-ins:
+        BatchRender --write-test-signals <dir>
+
+    The latency that the plug-in reports is compensated for, so the output lines
+    up with the input and has the same length. The output uses the same bit
+    depth as the input, so use 32-bit float files when comparing outputs.
+*/
+
+#include <JuceHeader.h>
+#include "../../Common/Processors.h"
+#include "../../Common/TestSignals.h"
+#include "../../../BitShiftGain/Source/PluginProcessor.h"
+#include "../../../Shared/CpuDispatch.h"
+#include "MappedWavWriter.h"
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+    #include <sys/resource.h>
+#endif
+
+namespace
+{
+    struct Settings
+    {
+        juce::String pluginName;
+        juce::StringPairArray parameters;
+        int numThreads = juce::SystemStats::getNumCpus();
+        int blockSize = 512;
+        bool randomBlockSizes = false;
+        juce::File outputDir;
+        juce::File compareDir;
+        double tolerance = 0.0;
+        bool integer = false;
+        bool mmap = false;
+
+        // The instruction sets to render with, one pass each. Empty means the
+        // best one that the CPU supports.
+        std::vector<CpuDispatch::Level> isaLevels;
+    };
+
+    // Where the samples are in a WAV file, and what kind of samples they are.
+    struct WavLayout
+    {
+        int formatTag = 0;      // 1 for integer PCM, 3 for float
+        int numChannels = 0;
+        int bitsPerSample = 0;
+        double sampleRate = 0.0;
+        juce::int64 dataStart = -1;
+        juce::int64 dataSize = 0;
+    };
+
+    // Reads the chunks of a WAV file up to the samples. Returns false if it's
+    // not a WAV file or if it has no samples. RF64 files are not supported.
+    bool readWavLayout(juce::InputStream& input, WavLayout& layout)
+    {
+        char chunkID[4];
+        if (input.read(chunkID, 4) != 4 || std::memcmp(chunkID, "RIFF", 4) != 0) { return false; }
+        input.readInt();
+        if (input.read(chunkID, 4) != 4 || std::memcmp(chunkID, "WAVE", 4) != 0) { return false; }
+
+        // Chunks have an even size, so an odd-sized chunk is followed by a
+        // padding byte.
+        while (layout.dataStart < 0 && input.read(chunkID, 4) == 4) {
+            auto chunkSize = juce::int64(juce::uint32(input.readInt()));
+            auto chunkStart = input.getPosition();
+
+            if (std::memcmp(chunkID, "fmt ", 4) == 0 && chunkSize >= 16) {
+                layout.formatTag = input.readShort() & 0xFFFF;
+                layout.numChannels = input.readShort();
+                layout.sampleRate = double(input.readInt());
+                input.readInt();    // bytes per second
+                input.readShort();  // bytes per frame
+                layout.bitsPerSample = input.readShort();
+
+                // WAVE_FORMAT_EXTENSIBLE has the actual format in the first
+                // two bytes of the sub-format GUID. It can also have fewer
+                // valid bits than the samples take up, which is not handled.
+                if (layout.formatTag == 0xFFFE && chunkSize >= 40) {
+                    input.readShort();
+                    int validBits = input.readShort();
+                    input.readInt();  // channel mask
+                    layout.formatTag = input.readShort() & 0xFFFF;
+                    if (validBits != layout.bitsPerSample) { layout.formatTag = 0; }
+                }
+            } else if (std::memcmp(chunkID, "data", 4) == 0) {
+                layout.dataStart = chunkStart;
+                layout.dataSize = std::min(chunkSize, input.getTotalLength() - chunkStart);
+            }
+            input.setPosition(chunkStart + chunkSize + (chunkSize & 1));
+        }
+        return layout.dataStart >= 0 && layout.numChannels > 0 && layout.bitsPerSample > 0;
+    }
+
+    // The number of frames that --mmap maps at a time. That's 2 MB for stereo
+    // 32-bit float, which is large enough that the cost of mapping is small.
+    constexpr juce::int64 mappedWindowSize = 1 << 18;
+
+    // Tells the OS which part of a file will be read next, so that it can read
+    // it from disk while the current part is being processed. This only does
+    // something on Linux.
+    class ReadAhead
+    {
+    public:
+        explicit ReadAhead(const juce::File& file)
+        {
+           #if defined(__linux__)
+            fd = ::open(file.getFullPathName().toRawUTF8(), O_RDONLY);
+            if (fd >= 0) { posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); }
+           #endif
+        }
+
+        ~ReadAhead()
+        {
+           #if defined(__linux__)
+            if (fd >= 0) { ::close(fd); }
+           #endif
+        }
+
+        void willNeed(juce::int64 start, juce::int64 length)
+        {
+           #if defined(__linux__)
+            if (fd >= 0) { posix_fadvise(fd, off_t(start), off_t(length), POSIX_FADV_WILLNEED); }
+           #endif
+        }
+
+    private:
+        int fd = -1;
+
+        JUCE_DECLARE_NON_COPYABLE(ReadAhead)
+    };
+
+    class RenderJob : public juce::ThreadPoolJob
+    {
+    public:
+        RenderJob(const Settings& settingsToUse, const juce::File& fileToRender) :
+            juce::ThreadPoolJob(fileToRender.getFileName()), inputFile(fileToRender), settings(settingsToUse)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            render();
+            if (error.isEmpty() && settings.compareDir != juce::File()) { compare(); }
+            totalSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+            return jobHasFinished;
+        }
+
+        const juce::File inputFile;
+        juce::File outputFile;
+        juce::String error;
+        juce::int64 numFrames = 0;
+        int numChannels = 0;
+        double sampleRate = 0.0;
+        double totalSeconds = 0.0;
+        double processSeconds = 0.0;
+        float maxDifference = 0.0f;
+        juce::int64 numDifferences = 0;
+        bool renderedAsInteger = false;
+        bool renderedMapped = false;
+
+    private:
+        void render()
+        {
+            if (settings.integer && renderInteger()) { return; }
+            if (settings.mmap && renderMapped()) { return; }
+
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+
+            std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputFile));
+            if (reader == nullptr) { error = "cannot read file"; return; }
+
+            numFrames = reader->lengthInSamples;
+            numChannels = int(reader->numChannels);
+            sampleRate = reader->sampleRate;
+
+            auto processor = createProcessor();
+            if (processor == nullptr) { return; }
+
+            outputFile = getOutputFile(*processor);
+            outputFile.deleteFile();
+
+            juce::WavAudioFormat wavFormat;
+            auto stream = outputFile.createOutputStream();
+            int bitsPerSample = std::min(int(reader->bitsPerSample), 32);
+            std::unique_ptr<juce::AudioFormatWriter> writer;
+            if (stream != nullptr) {
+                writer.reset(wavFormat.createWriterFor(stream.get(), sampleRate, unsigned(numChannels),
+                                                       bitsPerSample, reader->metadataValues, 0));
+            }
+            if (writer == nullptr) { error = "cannot write " + outputFile.getFullPathName(); return; }
+            stream.release();  // now owned by the writer
+
+            // Allocate the buffer once. Other blocks may be shorter, but
+            // setSize() will then reuse the memory that is already there.
+            juce::AudioBuffer<float> buffer(numChannels, settings.blockSize);
+            juce::MidiBuffer midi;
+
+            // Run the plug-in for `latency` extra samples, feeding it silence
+            // past the end of the file, and drop that many samples from the
+            // start of the output.
+            juce::int64 latency = processor->getLatencySamples();
+            juce::int64 totalFrames = numFrames + latency;
+            juce::int64 ticks = 0;
+
+            // The random block sizes use a fixed seed, so they are the same
+            // every time and for every file.
+            juce::Random random(1);
+
+            for (juce::int64 pos = 0; pos < totalFrames; ) {
+                int blockSize = settings.randomBlockSizes ? random.nextInt(juce::Range<int>(1, settings.blockSize + 1)) : settings.blockSize;
+                int numSamples = int(std::min(juce::int64(blockSize), totalFrames - pos));
+                buffer.setSize(numChannels, numSamples, false, false, true);
+
+                // The reader fills anything past the end of the file with zeros.
+                reader->read(&buffer, 0, numSamples, pos, true, true);
+
+                auto startTicks = juce::Time::getHighResolutionTicks();
+                processor->processBlock(buffer, midi);
+                ticks += juce::Time::getHighResolutionTicks() - startTicks;
+
+                int skip = int(std::clamp(latency - pos, juce::int64(0), juce::int64(numSamples)));
+                if (!writer->writeFromAudioSampleBuffer(buffer, skip, numSamples - skip)) {
+                    error = "write failed";
+                    return;
+                }
+                pos += numSamples;
+            }
+
+            processor->releaseResources();
+            processSeconds = std::max(juce::Time::highResolutionTicksToSeconds(ticks), 1.0e-9);
+        }
+
+        // Creates the plug-in with the parameters from the command line, and
+        // prepares it for this file. Returns nullptr and sets `error` if the
+        // plug-in doesn't support the file's number of channels.
+        std::unique_ptr<juce::AudioProcessor> createProcessor()
+        {
+            auto processor = Processors::create(settings.pluginName);
+            for (auto& id : settings.parameters.getAllKeys()) {
+                Processors::setParameter(*processor, id, settings.parameters[id].getFloatValue());
+            }
+
+            if (!Processors::prepare(*processor, numChannels, sampleRate, settings.blockSize)) {
+                error = "unsupported number of channels";
+                return nullptr;
+            }
+            return processor;
+        }
+
+        juce::File getOutputFile(const juce::AudioProcessor& processor) const
+        {
+            auto dir = settings.outputDir == juce::File() ? inputFile.getParentDirectory() : settings.outputDir;
+            return dir.getChildFile(inputFile.getFileNameWithoutExtension() + "-" + processor.getName() + ".wav");
+        }
+
+        /*
+            Like render(), but reads the file through JUCE's memory-mapped
+            reader and writes the output through a memory map as well, see
+            MappedWavWriter. Only one window of each file is mapped at a time,
+            so the memory use stays the same however long the file is. The
+            windows start on block boundaries, so the plug-in gets the same
+            processBlock() calls as with render(), and the output is the same,
+            except that metadata is not copied.
+
+            Returns false if the file's format can't be memory-mapped, so that
+            it can be rendered the usual way instead.
+        */
+        bool renderMapped()
+        {
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+
+            auto* format = formatManager.findFormatForFileExtension(inputFile.getFileExtension());
+            if (format == nullptr) { return false; }
+
+            std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader(format->createMemoryMappedReader(inputFile));
+            if (reader == nullptr) { return false; }
+
+            renderedMapped = true;
+            numFrames = reader->lengthInSamples;
+            numChannels = int(reader->numChannels);
+            sampleRate = reader->sampleRate;
+
+            auto processor = createProcessor();
+            if (processor == nullptr) { return true; }
+
+            outputFile = getOutputFile(*processor);
+            MappedWavWriter writer;
+            if (!writer.create(outputFile, sampleRate, numChannels, std::min(int(reader->bitsPerSample), 32), numFrames)) {
+                error = "cannot write " + outputFile.getFullPathName();
+                return true;
+            }
+
+            // To tell the OS which part of the input comes next, this needs to
+            // know where the samples are. For files other than WAV, there are
+            // no hints and the OS does its usual read-ahead.
+            WavLayout layout;
+            {
+                juce::FileInputStream input(inputFile);
+                if (input.openedOk()) { readWavLayout(input, layout); }
+            }
+            const juce::int64 bytesPerFrame = juce::int64(layout.numChannels) * layout.bitsPerSample / 8;
+            ReadAhead readAhead(inputFile);
+
+            juce::AudioBuffer<float> buffer(numChannels, settings.blockSize);
+            juce::MidiBuffer midi;
+
+            // The same latency compensation as in render(). The output window
+            // is `latency` frames behind the input window.
+            juce::int64 latency = processor->getLatencySamples();
+            juce::int64 totalFrames = numFrames + latency;
+            juce::int64 ticks = 0;
+            juce::Random random(1);
+
+            // A new window starts at the first block that doesn't fit in the
+            // current one, so that no block is cut in two and the plug-in gets
+            // exactly the same blocks as in render(). The end of the old window,
+            // where that block starts, is mapped again as part of the new one.
+            juce::int64 windowEnd = 0;
+
+            for (juce::int64 pos = 0; pos < totalFrames; ) {
+                int blockSize = settings.randomBlockSizes ? random.nextInt(juce::Range<int>(1, settings.blockSize + 1)) : settings.blockSize;
+                int numSamples = int(std::min(juce::int64(blockSize), totalFrames - pos));
+
+                if (pos + numSamples > windowEnd) {
+                    juce::int64 windowStart = pos;
+                    windowEnd = std::min(windowStart + std::max(mappedWindowSize, juce::int64(numSamples)), totalFrames);
+
+                    juce::Range<juce::int64> inputFrames(std::min(windowStart, numFrames), std::min(windowEnd, numFrames));
+                    if (!inputFrames.isEmpty() && !reader->mapSectionOfFile(inputFrames)) {
+                        error = "cannot map the file";
+                        return true;
+                    }
+                    if (!writer.mapFrames({ std::max(windowStart - latency, juce::int64(0)), windowEnd - latency })) {
+                        error = "cannot map " + outputFile.getFullPathName();
+                        return true;
+                    }
+
+                    if (layout.dataStart >= 0 && windowEnd < numFrames) {
+                        auto nextFrames = std::min(mappedWindowSize, numFrames - windowEnd);
+                        readAhead.willNeed(layout.dataStart + windowEnd * bytesPerFrame, nextFrames * bytesPerFrame);
+                    }
+                }
+
+                buffer.setSize(numChannels, numSamples, false, false, true);
+
+                // Only the part of the file that is in the window may be
+                // read. Past the end of the file, the plug-in gets silence.
+                int numInFile = int(std::clamp(numFrames - pos, juce::int64(0), juce::int64(numSamples)));
+                if (numInFile > 0) { reader->read(&buffer, 0, numInFile, pos, true, true); }
+                if (numInFile < numSamples) { buffer.clear(numInFile, numSamples - numInFile); }
+
+                auto startTicks = juce::Time::getHighResolutionTicks();
+                processor->processBlock(buffer, midi);
+                ticks += juce::Time::getHighResolutionTicks() - startTicks;
+
+                int skip = int(std::clamp(latency - pos, juce::int64(0), juce::int64(numSamples)));
+                writer.write(buffer, skip, numSamples - skip, pos + skip - latency);
+                pos += numSamples;
+            }
+
+            writer.close();
+            processor->releaseResources();
+            processSeconds = std::max(juce::Time::highResolutionTicksToSeconds(ticks), 1.0e-9);
+            return true;
+        }
+
+        /*
+            Shifts the samples of an integer WAV file directly, without turning
+            them into floats, see BitShiftPCM.h. The samples are interleaved in
+            the file, but since every sample gets the same shift, they can be
+            done as they are. Everything around the samples, such as the header
+            and any metadata chunks, is copied unchanged.
+
+            Returns false if the file is not a WAV file with 16, 24, or 32-bit
+            integer samples, so that it can be rendered the usual way instead.
+        */
+        bool renderInteger()
+        {
+            juce::FileInputStream input(inputFile);
+            if (!input.openedOk()) { return false; }
+
+            WavLayout layout;
+            if (!readWavLayout(input, layout)) { return false; }
+
+            constexpr int pcm = 1;
+            if (layout.formatTag != pcm) { return false; }
+
+            BitShift::PCMFormat format;
+            switch (layout.bitsPerSample) {
+                case 16: format = BitShift::PCMFormat::int16; break;
+                case 24: format = BitShift::PCMFormat::int24Packed; break;
+                case 32: format = BitShift::PCMFormat::int32; break;
+                default: return false;
+            }
+
+            renderedAsInteger = true;
+            numChannels = layout.numChannels;
+            sampleRate = layout.sampleRate;
+
+            BitShiftGain::AudioProcessor processor;
+            for (auto& id : settings.parameters.getAllKeys()) {
+                Processors::setParameter(processor, id, settings.parameters[id].getFloatValue());
+            }
+
+            outputFile = getOutputFile(processor);
+            outputFile.deleteFile();
+
+            juce::FileOutputStream output(outputFile);
+            if (output.failedToOpen()) { error = "cannot write " + outputFile.getFullPathName(); return true; }
+
+            // The header, up to the first sample.
+            input.setPosition(0);
+            if (output.writeFromInputStream(input, layout.dataStart) != layout.dataStart) { error = "write failed"; return true; }
+
+            int bytesPerSample = BitShift::bytesPerSample(format);
+            numFrames = layout.dataSize / (juce::int64(bytesPerSample) * numChannels);
+
+            // A whole number of samples at a time. If the data chunk ends with
+            // a partial sample, those bytes are copied as they are.
+            const int bufferSize = 65536 * bytesPerSample;
+            juce::HeapBlock<char> buffer(bufferSize);
+            juce::int64 ticks = 0;
+
+            for (juce::int64 pos = 0; pos < layout.dataSize; ) {
+                int numBytes = int(std::min(juce::int64(bufferSize), layout.dataSize - pos));
+                if (input.read(buffer, numBytes) != numBytes) { error = "read failed"; return true; }
+
+                auto startTicks = juce::Time::getHighResolutionTicks();
+                processor.processPCM(buffer, format, numBytes / bytesPerSample);
+                ticks += juce::Time::getHighResolutionTicks() - startTicks;
+
+                if (!output.write(buffer, size_t(numBytes))) { error = "write failed"; return true; }
+                pos += numBytes;
+            }
+
+            // Anything after the samples, such as metadata at the end.
+            output.writeFromInputStream(input, -1);
+            output.flush();
+            if (output.getStatus().failed()) { error = "write failed"; return true; }
+
+            processSeconds = std::max(juce::Time::highResolutionTicksToSeconds(ticks), 1.0e-9);
+            return true;
+        }
+
+        // Reads back the output file and the reference file and finds the
+        // largest difference between them.
+        void compare()
+        {
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+
+            auto referenceFile = settings.compareDir.getChildFile(outputFile.getFileName());
+            std::unique_ptr<juce::AudioFormatReader> reference(formatManager.createReaderFor(referenceFile));
+            if (reference == nullptr) { error = "cannot read " + referenceFile.getFullPathName(); return; }
+
+            std::unique_ptr<juce::AudioFormatReader> output(formatManager.createReaderFor(outputFile));
+            if (output == nullptr) { error = "cannot read " + outputFile.getFullPathName(); return; }
+
+            if (reference->numChannels != output->numChannels || reference->lengthInSamples != output->lengthInSamples) {
+                error = "the reference file has a different length or number of channels";
+                return;
+            }
+
+            const int chunkSize = 65536;
+            juce::AudioBuffer<float> expected(numChannels, chunkSize);
+            juce::AudioBuffer<float> actual(numChannels, chunkSize);
+
+            for (juce::int64 pos = 0; pos < output->lengthInSamples; pos += chunkSize) {
+                int numSamples = int(std::min(juce::int64(chunkSize), output->lengthInSamples - pos));
+                reference->read(&expected, 0, numSamples, pos, true, true);
+                output->read(&actual, 0, numSamples, pos, true, true);
+
+                for (int channel = 0; channel < numChannels; ++channel) {
+                    const float* a = expected.getReadPointer(channel);
+                    const float* b = actual.getReadPointer(channel);
+                    for (int i = 0; i < numSamples; ++i) {
+                        float difference = std::abs(a[i] - b[i]);
+                        if (difference > maxDifference) { maxDifference = difference; }
+                        if (a[i] != b[i]) { ++numDifferences; }
+                    }
+                }
+            }
+        }
+
+        const Settings& settings;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderJob)
+    };
+
+    void printUsage()
+    {
+        std::cout << "Usage: BatchRender <plug-in> [options] <file> [<file> ...]\n\n"
+                  << "Plug-ins: " << Processors::getNames().joinIntoString(", ") << "\n\n"
+                  << "Options:\n"
+                  << "  --param <id>=<value>  set a parameter, e.g. --param Input=12\n"
+                  << "  --threads <n>         number of worker threads (default: one per core)\n"
+                  << "  --block-size <n>      samples per processBlock call (default: 512)\n"
+                  << "  --block-size random   random block sizes between 1 and 512\n"
+                  << "  --output-dir <dir>    where to write the output files\n"
+                  << "  --compare <dir>       compare the output to the files in this folder\n"
+                  << "  --tolerance <x>       largest difference that --compare accepts (default: 0)\n"
+                  << "  --mmap                read and write through memory maps, with constant memory use\n"
+                  << "  --integer             BitShiftGain only: shift integer WAV files without converting to float\n"
+                  << "  --isa <level>         instruction set: generic, sse4, avx2, avx512, or all (default: best)\n\n"
+                  << "Or: BatchRender --write-test-signals <dir>\n";
+    }
+
+    // The most memory that the process has used so far, in megabytes, or 0
+    // if this is not known.
+    double getPeakMemoryMB()
+    {
+       #if defined(__APPLE__)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0.0; }
+        return double(usage.ru_maxrss) / (1024.0 * 1024.0);  // in bytes
+       #elif defined(__linux__)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0.0; }
+        return double(usage.ru_maxrss) / 1024.0;  // in kilobytes
+       #else
+        return 0.0;
+       #endif
+    }
+
+    // Formats a number of samples per second as e.g. "12.3 M".
+    juce::String formatRate(double samplesPerSecond)
+    {
+        return juce::String(samplesPerSecond / 1.0e6, 1) + " M";
+    }
+
+    // Renders all of the files once, prints a report, and returns how many
+    // of them failed or were different from the reference.
+    int renderFiles(const Settings& settings, const juce::Array<juce::File>& inputFiles)
+    {
+        juce::OwnedArray<RenderJob> jobs;
+        juce::ThreadPool pool(settings.numThreads);
+
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (auto& file : inputFiles) {
+            auto* job = jobs.add(new RenderJob(settings, file));
+            pool.addJob(job, false);
+        }
+        for (auto* job : jobs) {
+            pool.waitForJobToFinish(job, -1);
+        }
+
+        double wallSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+
+        double totalSamples = 0.0;
+        double totalProcessSeconds = 0.0;
+        int numFailed = 0;
+
+        for (auto* job : jobs) {
+            std::cout << job->inputFile.getFileName() << ": ";
+            if (job->error.isNotEmpty()) {
+                std::cout << "FAILED, " << job->error << "\n";
+                ++numFailed;
+                continue;
+            }
+
+            double samples = double(job->numFrames) * job->numChannels;
+            double audioSeconds = double(job->numFrames) / job->sampleRate;
+            totalSamples += samples;
+            totalProcessSeconds += job->processSeconds;
+
+            std::cout << job->numChannels << " ch, " << job->sampleRate << " Hz, "
+                      << juce::String(audioSeconds, 2) << " s of audio -> "
+                      << job->outputFile.getFileName() << (job->renderedAsInteger ? " (integer)" : (job->renderedMapped ? " (mapped)" : "")) << "\n"
+                      << "    total " << juce::String(job->totalSeconds * 1000.0, 1) << " ms, "
+                      << "processBlock " << juce::String(job->processSeconds * 1000.0, 1) << " ms ("
+                      << formatRate(samples / job->processSeconds) << " samples/s, "
+                      << juce::String(audioSeconds / job->processSeconds, 0) << "x realtime)\n";
+
+            if (settings.compareDir != juce::File()) {
+                if (job->numDifferences == 0) {
+                    std::cout << "    bit-exact with the reference\n";
+                } else {
+                    bool failed = job->maxDifference > settings.tolerance;
+                    std::cout << "    " << (failed ? "DIFFERENT from" : "within tolerance of") << " the reference: "
+                              << job->numDifferences << " samples differ, largest difference "
+                              << job->maxDifference << "\n";
+                    if (failed) { ++numFailed; }
+                }
+            }
+        }
+
+        std::cout << "\n" << settings.pluginName << ", " << jobs.size() << " files on "
+                  << settings.numThreads << " threads, "
+                  << (settings.randomBlockSizes ? "random block sizes" : "block size " + juce::String(settings.blockSize)) << ", "
+                  << "instruction set " << CpuDispatch::getName(CpuDispatch::select()) << "\n"
+                  << "wall time: " << juce::String(wallSeconds, 3) << " s\n"
+                  << "throughput: " << formatRate(totalSamples / wallSeconds) << " samples/s (wall), "
+                  << formatRate(totalSamples / totalProcessSeconds) << " samples/s per thread (processBlock only)\n";
+
+        return numFailed;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // The parameters use timers, which need a message manager, even though
+    // its message loop never runs.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::StringArray args;
+    for (int i = 1; i < argc; ++i) {
+        args.add(juce::CharPointer_UTF8(argv[i]));
+    }
+
+    if (args.size() == 2 && args[0] == "--write-test-signals") {
+        auto dir = juce::File::getCurrentWorkingDirectory().getChildFile(args[1]);
+        dir.createDirectory();
+        if (!TestSignals::writeFiles(dir, { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0,
+                                            192000.0, 352800.0, 384000.0, 705600.0, 768000.0 }, 1.0, 2)) {
+            std::cerr << "Cannot write the test signals to " << dir.getFullPathName() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (args.isEmpty() || args[0].startsWith("-")) {
+        printUsage();
+        return 1;
+    }
+
+    Settings settings;
+    settings.pluginName = args[0];
+
+    // This instance is only used to check the arguments.
+    auto processor = Processors::create(settings.pluginName);
+    if (processor == nullptr) {
+        std::cerr << "Unknown plug-in: " << settings.pluginName << "\n";
+        return 1;
+    }
+
+    juce::Array<juce::File> inputFiles;
+    for (int i = 1; i < args.size(); ++i) {
+        const auto& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+
+        if (arg == "--param" && hasValue) {
+            auto assignment = args[++i];
+            settings.parameters.set(assignment.upToFirstOccurrenceOf("=", false, false),
+                                    assignment.fromFirstOccurrenceOf("=", false, false));
+        } else if (arg == "--threads" && hasValue) {
+            settings.numThreads = std::max(1, args[++i].getIntValue());
+        } else if (arg == "--block-size" && hasValue && args[i + 1] == "random") {
+            settings.randomBlockSizes = true;
+            ++i;
+        } else if (arg == "--block-size" && hasValue) {
+            settings.blockSize = std::max(1, args[++i].getIntValue());
+        } else if (arg == "--output-dir" && hasValue) {
+            settings.outputDir = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i]);
+            settings.outputDir.createDirectory();
+        } else if (arg == "--compare" && hasValue) {
+            settings.compareDir = juce::File::getCurrentWorkingDirectory().getChildFile(args[++i]);
+        } else if (arg == "--tolerance" && hasValue) {
+            settings.tolerance = args[++i].getDoubleValue();
+        } else if (arg == "--integer") {
+            settings.integer = true;
+        } else if (arg == "--mmap") {
+            settings.mmap = true;
+        } else if (arg == "--isa" && hasValue && args[i + 1] == "all") {
+            for (int level = 0; level <= int(CpuDispatch::detect()); ++level) {
+                settings.isaLevels.push_back(CpuDispatch::Level(level));
+            }
+            ++i;
+        } else if (arg == "--isa" && hasValue) {
+            CpuDispatch::Level level;
+            if (!CpuDispatch::parse(args[++i].toRawUTF8(), level)) {
+                std::cerr << "Unknown instruction set: " << args[i] << "\n";
+                return 1;
+            }
+            if (level > CpuDispatch::detect()) {
+                std::cerr << "This CPU doesn't support " << args[i] << "\n";
+                return 1;
+            }
+            settings.isaLevels = { level };
+        } else if (arg.startsWith("-")) {
+            printUsage();
+            return 1;
+        } else {
+            inputFiles.add(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+        }
+    }
+
+    if (settings.integer && dynamic_cast<BitShiftGain::AudioProcessor*>(processor.get()) == nullptr) {
+        std::cerr << "--integer only works with BitShiftGain\n";
+        return 1;
+    }
+
+    // Check the parameter names up front rather than once for every file.
+    for (auto& id : settings.parameters.getAllKeys()) {
+        if (!Processors::setParameter(*processor, id, settings.parameters[id].getFloatValue())) {
+            std::cerr << "Unknown parameter: " << id << "\n";
+            return 1;
+        }
+    }
+
+    int numFailed = 0;
+    if (settings.isaLevels.empty()) {
+        numFailed = renderFiles(settings, inputFiles);
+    }
+    for (auto level : settings.isaLevels) {
+        CpuDispatch::force(level);
+        numFailed += renderFiles(settings, inputFiles);
+    }
+
+    double peakMemory = getPeakMemoryMB();
+    if (peakMemory > 0.0) {
+        std::cout << "peak memory: " << juce::String(peakMemory, 1) << " MB\n";
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
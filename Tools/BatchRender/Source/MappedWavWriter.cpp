@@ -0,0 +1,167 @@
+#include "MappedWavWriter.h"
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace
+{
+    // Like juce::AudioFormatWriter, integer formats are made by turning the
+    // sample into a 32-bit integer first and then keeping its top bits.
+    int toInt32(float sample)
+    {
+        if (sample <= -1.0f) { return std::numeric_limits<int>::min(); }
+        if (sample >= 1.0f) { return std::numeric_limits<int>::max(); }
+        return juce::roundToInt(std::numeric_limits<int>::max() * double(sample));
+    }
+
+    void writeLittleEndian(juce::uint8* dest, juce::uint32 value, int numBytes)
+    {
+        for (int i = 0; i < numBytes; ++i) {
+            dest[i] = juce::uint8(value >> (8 * i));
+        }
+    }
+}
+
+MappedWavWriter::~MappedWavWriter()
+{
+    close();
+}
+
+bool MappedWavWriter::create(const juce::File& fileToCreate, double sampleRate, int channels, int bits,
+                             juce::int64 numFrames)
+{
+    close();
+    if (bits != 8 && bits != 16 && bits != 24 && bits != 32) { return false; }
+
+    file = fileToCreate;
+    numChannels = channels;
+    bitsPerSample = bits;
+    bytesPerFrame = numChannels * bitsPerSample / 8;
+
+    const bool isFloat = bitsPerSample == 32;
+    const juce::int64 dataSize = numFrames * bytesPerFrame;
+    const juce::int64 padding = dataSize & 1;
+
+    // The RIFF sizes are 32 bits. Beyond that, RF64 puts them in a ds64 chunk
+    // and sets the 32-bit sizes to 0xFFFFFFFF.
+    const bool isRF64 = dataSize + padding + 36 > 0xFFFFFFFFLL;
+    const juce::int64 riffSize = dataSize + padding + (isRF64 ? 72 : 36);
+
+    juce::MemoryOutputStream header;
+    header.write(isRF64 ? "RF64" : "RIFF", 4);
+    header.writeInt(isRF64 ? -1 : int(juce::uint32(riffSize)));
+    header.write("WAVE", 4);
+
+    if (isRF64) {
+        header.write("ds64", 4);
+        header.writeInt(28);
+        header.writeInt64(riffSize);
+        header.writeInt64(dataSize);
+        header.writeInt64(numFrames);
+        header.writeInt(0);  // no table
+    }
+
+    header.write("fmt ", 4);
+    header.writeInt(16);
+    header.writeShort(isFloat ? 3 : 1);  // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+    header.writeShort(short(numChannels));
+    header.writeInt(int(sampleRate));
+    header.writeInt(int(sampleRate) * bytesPerFrame);
+    header.writeShort(short(bytesPerFrame));
+    header.writeShort(short(bitsPerSample));
+
+    header.write("data", 4);
+    header.writeInt(isRF64 ? -1 : int(juce::uint32(dataSize)));
+
+    dataStart = juce::int64(header.getDataSize());
+    const juce::int64 fileSize = dataStart + dataSize + padding;
+
+    file.deleteFile();
+    {
+        juce::FileOutputStream stream(file);
+        if (stream.failedToOpen()) { return false; }
+        stream.write(header.getData(), header.getDataSize());
+
+        // Writing the last byte gives the file its full size, without having
+        // to write all the bytes in between.
+        if (fileSize > dataStart) {
+            stream.setPosition(fileSize - 1);
+            stream.writeByte(0);
+        }
+        stream.flush();
+        if (stream.getStatus().failed()) { return false; }
+    }
+
+   #if defined(__linux__)
+    // The file is sparse now. Reserving the disk space up front means that a
+    // full disk shows up here, rather than as a crash (SIGBUS) when writing to
+    // the mapped memory later on.
+    int fd = ::open(file.getFullPathName().toRawUTF8(), O_WRONLY);
+    if (fd < 0) { return false; }
+    int result = posix_fallocate(fd, 0, fileSize);
+    ::close(fd);
+    if (result != 0) { return false; }
+   #endif
+
+    return true;
+}
+
+bool MappedWavWriter::mapFrames(juce::Range<juce::int64> frames)
+{
+    map.reset();
+    mappedData = nullptr;
+    mappedFrames = frames;
+    if (frames.isEmpty()) { return true; }
+
+    juce::Range<juce::int64> bytes(dataStart + frames.getStart() * bytesPerFrame,
+                                   dataStart + frames.getEnd() * bytesPerFrame);
+    map = std::make_unique<juce::MemoryMappedFile>(file, bytes, juce::MemoryMappedFile::readWrite);
+    if (map->getData() == nullptr) {
+        map.reset();
+        return false;
+    }
+
+    // The map starts on a page boundary, which may be before the first frame.
+    mappedData = static_cast<char*>(map->getData()) + (bytes.getStart() - map->getRange().getStart());
+    return true;
+}
+
+void MappedWavWriter::write(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples, juce::int64 frame)
+{
+    if (numSamples <= 0) { return; }
+    jassert(mappedData != nullptr && mappedFrames.contains(juce::Range<juce::int64>(frame, frame + numSamples)));
+
+    const int bytesPerSample = bitsPerSample / 8;
+    auto* firstFrame = reinterpret_cast<juce::uint8*>(mappedData + (frame - mappedFrames.getStart()) * bytesPerFrame);
+
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const float* in = buffer.getReadPointer(channel, startSample);
+        juce::uint8* out = firstFrame + channel * bytesPerSample;
+
+        if (bitsPerSample == 32) {
+            for (int i = 0; i < numSamples; ++i) {
+                juce::uint32 value;
+                std::memcpy(&value, in + i, 4);
+                writeLittleEndian(out + i * bytesPerFrame, value, 4);
+            }
+            continue;
+        }
+
+        // 8-bit WAV files are unsigned, the others are signed.
+        const juce::uint32 offset = bitsPerSample == 8 ? 0x80000000u : 0;
+        const int shift = 32 - bitsPerSample;
+        for (int i = 0; i < numSamples; ++i) {
+            auto value = (juce::uint32(toInt32(in[i])) ^ offset) >> shift;
+            writeLittleEndian(out + i * bytesPerFrame, value, bytesPerSample);
+        }
+    }
+}
+
+void MappedWavWriter::close()
+{
+    map.reset();
+    mappedData = nullptr;
+    mappedFrames = {};
+}
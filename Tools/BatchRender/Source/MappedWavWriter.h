@@ -0,0 +1,48 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+/*
+    Writes a WAV file through a memory map, for BatchRender's --mmap mode.
+
+    The file is created at its full size up front, header and all, so that the
+    samples can go straight into the mapped memory without any buffering. Only
+    one window of the file is mapped at a time, so the memory that this takes
+    doesn't grow with the length of the file.
+
+    The samples are converted the same way as juce::WavAudioFormat's writer
+    converts them, so the output is the same as BatchRender's normal output:
+    8, 16, or 24-bit integer, or 32-bit float. Metadata is not written. When
+    the samples take up more than 4 GB, the file is written as RF64.
+*/
+class MappedWavWriter
+{
+public:
+    ~MappedWavWriter();
+
+    // Creates the file with room for `numFrames` frames. Returns false if it
+    // cannot be created at that size, for example because the disk is full.
+    bool create(const juce::File& file, double sampleRate, int numChannels, int bitsPerSample,
+                juce::int64 numFrames);
+
+    // Maps these frames of the file, and unmaps the ones from before.
+    bool mapFrames(juce::Range<juce::int64> frames);
+
+    // Converts and interleaves the samples from the buffer into the file,
+    // starting at `frame`. These frames must all be in the mapped window.
+    void write(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples, juce::int64 frame);
+
+    // Unmaps the last window. The data is written to disk by the OS.
+    void close();
+
+private:
+    juce::File file;
+    int numChannels = 0;
+    int bitsPerSample = 0;
+    int bytesPerFrame = 0;
+    juce::int64 dataStart = 0;
+
+    std::unique_ptr<juce::MemoryMappedFile> map;
+    juce::Range<juce::int64> mappedFrames;
+    char* mappedData = nullptr;  // where mappedFrames starts
+};
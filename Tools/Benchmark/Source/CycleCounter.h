@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <cstring>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+    #define AIRWINDOWS_HAS_RDTSC 1
+#endif
+
+/*
+    Counts CPU cycles for the calling thread.
+
+    On Linux this uses the hardware cycle counter from perf_event_open(), which
+    counts actual core cycles. Inside containers and VMs that is often not
+    allowed, and then the time stamp counter is used instead. The TSC ticks at
+    a fixed rate that is usually, but not always, close to the base clock of
+    the CPU, so it doesn't see turbo boost or frequency scaling. getSource()
+    says which one is being used, so results can be compared fairly.
+*/
+class CycleCounter
+{
+public:
+    CycleCounter()
+    {
+       #if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+       #endif
+    }
+
+    ~CycleCounter()
+    {
+       #if defined(__linux__)
+        if (fd >= 0) { close(fd); }
+       #endif
+    }
+
+    // "perf" for real core cycles, "tsc" for the time stamp counter, or
+    // "none" if there is no way to count cycles on this machine.
+    const char* getSource() const
+    {
+       #if defined(__linux__)
+        if (fd >= 0) { return "perf"; }
+       #endif
+       #if AIRWINDOWS_HAS_RDTSC
+        return "tsc";
+       #else
+        return "none";
+       #endif
+    }
+
+    bool isAvailable() const
+    {
+        return getSource()[0] != 'n';
+    }
+
+    std::uint64_t read() const
+    {
+       #if defined(__linux__)
+        if (fd >= 0) {
+            std::uint64_t count = 0;
+            if (::read(fd, &count, sizeof(count)) == sizeof(count)) { return count; }
+            return 0;
+        }
+       #endif
+       #if AIRWINDOWS_HAS_RDTSC
+        return __rdtsc();
+       #else
+        return 0;
+       #endif
+    }
+
+private:
+    int fd = -1;
+
+    CycleCounter(const CycleCounter&) = delete;
+    CycleCounter& operator=(const CycleCounter&) = delete;
+};
@@ -0,0 +1,606 @@
+/*
+    Measures how long processBlock takes for each of the plug-ins, for a range
+    of sample rates, block sizes, and input signals. The results are printed as
+    they come in and are also written to a JSON file, so that they can be
+    compared between commits.
+
+    Usage:
+        Benchmark [options]
+
+    Options:
+        --configs <a,b,...>      Only run these configurations (see below).
+        --signals <a,b,...>      Only use these signals: silence, sine, clip, noise.
+        --rates <a,b,...>        Sample rates. Default: 44100 up to 768000.
+        --block-sizes <a,b,...>  Block sizes. Default: powers of two from 1 to 8192.
+        --frames <n>             Frames per measurement. Default: 65536.
+        --repeats <n>            Measurements per case, the fastest one is kept.
+                                 Default: 5.
+        --output <file>          Where to write the JSON. Default: benchmark.json.
+        --label <text>           Stored in the JSON, e.g. the commit hash.
+        --compare <file>         JSON from an earlier run to compare against.
+        --tracks <n>             Measure many instances at once instead, see below.
+        --threads <a,b,...>      Thread counts for --tracks. Default: 1 up to
+                                 the number of cores.
+        --state                  Measure saving and loading the state instead.
+        --isa <level>            Run the kernels with this instruction set:
+                                 generic, sse4, avx2, or avx512. Default: the
+                                 best one that the CPU supports.
+
+    The times are per sample, where a sample is one value in one channel. All
+    measurements are done in stereo.
+
+    With --tracks, the benchmark measures how well the TrackScheduler scales.
+    It creates that many stereo tracks, using the configurations in turn, and
+    times one audio callback for all of them together, for each number of
+    threads. Unless given otherwise, this uses the noise signal at 44.1 kHz
+    with 64-sample blocks.
+
+    With --state, the benchmark measures getStateInformation and
+    setStateInformation for each plug-in, as a host does when it saves or
+    opens a session. It also loads the XML that older versions saved, to
+    show what the compact format gains.
+*/
+
+#include <JuceHeader.h>
+#include "../../Common/Processors.h"
+#include "../../Common/TestSignals.h"
+#include "../../Common/TrackScheduler.h"
+#include "../../../Shared/CpuDispatch.h"
+#include "CycleCounter.h"
+
+namespace
+{
+    // A plug-in plus the parameter settings to benchmark it with.
+    struct Config
+    {
+        juce::String name;
+        juce::String pluginName;
+        juce::StringPairArray parameters;
+    };
+
+    juce::Array<Config> getConfigs()
+    {
+        auto config = [](const juce::String& name, const juce::String& pluginName,
+                         const juce::StringPairArray& parameters = {}) {
+            return Config { name, pluginName, parameters };
+        };
+
+        auto params = [](const juce::String& id, const juce::String& value) {
+            juce::StringPairArray result;
+            result.set(id, value);
+            return result;
+        };
+
+        return {
+            config("ClipOnly", "ClipOnly"),
+            config("ClipOnly2", "ClipOnly2"),
+            config("ClipSoftly", "ClipSoftly"),
+            config("ClipSoftly-FastMath", "ClipSoftly", params("FastMath", "1")),
+            config("ClipOnly2-2x", "ClipOnly2", params("Oversampling", "1")),
+            config("ClipOnly2-8x", "ClipOnly2", params("Oversampling", "3")),
+            config("ClipSoftly-2x", "ClipSoftly", params("Oversampling", "1")),
+            config("ClipSoftly-8x", "ClipSoftly", params("Oversampling", "3")),
+            config("BitShiftGain-0", "BitShiftGain", params("Bits", "0")),
+            config("BitShiftGain-3", "BitShiftGain", params("Bits", "3")),
+            config("ClipChain", "ClipChain"),
+            config("ClipChain-FastMath", "ClipChain", params("FastMath", "1")),
+            config("ClipOnly-Bypass", "ClipOnly", params("Bypass", "1")),
+            config("ClipOnly2-Bypass", "ClipOnly2", params("Bypass", "1")),
+            config("ClipSoftly-Bypass", "ClipSoftly", params("Bypass", "1")),
+            config("ClipChain-Bypass", "ClipChain", params("Bypass", "1")),
+            config("ClipOnly2-Dither", "ClipOnly2", params("Dither", "1")),
+            config("ClipOnly2-TruePeakMeter", "ClipOnly2", params("TruePeak", "1")),
+            config("ClipOnly2-TruePeakLimit", "ClipOnly2", params("TruePeak", "2")),
+        };
+    }
+
+    struct Settings
+    {
+        juce::StringArray configs;
+        juce::StringArray signals = TestSignals::getNames();
+        juce::Array<double> sampleRates = { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0,
+                                            192000.0, 352800.0, 384000.0, 705600.0, 768000.0 };
+        juce::Array<int> blockSizes = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192 };
+        int numFrames = 65536;
+        int numRepeats = 5;
+        juce::File outputFile = juce::File::getCurrentWorkingDirectory().getChildFile("benchmark.json");
+        juce::File compareFile;
+        juce::String label;
+        int numTracks = 0;
+        juce::Array<int> threadCounts;
+        bool state = false;
+    };
+
+    struct Result
+    {
+        double nsPerSample;
+        double cyclesPerSample;
+    };
+
+    Result measure(const Settings& settings, const Config& config, const juce::String& signal,
+                   double sampleRate, int blockSize, const CycleCounter& cycleCounter)
+    {
+        constexpr int numChannels = 2;
+
+        auto processor = Processors::create(config.pluginName);
+        for (auto& id : config.parameters.getAllKeys()) {
+            Processors::setParameter(*processor, id, config.parameters[id].getFloatValue());
+        }
+        Processors::prepare(*processor, numChannels, sampleRate, blockSize);
+
+        // Use a whole number of blocks, and at least one.
+        int numBlocks = std::max(1, settings.numFrames / blockSize);
+        int numFrames = numBlocks * blockSize;
+
+        juce::AudioBuffer<float> input(numChannels, numFrames);
+        TestSignals::generate(signal, input, sampleRate);
+
+        // The blocks are processed in place, so each measurement starts from
+        // a fresh copy of the input.
+        juce::AudioBuffer<float> work(numChannels, numFrames);
+        juce::MidiBuffer midi;
+
+        double bestSeconds = std::numeric_limits<double>::max();
+        double bestCycles = std::numeric_limits<double>::max();
+
+        // The first run is not counted. It warms up the caches and lets the
+        // CPU clock up.
+        for (int repeat = 0; repeat <= settings.numRepeats; ++repeat) {
+            work.makeCopyOf(input, true);
+            processor->reset();
+
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            auto startCycles = cycleCounter.read();
+
+            for (int block = 0; block < numBlocks; ++block) {
+                // This refers to the samples in `work` and does not allocate.
+                juce::AudioBuffer<float> view(work.getArrayOfWritePointers(), numChannels,
+                                              block * blockSize, blockSize);
+                processor->processBlock(view, midi);
+            }
+
+            auto endCycles = cycleCounter.read();
+            auto endTicks = juce::Time::getHighResolutionTicks();
+
+            if (repeat > 0) {
+                bestSeconds = std::min(bestSeconds, juce::Time::highResolutionTicksToSeconds(endTicks - startTicks));
+                bestCycles = std::min(bestCycles, double(endCycles - startCycles));
+            }
+        }
+
+        processor->releaseResources();
+
+        double numSamples = double(numFrames) * numChannels;
+        return { bestSeconds * 1.0e9 / numSamples, bestCycles / numSamples };
+    }
+
+    struct TracksResult
+    {
+        double meanSeconds;     // per callback
+        double worstSeconds;
+        juce::int64 numMissed;
+        double stolenPerCycle;
+    };
+
+    TracksResult measureTracks(const Settings& settings, const juce::Array<Config>& configs,
+                               const juce::String& signal, double sampleRate, int blockSize, int numThreads)
+    {
+        constexpr int numChannels = 2;
+
+        TrackScheduler scheduler(numThreads);
+        for (int track = 0; track < settings.numTracks; ++track) {
+            const auto& config = configs.getReference(track % configs.size());
+            auto processor = Processors::create(config.pluginName);
+            for (auto& id : config.parameters.getAllKeys()) {
+                Processors::setParameter(*processor, id, config.parameters[id].getFloatValue());
+            }
+            scheduler.addTrack(std::move(processor), numChannels);
+        }
+        scheduler.prepare(sampleRate, blockSize);
+
+        int numBlocks = std::max(1, settings.numFrames / blockSize);
+        juce::AudioBuffer<float> input(numChannels, numBlocks * blockSize);
+        TestSignals::generate(signal, input, sampleRate);
+
+        // A callback may take as long as the audio it produces.
+        double deadline = blockSize / sampleRate;
+
+        // As in measure(), the first run is not counted. Here it also gives
+        // the scheduler an idea of how long each track takes.
+        TracksResult best { std::numeric_limits<double>::max(), 0.0, 0, 0.0 };
+        for (int repeat = 0; repeat <= settings.numRepeats; ++repeat) {
+            scheduler.resetStatistics();
+
+            for (int block = 0; block < numBlocks; ++block) {
+                // Every track gets the same input, like a host that is
+                // filling the track buffers from disk.
+                for (int track = 0; track < settings.numTracks; ++track) {
+                    auto& buffer = scheduler.getBuffer(track);
+                    for (int channel = 0; channel < numChannels; ++channel) {
+                        buffer.copyFrom(channel, 0, input, channel, block * blockSize, blockSize);
+                    }
+                }
+                scheduler.process(blockSize, deadline);
+            }
+
+            const auto& statistics = scheduler.getStatistics();
+            double meanSeconds = statistics.totalSeconds / double(statistics.numCycles);
+            if (repeat > 0 && meanSeconds < best.meanSeconds) {
+                best = { meanSeconds, statistics.worstSeconds, statistics.numMissed,
+                         double(statistics.numStolen) / double(statistics.numCycles) };
+            }
+        }
+        return best;
+    }
+
+    // Returns how long one call to `function` takes, in seconds, as the best
+    // of several runs of `numCalls` calls each.
+    template<typename Function>
+    double timePerCall(int numRepeats, int numCalls, Function&& function)
+    {
+        double bestSeconds = std::numeric_limits<double>::max();
+        for (int repeat = 0; repeat <= numRepeats; ++repeat) {
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            for (int call = 0; call < numCalls; ++call) {
+                function();
+            }
+            auto endTicks = juce::Time::getHighResolutionTicks();
+
+            if (repeat > 0) {
+                bestSeconds = std::min(bestSeconds, juce::Time::highResolutionTicksToSeconds(endTicks - startTicks));
+            }
+        }
+        return bestSeconds / numCalls;
+    }
+
+    /*
+        The state as older versions of the plug-ins saved it: the parameters
+        as XML, in the same form that AudioProcessorValueTreeState uses.
+        Those versions also copied the whole ValueTree first, so saving this
+        way is a bit faster than it used to be.
+    */
+    void getXmlState(juce::AudioProcessor& processor, juce::MemoryBlock& destData)
+    {
+        juce::XmlElement xml("Parameters");
+        for (auto* parameter : processor.getParameters()) {
+            auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+            auto* child = xml.createNewChildElement("PARAM");
+            child->setAttribute("id", ranged->getParameterID());
+            child->setAttribute("value", ranged->convertFrom0to1(ranged->getValue()));
+        }
+        juce::AudioProcessor::copyXmlToBinary(xml, destData);
+    }
+
+    juce::Array<juce::var> runState(const Settings& settings)
+    {
+        // Like opening a session with this many instances of each plug-in.
+        constexpr int numCalls = 1000;
+
+        juce::Array<juce::var> results;
+        std::cout << "plug-in        bytes   save us   load us    xml bytes   xml save us   xml load us\n";
+
+        for (auto& name : Processors::getNames()) {
+            auto processor = Processors::create(name);
+            Processors::prepare(*processor, 2, 44100.0, 512);
+
+            juce::MemoryBlock compact, xml;
+            processor->getStateInformation(compact);
+            getXmlState(*processor, xml);
+
+            double save = timePerCall(settings.numRepeats, numCalls, [&] {
+                juce::MemoryBlock state;
+                processor->getStateInformation(state);
+            });
+            double load = timePerCall(settings.numRepeats, numCalls, [&] {
+                processor->setStateInformation(compact.getData(), int(compact.getSize()));
+            });
+            double xmlSave = timePerCall(settings.numRepeats, numCalls, [&] {
+                juce::MemoryBlock state;
+                getXmlState(*processor, state);
+            });
+            double xmlLoad = timePerCall(settings.numRepeats, numCalls, [&] {
+                processor->setStateInformation(xml.getData(), int(xml.getSize()));
+            });
+
+            auto* object = new juce::DynamicObject();
+            object->setProperty("config", name + " state");
+            object->setProperty("plugin", name);
+            object->setProperty("bytes", int(compact.getSize()));
+            object->setProperty("saveMicroseconds", save * 1.0e6);
+            object->setProperty("loadMicroseconds", load * 1.0e6);
+            object->setProperty("xmlBytes", int(xml.getSize()));
+            object->setProperty("xmlSaveMicroseconds", xmlSave * 1.0e6);
+            object->setProperty("xmlLoadMicroseconds", xmlLoad * 1.0e6);
+            results.add(juce::var(object));
+
+            std::cout << name.paddedRight(' ', 13)
+                      << juce::String(int(compact.getSize())).paddedLeft(' ', 7)
+                      << juce::String(save * 1.0e6, 2).paddedLeft(' ', 10)
+                      << juce::String(load * 1.0e6, 2).paddedLeft(' ', 10)
+                      << juce::String(int(xml.getSize())).paddedLeft(' ', 13)
+                      << juce::String(xmlSave * 1.0e6, 2).paddedLeft(' ', 14)
+                      << juce::String(xmlLoad * 1.0e6, 2).paddedLeft(' ', 14) << std::endl;
+        }
+        return results;
+    }
+
+    juce::String makeKey(const juce::var& result)
+    {
+        return result["config"].toString() + "/" + result["signal"].toString() + "/"
+             + juce::String(int(result["sampleRate"])) + "/" + juce::String(int(result["blockSize"]));
+    }
+
+    // Reads the results from an earlier run, indexed by makeKey().
+    std::map<juce::String, double> loadResults(const juce::File& file)
+    {
+        std::map<juce::String, double> results;
+        auto json = juce::JSON::parse(file);
+        if (auto* array = json["results"].getArray()) {
+            for (auto& result : *array) {
+                results[makeKey(result)] = double(result["nsPerSample"]);
+            }
+        }
+        return results;
+    }
+
+    template<typename T>
+    juce::Array<T> parseList(const juce::String& text)
+    {
+        juce::Array<T> values;
+        for (auto& item : juce::StringArray::fromTokens(text, ",", "")) {
+            if constexpr (std::is_same_v<T, int>) {
+                values.add(item.getIntValue());
+            } else {
+                values.add(item.getDoubleValue());
+            }
+        }
+        return values;
+    }
+
+    // The configurations that were asked for, or all of them.
+    juce::Array<Config> getSelectedConfigs(const Settings& settings)
+    {
+        juce::Array<Config> configs;
+        for (auto& config : getConfigs()) {
+            if (settings.configs.isEmpty() || settings.configs.contains(config.name, true)) {
+                configs.add(config);
+            }
+        }
+        return configs;
+    }
+
+    juce::Array<juce::var> runTracks(const Settings& settings, const std::map<juce::String, double>& previous)
+    {
+        juce::Array<juce::var> results;
+        auto configs = getSelectedConfigs(settings);
+        if (configs.isEmpty()) { return results; }
+
+        juce::StringArray names;
+        for (auto& config : configs) {
+            names.add(config.name);
+        }
+        std::cout << settings.numTracks << " stereo tracks of " << names.joinIntoString(", ") << "\n\n";
+        std::cout << "threads  signal   rate     block   callback us   worst us   budget  missed  stolen  speedup\n";
+
+        for (auto& signal : settings.signals) {
+            for (double sampleRate : settings.sampleRates) {
+                for (int blockSize : settings.blockSizes) {
+                    if (blockSize < 1) { continue; }
+
+                    double firstSeconds = 0.0;
+                    for (int numThreads : settings.threadCounts) {
+                        if (numThreads < 1) { continue; }
+
+                        auto result = measureTracks(settings, configs, signal, sampleRate, blockSize, numThreads);
+                        if (firstSeconds == 0.0) { firstSeconds = result.meanSeconds; }
+
+                        double numSamples = double(settings.numTracks) * blockSize * 2.0;
+                        double nsPerSample = result.meanSeconds * 1.0e9 / numSamples;
+                        double budget = result.meanSeconds * sampleRate / blockSize;
+
+                        auto* object = new juce::DynamicObject();
+                        object->setProperty("config", juce::String(settings.numTracks) + " tracks, "
+                                                      + juce::String(numThreads) + " threads");
+                        object->setProperty("tracks", settings.numTracks);
+                        object->setProperty("threads", numThreads);
+                        object->setProperty("signal", signal);
+                        object->setProperty("sampleRate", sampleRate);
+                        object->setProperty("blockSize", blockSize);
+                        object->setProperty("nsPerSample", nsPerSample);
+                        object->setProperty("callbackMicroseconds", result.meanSeconds * 1.0e6);
+                        object->setProperty("worstMicroseconds", result.worstSeconds * 1.0e6);
+                        object->setProperty("missedDeadlines", result.numMissed);
+                        object->setProperty("stolenPerCallback", result.stolenPerCycle);
+                        juce::var entry(object);
+                        results.add(entry);
+
+                        std::cout << juce::String(numThreads).paddedRight(' ', 9) << signal.paddedRight(' ', 9)
+                                  << juce::String(int(sampleRate)).paddedRight(' ', 9)
+                                  << juce::String(blockSize).paddedRight(' ', 8)
+                                  << juce::String(result.meanSeconds * 1.0e6, 1).paddedLeft(' ', 11)
+                                  << juce::String(result.worstSeconds * 1.0e6, 1).paddedLeft(' ', 11)
+                                  << (juce::String(budget * 100.0, 0) + "%").paddedLeft(' ', 9)
+                                  << juce::String(result.numMissed).paddedLeft(' ', 8)
+                                  << juce::String(result.stolenPerCycle, 1).paddedLeft(' ', 8)
+                                  << (juce::String(firstSeconds / result.meanSeconds, 2) + "x").paddedLeft(' ', 9);
+
+                        auto found = previous.find(makeKey(entry));
+                        if (found != previous.end() && found->second > 0.0) {
+                            double change = nsPerSample / found->second - 1.0;
+                            std::cout << "   " << (change >= 0.0 ? "+" : "") << juce::String(change * 100.0, 1) << "%";
+                        }
+                        std::cout << std::endl;
+                    }
+                }
+            }
+        }
+        return results;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: Benchmark [options]\n\n"
+                  << "Options:\n"
+                  << "  --configs <a,b,...>      configurations to run (default: all)\n"
+                  << "  --signals <a,b,...>      silence, sine, clip, noise (default: all)\n"
+                  << "  --rates <a,b,...>        sample rates (default: 44100 to 768000)\n"
+                  << "  --block-sizes <a,b,...>  block sizes (default: 1, 2, 4, ..., 8192)\n"
+                  << "  --frames <n>             frames per measurement (default: 65536)\n"
+                  << "  --repeats <n>            measurements per case (default: 5)\n"
+                  << "  --output <file>          JSON output file (default: benchmark.json)\n"
+                  << "  --label <text>           label to store in the JSON\n"
+                  << "  --compare <file>         JSON from an earlier run to compare against\n"
+                  << "  --tracks <n>             measure n tracks on a pool of threads\n"
+                  << "  --threads <a,b,...>      thread counts for --tracks (default: 1 to the number of cores)\n"
+                  << "  --state                  measure saving and loading the plug-in state\n"
+                  << "  --isa <level>            instruction set: generic, sse4, avx2, avx512 (default: best)\n\n"
+                  << "Configurations:";
+        for (auto& config : getConfigs()) {
+            std::cout << " " << config.name;
+        }
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // The parameters use timers, which need a message manager, even though
+    // its message loop never runs.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    Settings settings;
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    bool hasSignals = false, hasRates = false, hasBlockSizes = false;
+
+    for (int i = 1; i < argc; ++i) {
+        juce::String arg(juce::CharPointer_UTF8(argv[i]));
+        juce::String value = i + 1 < argc ? juce::String(juce::CharPointer_UTF8(argv[i + 1])) : juce::String();
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--state") {
+            settings.state = true;
+            continue;
+        } else if (arg == "--configs" && hasValue) {
+            settings.configs = juce::StringArray::fromTokens(value, ",", "");
+        } else if (arg == "--signals" && hasValue) {
+            settings.signals = juce::StringArray::fromTokens(value, ",", "");
+            hasSignals = true;
+        } else if (arg == "--rates" && hasValue) {
+            settings.sampleRates = parseList<double>(value);
+            hasRates = true;
+        } else if (arg == "--block-sizes" && hasValue) {
+            settings.blockSizes = parseList<int>(value);
+            hasBlockSizes = true;
+        } else if (arg == "--frames" && hasValue) {
+            settings.numFrames = std::max(1, value.getIntValue());
+        } else if (arg == "--repeats" && hasValue) {
+            settings.numRepeats = std::max(1, value.getIntValue());
+        } else if (arg == "--output" && hasValue) {
+            settings.outputFile = cwd.getChildFile(value);
+        } else if (arg == "--label" && hasValue) {
+            settings.label = value;
+        } else if (arg == "--compare" && hasValue) {
+            settings.compareFile = cwd.getChildFile(value);
+        } else if (arg == "--tracks" && hasValue) {
+            settings.numTracks = std::max(1, value.getIntValue());
+        } else if (arg == "--threads" && hasValue) {
+            settings.threadCounts = parseList<int>(value);
+        } else if (arg == "--isa" && hasValue) {
+            CpuDispatch::Level level;
+            if (!CpuDispatch::parse(value.toRawUTF8(), level) || level > CpuDispatch::detect()) {
+                std::cerr << "This CPU doesn't support the instruction set " << value << "\n";
+                return 1;
+            }
+            CpuDispatch::force(level);
+        } else {
+            printUsage();
+            return 1;
+        }
+        ++i;
+    }
+
+    std::map<juce::String, double> previous;
+    if (settings.compareFile != juce::File()) {
+        previous = loadResults(settings.compareFile);
+    }
+
+    CycleCounter cycleCounter;
+
+    juce::Array<juce::var> results;
+
+    if (settings.state) {
+        results = runState(settings);
+    } else if (settings.numTracks > 0) {
+        if (!hasSignals) { settings.signals = { "noise" }; }
+        if (!hasRates) { settings.sampleRates = { 44100.0 }; }
+        if (!hasBlockSizes) { settings.blockSizes = { 64 }; }
+        if (settings.threadCounts.isEmpty()) {
+            for (int n = 1; n <= juce::SystemStats::getNumCpus(); ++n) {
+                settings.threadCounts.add(n);
+            }
+        }
+        results = runTracks(settings, previous);
+    } else {
+        std::cout << "config               signal   rate     block   ns/sample  cycles/sample\n";
+
+        for (auto& config : getConfigs()) {
+            if (!settings.configs.isEmpty() && !settings.configs.contains(config.name, true)) { continue; }
+
+            for (auto& signal : settings.signals) {
+                for (double sampleRate : settings.sampleRates) {
+                    for (int blockSize : settings.blockSizes) {
+                        if (blockSize < 1) { continue; }
+
+                        auto result = measure(settings, config, signal, sampleRate, blockSize, cycleCounter);
+
+                        auto* object = new juce::DynamicObject();
+                        object->setProperty("config", config.name);
+                        object->setProperty("plugin", config.pluginName);
+                        object->setProperty("signal", signal);
+                        object->setProperty("sampleRate", sampleRate);
+                        object->setProperty("blockSize", blockSize);
+                        object->setProperty("nsPerSample", result.nsPerSample);
+                        if (cycleCounter.isAvailable()) {
+                            object->setProperty("cyclesPerSample", result.cyclesPerSample);
+                        }
+                        juce::var entry(object);
+                        results.add(entry);
+
+                        std::cout << config.name.paddedRight(' ', 21) << signal.paddedRight(' ', 9)
+                                  << juce::String(int(sampleRate)).paddedRight(' ', 9)
+                                  << juce::String(blockSize).paddedRight(' ', 8)
+                                  << juce::String(result.nsPerSample, 3).paddedLeft(' ', 9)
+                                  << juce::String(result.cyclesPerSample, 2).paddedLeft(' ', 15);
+
+                        auto found = previous.find(makeKey(entry));
+                        if (found != previous.end() && found->second > 0.0) {
+                            double change = result.nsPerSample / found->second - 1.0;
+                            std::cout << "   " << (change >= 0.0 ? "+" : "") << juce::String(change * 100.0, 1) << "%";
+                        }
+                        std::cout << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    auto* root = new juce::DynamicObject();
+    root->setProperty("label", settings.label);
+    root->setProperty("date", juce::Time::getCurrentTime().toISO8601(true));
+    root->setProperty("cpu", juce::SystemStats::getCpuModel());
+    root->setProperty("cycleSource", juce::String(cycleCounter.getSource()));
+    root->setProperty("isa", juce::String(CpuDispatch::getName(CpuDispatch::select())));
+    root->setProperty("framesPerMeasurement", settings.numFrames);
+    root->setProperty("repeats", settings.numRepeats);
+    root->setProperty("results", results);
+
+    if (!settings.outputFile.replaceWithText(juce::JSON::toString(juce::var(root)))) {
+        std::cerr << "Cannot write " << settings.outputFile.getFullPathName() << "\n";
+        return 1;
+    }
+
+    std::cout << "\nCycles counted with: " << cycleCounter.getSource() << "\n"
+              << "Instruction set: " << CpuDispatch::getName(CpuDispatch::select()) << "\n"
+              << "Results written to " << settings.outputFile.getFullPathName() << "\n";
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "Processors.h"
+#include "../../ClipOnly/Source/PluginProcessor.h"
+#include "../../ClipOnly2/Source/PluginProcessor.h"
+#include "../../ClipSoftly/Source/PluginProcessor.h"
+#include "../../BitShiftGain/Source/PluginProcessor.h"
+#include "../../ClipChain/Source/PluginProcessor.h"
+
+namespace Processors
+{
+    juce::StringArray getNames()
+    {
+        return { "ClipOnly", "ClipOnly2", "ClipSoftly", "BitShiftGain", "ClipChain" };
+    }
+
+    std::unique_ptr<juce::AudioProcessor> create(const juce::String& name)
+    {
+        if (name.equalsIgnoreCase("ClipOnly")) { return std::make_unique<ClipOnly::AudioProcessor>(); }
+        if (name.equalsIgnoreCase("ClipOnly2")) { return std::make_unique<ClipOnly2::AudioProcessor>(); }
+        if (name.equalsIgnoreCase("ClipSoftly")) { return std::make_unique<ClipSoftly::AudioProcessor>(); }
+        if (name.equalsIgnoreCase("BitShiftGain")) { return std::make_unique<BitShiftGain::AudioProcessor>(); }
+        if (name.equalsIgnoreCase("ClipChain")) { return std::make_unique<ClipChain::AudioProcessor>(); }
+        return nullptr;
+    }
+
+    bool setParameter(juce::AudioProcessor& processor, const juce::String& parameterID, float value)
+    {
+        for (auto* parameter : processor.getParameters()) {
+            auto* withID = dynamic_cast<juce::RangedAudioParameter*>(parameter);
+            if (withID != nullptr && withID->getParameterID() == parameterID) {
+                withID->setValueNotifyingHost(withID->convertTo0to1(value));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool prepare(juce::AudioProcessor& processor, int numChannels, double sampleRate, int maxBlockSize)
+    {
+        juce::AudioProcessor::BusesLayout layout;
+        layout.inputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+        layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(numChannels));
+        if (!processor.setBusesLayout(layout)) { return false; }
+
+        processor.setRateAndBufferSizeDetails(sampleRate, maxBlockSize);
+        processor.prepareToPlay(sampleRate, maxBlockSize);
+        return true;
+    }
+}
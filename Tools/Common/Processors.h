@@ -0,0 +1,28 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+/*
+    Creates the plug-ins by name, for the command-line tools. These don't load
+    the plug-ins as VST3 or AU but compile the processor classes directly into
+    the executable.
+*/
+namespace Processors
+{
+    // The names that create() accepts: "ClipOnly", "ClipOnly2", and so on.
+    juce::StringArray getNames();
+
+    // Returns nullptr if there is no plug-in with this name. The name is not
+    // case-sensitive.
+    std::unique_ptr<juce::AudioProcessor> create(const juce::String& name);
+
+    // Sets a parameter by its ID to a value in the parameter's own units,
+    // e.g. decibels, rather than the normalized 0 - 1 range. Returns false
+    // if the plug-in has no parameter with this ID.
+    bool setParameter(juce::AudioProcessor& processor, const juce::String& parameterID, float value);
+
+    // Gives the processor a main bus with `numChannels` on both the input and
+    // output and calls prepareToPlay(). Returns false if this layout is not
+    // supported.
+    bool prepare(juce::AudioProcessor& processor, int numChannels, double sampleRate, int maxBlockSize);
+}
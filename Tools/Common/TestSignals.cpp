@@ -0,0 +1,61 @@
+#include "TestSignals.h"
+
+namespace TestSignals
+{
+    juce::StringArray getNames()
+    {
+        return { "silence", "sine", "clip", "noise" };
+    }
+
+    void generate(const juce::String& name, juce::AudioBuffer<float>& buffer, double sampleRate)
+    {
+        juce::Random random(12345);
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+            float* data = buffer.getWritePointer(channel);
+
+            // Slightly different phases, so the channels are not identical.
+            double phase = channel * 0.25;
+            double increment = juce::MathConstants<double>::twoPi * 1000.0 / sampleRate;
+
+            for (int i = 0; i < buffer.getNumSamples(); ++i) {
+                float x = 0.0f;
+                if (name == "sine") {
+                    x = float(0.5 * std::sin(phase + i * increment));
+                } else if (name == "clip") {
+                    x = float(4.0 * std::sin(phase + i * increment));
+                } else if (name == "noise") {
+                    x = (random.nextFloat() * 2.0f - 1.0f) * 15.848932f;
+                }
+                data[i] = x;
+            }
+        }
+    }
+
+    bool writeFiles(const juce::File& dir, const juce::Array<double>& sampleRates,
+                    double lengthInSeconds, int numChannels)
+    {
+        juce::WavAudioFormat wavFormat;
+
+        for (auto& name : getNames()) {
+            for (double sampleRate : sampleRates) {
+                juce::AudioBuffer<float> buffer(numChannels, int(sampleRate * lengthInSeconds));
+                generate(name, buffer, sampleRate);
+
+                auto file = dir.getChildFile(name + "-" + juce::String(int(sampleRate)) + ".wav");
+                file.deleteFile();
+
+                auto stream = file.createOutputStream();
+                if (stream == nullptr) { return false; }
+
+                std::unique_ptr<juce::AudioFormatWriter> writer(
+                    wavFormat.createWriterFor(stream.get(), sampleRate, unsigned(numChannels), 32, {}, 0));
+                if (writer == nullptr) { return false; }
+                stream.release();  // now owned by the writer
+
+                if (!writer->writeFromAudioSampleBuffer(buffer, 0, buffer.getNumSamples())) { return false; }
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+/*
+    Synthetic test signals, shared by the benchmark and the batch renderer.
+    They are the same every time, so they can be used to compare the output
+    of different versions of the plug-ins.
+
+    - silence: all zeros
+    - sine: 1 kHz at -6 dBFS, which never reaches the clip threshold
+    - clip: 1 kHz at +12 dBFS, so the clippers are busy most of the time
+    - noise: white noise at +24 dBFS, the worst case for the clippers
+
+    The gain is part of the signal rather than set with the Input parameter,
+    so that every plug-in gets the same input.
+*/
+namespace TestSignals
+{
+    juce::StringArray getNames();
+
+    // Fills the buffer with the named signal. The channels are slightly
+    // different from each other.
+    void generate(const juce::String& name, juce::AudioBuffer<float>& buffer, double sampleRate);
+
+    // Writes every signal at every sample rate as a 32-bit float WAV file, so
+    // that nothing gets clipped or rounded. The files are named e.g.
+    // `noise-96000.wav`. Returns false if a file could not be written.
+    bool writeFiles(const juce::File& dir, const juce::Array<double>& sampleRates,
+                    double lengthInSeconds, int numChannels);
+}
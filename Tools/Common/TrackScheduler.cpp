@@ -0,0 +1,177 @@
+#include "TrackScheduler.h"
+#include "Processors.h"
+
+namespace
+{
+    // How long a worker keeps checking for a new cycle before it goes to
+    // sleep. This is longer than the time between callbacks at any normal
+    // block size, so the workers only sleep when the audio has stopped.
+    constexpr double spinSeconds = 0.005;
+
+    double secondsSince(juce::int64 startTicks)
+    {
+        return juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+    }
+}
+
+TrackScheduler::TrackScheduler(int numThreadsToUse) :
+    numThreads(std::max(1, numThreadsToUse)),
+    queues(new Queue[size_t(numThreads)])
+{
+    // Worker 0 is the thread that calls process().
+    for (int worker = 1; worker < numThreads; ++worker) {
+        threads.emplace_back([this, worker] { workerLoop(worker); });
+    }
+}
+
+TrackScheduler::~TrackScheduler()
+{
+    quit.store(true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeUp.notify_all();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int TrackScheduler::addTrack(std::unique_ptr<juce::AudioProcessor> processor, int numChannels)
+{
+    tracks.emplace_back();
+    tracks.back().processor = std::move(processor);
+    tracks.back().numChannels = numChannels;
+    return int(tracks.size()) - 1;
+}
+
+bool TrackScheduler::prepare(double sampleRate, int maxBlockSize)
+{
+    order.clear();
+    for (auto& track : tracks) {
+        if (!Processors::prepare(*track.processor, track.numChannels, sampleRate, maxBlockSize)) { return false; }
+
+        constexpr int floatsPerLine = int(cacheLineSize / sizeof(float));
+        int stride = (maxBlockSize + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+        track.samples.assign(size_t(track.numChannels) * size_t(stride), 0.0f);
+        std::vector<float*> channels;
+        for (int channel = 0; channel < track.numChannels; ++channel) {
+            channels.push_back(track.samples.data() + size_t(channel) * size_t(stride));
+        }
+        track.buffer.setDataToReferTo(channels.data(), track.numChannels, maxBlockSize);
+        track.cost = 0.0;
+        order.push_back(int(order.size()));
+    }
+    return true;
+}
+
+bool TrackScheduler::process(int numSamples, double deadlineSeconds)
+{
+    auto startTicks = juce::Time::getHighResolutionTicks();
+
+    // Slowest tracks first. Ties are broken by the index, so that the order
+    // doesn't change from one cycle to the next without a reason.
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        double costA = tracks[size_t(a)].cost;
+        double costB = tracks[size_t(b)].cost;
+        return costA > costB || (costA == costB && a < b);
+    });
+
+    // A worker that is late for the previous cycle may already claim a track
+    // as soon as its queue is reset, so everything else must be ready first.
+    cycleSamples = numSamples;
+    numStolen.store(0, std::memory_order_relaxed);
+    remaining.store(int(order.size()), std::memory_order_relaxed);
+    for (int queue = 0; queue < numThreads; ++queue) {
+        queues[size_t(queue)].next.store(0, std::memory_order_release);
+    }
+
+    generation.fetch_add(1);
+    if (numSleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeUp.notify_all();
+    }
+
+    runCycle(0);
+
+    // Wait for the tracks that other workers are still busy with.
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+
+    double seconds = secondsSince(startTicks);
+    bool inTime = seconds <= deadlineSeconds;
+
+    statistics.numCycles += 1;
+    statistics.numMissed += inTime ? 0 : 1;
+    statistics.numStolen += numStolen.load(std::memory_order_relaxed);
+    statistics.totalSeconds += seconds;
+    statistics.worstSeconds = std::max(statistics.worstSeconds, seconds);
+    return inTime;
+}
+
+void TrackScheduler::workerLoop(int worker)
+{
+    juce::uint32 seen = generation.load();
+    auto idleTicks = juce::Time::getHighResolutionTicks();
+
+    while (!quit.load()) {
+        juce::uint32 current = generation.load(std::memory_order_acquire);
+        if (current != seen) {
+            seen = current;
+            runCycle(worker);
+            idleTicks = juce::Time::getHighResolutionTicks();
+        } else if (secondsSince(idleTicks) < spinSeconds) {
+            std::this_thread::yield();
+        } else {
+            std::unique_lock<std::mutex> lock(mutex);
+            numSleeping.fetch_add(1);
+            wakeUp.wait(lock, [&] { return quit.load() || generation.load() != seen; });
+            numSleeping.fetch_sub(1);
+            idleTicks = juce::Time::getHighResolutionTicks();
+        }
+    }
+}
+
+void TrackScheduler::runCycle(int worker)
+{
+    int track;
+    while (claim(worker, track)) {
+        processTrack(track, false);
+    }
+
+    // Nothing left in this worker's own queue, so help the others, starting
+    // with the next worker so that the thieves spread out.
+    for (int i = 1; i < numThreads; ++i) {
+        int victim = (worker + i) % numThreads;
+        while (claim(victim, track)) {
+            processTrack(track, true);
+        }
+    }
+}
+
+bool TrackScheduler::claim(int queue, int& track)
+{
+    int claimed = queues[size_t(queue)].next.fetch_add(1, std::memory_order_acq_rel);
+    size_t index = size_t(queue) + size_t(claimed) * size_t(numThreads);
+    if (index >= order.size()) { return false; }
+    track = order[index];
+    return true;
+}
+
+void TrackScheduler::processTrack(int index, bool stolen)
+{
+    auto& track = tracks[size_t(index)];
+    auto startTicks = juce::Time::getHighResolutionTicks();
+
+    // This refers to the samples in the track's buffer and does not allocate.
+    juce::AudioBuffer<float> view(track.buffer.getArrayOfWritePointers(), track.numChannels, 0, cycleSamples);
+    track.processor->processBlock(view, track.midi);
+
+    // Averaged over a few cycles, so that one slow call doesn't move the
+    // track to the front for good.
+    double seconds = secondsSince(startTicks);
+    track.cost = track.cost == 0.0 ? seconds : track.cost + 0.25 * (seconds - track.cost);
+
+    if (stolen) { numStolen.fetch_add(1, std::memory_order_relaxed); }
+    remaining.fetch_sub(1, std::memory_order_release);
+}
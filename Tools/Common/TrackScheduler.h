@@ -0,0 +1,151 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "../../Shared/CacheAligned.h"
+
+/*
+    Runs many plug-in instances, one per track, on a fixed pool of threads.
+
+    A render server that gives every track its own processor would otherwise
+    call processBlock on them one after the other, on one core. Here, every
+    call to process() hands the tracks out to the workers, and returns when
+    all of them have been processed. The thread that calls process() is one
+    of the workers, so a scheduler with one thread runs everything on the
+    calling thread, without any synchronization.
+
+    At the start of each cycle, the tracks are sorted by how long they took
+    recently, the slowest first, and dealt out to the workers like cards.
+    Starting the slow tracks first means that the last tracks to finish are
+    short ones, which makes it more likely that the cycle ends before its
+    deadline. A worker that runs out of tracks takes the next one from
+    another worker's queue, so a worker that got unlucky, or that the OS
+    didn't schedule in time, doesn't hold up the others.
+
+    Each queue is a single counter in its own cache line, and a track is
+    claimed with one atomic increment, so stealing doesn't need a lock. The
+    per-track state that the workers write to is also kept in separate cache
+    lines, so that workers on different cores don't invalidate each other's
+    caches. That goes for the scheduler's bookkeeping, such as the time a
+    track took, and for the track's audio buffer, which is allocated here.
+    The processors take care of their own state: they and the kernels,
+    ramps, and delay lines in them are allocated in whole cache lines, see
+    Shared/CacheAligned.h. A processor that doesn't do that can still share
+    cache lines with the one that was allocated next to it.
+
+    process() does not allocate. Add the tracks and call prepare() before the
+    first call to process().
+*/
+class TrackScheduler
+{
+public:
+    // The size of a cache line on current x86 and ARM processors.
+    static constexpr size_t cacheLineSize = CacheAligned::lineSize;
+
+    // The number of threads includes the thread that calls process().
+    explicit TrackScheduler(int numThreads);
+    ~TrackScheduler();
+
+    // Adds a track that will be processed with `numChannels` channels. Don't
+    // call this after prepare(). Returns the index of the track.
+    int addTrack(std::unique_ptr<juce::AudioProcessor> processor, int numChannels);
+
+    // Prepares all processors and allocates their buffers.
+    bool prepare(double sampleRate, int maxBlockSize);
+
+    int getNumTracks() const { return int(tracks.size()); }
+    int getNumThreads() const { return numThreads; }
+    juce::AudioProcessor& getProcessor(int track) { return *tracks[size_t(track)].processor; }
+
+    // The audio for a track. Fill it before process(), and read the result
+    // from it afterwards. Only the first `numSamples` are processed.
+    juce::AudioBuffer<float>& getBuffer(int track) { return tracks[size_t(track)].buffer; }
+
+    /*
+        Processes `numSamples` samples on every track, in place, and waits
+        until all tracks are done. The deadline is the time the cycle may
+        take, usually numSamples / sampleRate or a bit less. Returns false if
+        the cycle took longer.
+
+        There's no way to skip a track, so a late cycle still processes every
+        track; the deadline only decides what counts as a miss.
+    */
+    bool process(int numSamples, double deadlineSeconds);
+
+    struct Statistics
+    {
+        juce::int64 numCycles = 0;
+        juce::int64 numMissed = 0;    // cycles that took longer than the deadline
+        juce::int64 numStolen = 0;    // tracks that were processed by another worker
+        double totalSeconds = 0.0;
+        double worstSeconds = 0.0;
+    };
+
+    const Statistics& getStatistics() const { return statistics; }
+    void resetStatistics() { statistics = {}; }
+
+private:
+    // The aligned struct takes up whole cache lines, so no two tracks share
+    // one, even when they sit next to each other in the vector.
+    struct alignas(cacheLineSize) Track
+    {
+        std::unique_ptr<juce::AudioProcessor> processor;
+
+        // Refers to `samples`, which holds the channels one after the other,
+        // each in whole cache lines.
+        juce::AudioBuffer<float> buffer;
+        CacheAligned::Vector<float> samples;
+
+        juce::MidiBuffer midi;
+        int numChannels = 0;
+
+        // A running average of how long processBlock took, in seconds.
+        double cost = 0.0;
+    };
+
+    // The tracks that a worker still has to do are order[worker], then
+    // order[worker + numThreads], and so on. `next` counts how many of those
+    // have been claimed, by the worker itself or by others.
+    struct alignas(cacheLineSize) Queue
+    {
+        std::atomic<int> next { 0 };
+    };
+
+    void workerLoop(int worker);
+    void runCycle(int worker);
+    bool claim(int queue, int& track);
+    void processTrack(int track, bool stolen);
+
+    const int numThreads;
+    std::vector<Track> tracks;
+    std::vector<int> order;
+    std::unique_ptr<Queue[]> queues;
+    std::vector<std::thread> threads;
+
+    int cycleSamples = 0;
+
+    // Incremented by process() to start a cycle. The workers watch it.
+    alignas(cacheLineSize) std::atomic<juce::uint32> generation { 0 };
+
+    // The number of tracks that haven't finished yet in this cycle.
+    alignas(cacheLineSize) std::atomic<int> remaining { 0 };
+
+    // The number of tracks in this cycle that were processed by a worker
+    // other than the one they were dealt to.
+    alignas(cacheLineSize) std::atomic<int> numStolen { 0 };
+
+    // Between cycles the workers spin for a little while, then go to sleep
+    // until the next cycle. process() only takes the lock to wake them when
+    // one of them is actually asleep, which only happens after a pause.
+    std::atomic<int> numSleeping { 0 };
+    std::atomic<bool> quit { false };
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+
+    Statistics statistics;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TrackScheduler)
+};
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Renders the files in `input` with the plug-ins as they are now, and checks
+# the output against `baseline`, which is what the original plug-ins made of
+# the same files. Every render must be bit-exact with the baseline, except the
+# ones in expected-differences.txt, which must differ by exactly the amount
+# given there. Each plug-in is rendered with 512-sample blocks and with random
+# block sizes, and with every instruction set that the CPU supports.
+#
+# Usage:
+#     check.sh <path to BatchRender>
+#
+# Exits with an error code if any render is not as expected.
+
+batchRender=${1:?"usage: check.sh <path to BatchRender>"}
+here=$(cd "$(dirname "$0")" && pwd)
+output=$(mktemp -d)
+trap 'rm -rf "$output"' EXIT
+
+numInputs=$(ls "$here"/input/*.wav | wc -l)
+numFailed=0
+
+for plugin in ClipOnly ClipOnly2 ClipSoftly BitShiftGain; do
+    # BitShiftGain does nothing at all at its default setting.
+    params=""
+    if [ "$plugin" = BitShiftGain ]; then params="--param Bits=-3"; fi
+
+    for blockSize in 512 random; do
+        echo "$plugin, block size $blockSize"
+
+        # BatchRender exits with an error code when a file differs, which is
+        # expected for some of them, so only its report counts.
+        "$batchRender" "$plugin" $params --block-size "$blockSize" --isa all --output-dir "$output" \
+            --compare "$here/baseline" "$here"/input/*.wav > "$output/report.txt"
+
+        awk -v plugin="$plugin" -v numInputs="$numInputs" '
+            FILENAME != "-" {
+                if ($0 !~ /^#/ && NF == 4) { expected[$1 " " $2] = $3 " samples differ by up to " $4 }
+                next
+            }
+            /^[^ ].*\.wav: / {
+                file = substr($1, 1, length($1) - 1)
+                if ($0 ~ /FAILED/) { print "    " $0; ++numFailed }
+                next
+            }
+            /bit-exact with the reference/ {
+                ++numResults
+                if ((plugin " " file) in expected) {
+                    print "    " file ": bit-exact, expected " expected[plugin " " file]
+                    ++numFailed
+                }
+            }
+            /from the reference:/ {
+                ++numResults
+                actual = $5 " samples differ by up to " $NF
+                if (!((plugin " " file) in expected)) {
+                    print "    " file ": " actual ", expected bit-exact"
+                    ++numFailed
+                } else if (expected[plugin " " file] != actual) {
+                    print "    " file ": " actual ", expected " expected[plugin " " file]
+                    ++numFailed
+                }
+            }
+            END {
+                if (numResults == 0 || numResults % numInputs != 0) {
+                    print "    BatchRender did not report on every file"
+                    ++numFailed
+                }
+                exit numFailed > 0
+            }
+        ' "$here/expected-differences.txt" - < "$output/report.txt" || numFailed=$((numFailed + 1))
+    done
+done
+
+if [ "$numFailed" -eq 0 ]; then
+    echo "All renders are as expected"
+else
+    echo "Some renders are not as expected"
+    exit 1
+fi
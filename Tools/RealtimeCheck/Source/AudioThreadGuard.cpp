@@ -0,0 +1,481 @@
+// The C library's fortified versions of read() and friends are inline
+// functions that can't be replaced, so they are turned off for this file.
+#undef _FORTIFY_SOURCE
+
+#include "AudioThreadGuard.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__) && defined(__GLIBC__)
+    #define AIRWINDOWS_GUARD_GLIBC 1
+    #include <cstdarg>
+    #include <cerrno>
+    #include <cstdio>
+    #include <dlfcn.h>
+    #include <execinfo.h>
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <semaphore.h>
+    #include <time.h>
+    #include <unistd.h>
+
+    // glibc's own allocator, which the replacements of malloc and operator
+    // new call into. These are not in any header but are always exported.
+    extern "C" {
+        void* __libc_malloc(size_t size);
+        void* __libc_calloc(size_t count, size_t size);
+        void* __libc_realloc(void* ptr, size_t size);
+        void* __libc_memalign(size_t alignment, size_t size);
+        void __libc_free(void* ptr);
+    }
+#else
+    #define AIRWINDOWS_GUARD_GLIBC 0
+#endif
+
+namespace
+{
+    using AudioThreadGuard::Kind;
+
+    // The number of Scopes that are active on this thread. This is a plain
+    // int that is constant-initialized, so reading it from inside malloc
+    // doesn't allocate.
+    thread_local int depth = 0;
+
+    // Set while a violation is being recorded, so that anything the
+    // recording itself calls isn't counted again.
+    thread_local bool recording = false;
+
+    std::atomic<std::uint64_t> counts[int(Kind::numKinds)];
+    std::atomic<const char*> firstFunction { nullptr };
+
+    constexpr int maxStackDepth = 64;
+    void* firstStack[maxStackDepth];
+    int firstStackSize = 0;
+
+    void record(Kind kind, const char* function)
+    {
+        if (depth == 0 || recording) { return; }
+        recording = true;
+
+        counts[int(kind)].fetch_add(1, std::memory_order_relaxed);
+
+        const char* expected = nullptr;
+        if (firstFunction.compare_exchange_strong(expected, function)) {
+           #if AIRWINDOWS_GUARD_GLIBC
+            firstStackSize = backtrace(firstStack, maxStackDepth);
+           #endif
+        }
+
+        recording = false;
+    }
+
+    void* allocate(std::size_t size)
+    {
+       #if AIRWINDOWS_GUARD_GLIBC
+        return __libc_malloc(size);
+       #else
+        return std::malloc(size);
+       #endif
+    }
+
+    void* allocateAligned(std::size_t size, std::size_t alignment)
+    {
+       #if AIRWINDOWS_GUARD_GLIBC
+        return __libc_memalign(alignment, size);
+       #elif defined(_MSC_VER)
+        return _aligned_malloc(size, alignment);
+       #else
+        // aligned_alloc wants the size to be a multiple of the alignment.
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+       #endif
+    }
+
+    void deallocate(void* ptr)
+    {
+       #if AIRWINDOWS_GUARD_GLIBC
+        __libc_free(ptr);
+       #else
+        std::free(ptr);
+       #endif
+    }
+
+    void deallocateAligned(void* ptr)
+    {
+       #if defined(_MSC_VER)
+        _aligned_free(ptr);
+       #else
+        deallocate(ptr);
+       #endif
+    }
+
+    void* checkedNew(std::size_t size)
+    {
+        record(Kind::allocation, "operator new");
+        if (void* ptr = allocate(size == 0 ? 1 : size)) { return ptr; }
+        throw std::bad_alloc();
+    }
+
+    void* checkedNewAligned(std::size_t size, std::align_val_t alignment)
+    {
+        record(Kind::allocation, "operator new");
+        if (void* ptr = allocateAligned(size == 0 ? 1 : size, std::size_t(alignment))) { return ptr; }
+        throw std::bad_alloc();
+    }
+
+    void checkedDelete(void* ptr)
+    {
+        if (ptr == nullptr) { return; }
+        record(Kind::deallocation, "operator delete");
+        deallocate(ptr);
+    }
+
+    void checkedDeleteAligned(void* ptr)
+    {
+        if (ptr == nullptr) { return; }
+        record(Kind::deallocation, "operator delete");
+        deallocateAligned(ptr);
+    }
+
+   #if AIRWINDOWS_GUARD_GLIBC
+    // Finds the next definition of `name` after this one, which is the real
+    // function in the C library. The result is cached in `function`. This
+    // doesn't use a local static, because initializing one can take a lock.
+    template<typename Function>
+    Function real(Function& function, const char* name)
+    {
+        if (function == nullptr) {
+            function = reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+        }
+        return function;
+    }
+
+    decltype(&pthread_mutex_lock) realMutexLock = nullptr;
+    decltype(&pthread_mutex_timedlock) realMutexTimedLock = nullptr;
+    decltype(&pthread_rwlock_rdlock) realReadLock = nullptr;
+    decltype(&pthread_rwlock_wrlock) realWriteLock = nullptr;
+    decltype(&pthread_cond_wait) realCondWait = nullptr;
+    decltype(&pthread_cond_timedwait) realCondTimedWait = nullptr;
+    decltype(&sem_wait) realSemWait = nullptr;
+    decltype(&sem_timedwait) realSemTimedWait = nullptr;
+    decltype(&nanosleep) realNanosleep = nullptr;
+    decltype(&clock_nanosleep) realClockNanosleep = nullptr;
+    decltype(&usleep) realUsleep = nullptr;
+    decltype(&sleep) realSleep = nullptr;
+    decltype(&sched_yield) realYield = nullptr;
+    decltype(&read) realRead = nullptr;
+    decltype(&write) realWrite = nullptr;
+    decltype(&close) realClose = nullptr;
+    decltype(&fopen) realFopen = nullptr;
+    int (*realOpen)(const char*, int, ...) = nullptr;
+    long (*realSyscall)(long, ...) = nullptr;
+   #endif
+}
+
+namespace AudioThreadGuard
+{
+    std::uint64_t Violations::getTotal() const
+    {
+        std::uint64_t total = 0;
+        for (auto count : counts) {
+            total += count;
+        }
+        return total;
+    }
+
+    void initialise()
+    {
+       #if AIRWINDOWS_GUARD_GLIBC
+        real(realMutexLock, "pthread_mutex_lock");
+        real(realMutexTimedLock, "pthread_mutex_timedlock");
+        real(realReadLock, "pthread_rwlock_rdlock");
+        real(realWriteLock, "pthread_rwlock_wrlock");
+        real(realCondWait, "pthread_cond_wait");
+        real(realCondTimedWait, "pthread_cond_timedwait");
+        real(realSemWait, "sem_wait");
+        real(realSemTimedWait, "sem_timedwait");
+        real(realNanosleep, "nanosleep");
+        real(realClockNanosleep, "clock_nanosleep");
+        real(realUsleep, "usleep");
+        real(realSleep, "sleep");
+        real(realYield, "sched_yield");
+        real(realRead, "read");
+        real(realWrite, "write");
+        real(realClose, "close");
+        real(realFopen, "fopen");
+        real(realOpen, "open");
+        real(realSyscall, "syscall");
+
+        // The first call to backtrace() loads the unwinder.
+        void* stack[4];
+        backtrace(stack, 4);
+       #endif
+    }
+
+    Scope::Scope()
+    {
+        ++depth;
+    }
+
+    Scope::~Scope()
+    {
+        --depth;
+    }
+
+    Violations getViolations()
+    {
+        Violations violations;
+        for (int kind = 0; kind < int(Kind::numKinds); ++kind) {
+            violations.counts[kind] = counts[kind].load();
+        }
+        violations.firstFunction = firstFunction.load();
+        return violations;
+    }
+
+    void reset()
+    {
+        for (auto& count : counts) {
+            count.store(0);
+        }
+        firstStackSize = 0;
+        firstFunction.store(nullptr);
+    }
+
+    void printFirstStackTrace()
+    {
+       #if AIRWINDOWS_GUARD_GLIBC
+        if (firstFunction.load() != nullptr && firstStackSize > 0) {
+            backtrace_symbols_fd(firstStack, firstStackSize, 2);
+        }
+       #endif
+    }
+
+    const char* getName(Kind kind)
+    {
+        switch (kind) {
+            case Kind::allocation: return "allocations";
+            case Kind::deallocation: return "deallocations";
+            case Kind::lock: return "locks";
+            case Kind::systemCall: return "system calls";
+            default: return "";
+        }
+    }
+
+    bool canSeeLocks()
+    {
+        return AIRWINDOWS_GUARD_GLIBC != 0;
+    }
+}
+
+void* operator new(std::size_t size) { return checkedNew(size); }
+void* operator new[](std::size_t size) { return checkedNew(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return checkedNewAligned(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return checkedNewAligned(size, alignment); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    record(Kind::allocation, "operator new");
+    return allocate(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    record(Kind::allocation, "operator new");
+    return allocate(size == 0 ? 1 : size);
+}
+
+void operator delete(void* ptr) noexcept { checkedDelete(ptr); }
+void operator delete[](void* ptr) noexcept { checkedDelete(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { checkedDelete(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { checkedDelete(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { checkedDelete(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { checkedDelete(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { checkedDeleteAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { checkedDeleteAligned(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { checkedDeleteAligned(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { checkedDeleteAligned(ptr); }
+
+#if AIRWINDOWS_GUARD_GLIBC
+extern "C" {
+
+void* malloc(size_t size)
+{
+    record(Kind::allocation, "malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    record(Kind::allocation, "calloc");
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    record(Kind::allocation, "realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    if (ptr == nullptr) { return; }
+    record(Kind::deallocation, "free");
+    __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    record(Kind::allocation, "memalign");
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    record(Kind::allocation, "aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    record(Kind::allocation, "posix_memalign");
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) { return EINVAL; }
+    void* result = __libc_memalign(alignment, size);
+    if (result == nullptr) { return ENOMEM; }
+    *ptr = result;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+    record(Kind::lock, "pthread_mutex_lock");
+    return real(realMutexLock, "pthread_mutex_lock")(mutex);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t* mutex, const struct timespec* timeout) noexcept
+{
+    record(Kind::lock, "pthread_mutex_timedlock");
+    return real(realMutexTimedLock, "pthread_mutex_timedlock")(mutex, timeout);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t* lock) noexcept
+{
+    record(Kind::lock, "pthread_rwlock_rdlock");
+    return real(realReadLock, "pthread_rwlock_rdlock")(lock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t* lock) noexcept
+{
+    record(Kind::lock, "pthread_rwlock_wrlock");
+    return real(realWriteLock, "pthread_rwlock_wrlock")(lock);
+}
+
+int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+{
+    record(Kind::lock, "pthread_cond_wait");
+    return real(realCondWait, "pthread_cond_wait")(condition, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* timeout)
+{
+    record(Kind::lock, "pthread_cond_timedwait");
+    return real(realCondTimedWait, "pthread_cond_timedwait")(condition, mutex, timeout);
+}
+
+int sem_wait(sem_t* semaphore)
+{
+    record(Kind::lock, "sem_wait");
+    return real(realSemWait, "sem_wait")(semaphore);
+}
+
+int sem_timedwait(sem_t* semaphore, const struct timespec* timeout)
+{
+    record(Kind::lock, "sem_timedwait");
+    return real(realSemTimedWait, "sem_timedwait")(semaphore, timeout);
+}
+
+int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+    record(Kind::systemCall, "nanosleep");
+    return real(realNanosleep, "nanosleep")(duration, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const struct timespec* duration, struct timespec* remaining)
+{
+    record(Kind::systemCall, "clock_nanosleep");
+    return real(realClockNanosleep, "clock_nanosleep")(clock, flags, duration, remaining);
+}
+
+int usleep(useconds_t microseconds)
+{
+    record(Kind::systemCall, "usleep");
+    return real(realUsleep, "usleep")(microseconds);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+    record(Kind::systemCall, "sleep");
+    return real(realSleep, "sleep")(seconds);
+}
+
+int sched_yield() noexcept
+{
+    record(Kind::systemCall, "sched_yield");
+    return real(realYield, "sched_yield")();
+}
+
+ssize_t read(int fd, void* data, size_t size)
+{
+    record(Kind::systemCall, "read");
+    return real(realRead, "read")(fd, data, size);
+}
+
+ssize_t write(int fd, const void* data, size_t size)
+{
+    record(Kind::systemCall, "write");
+    return real(realWrite, "write")(fd, data, size);
+}
+
+int close(int fd)
+{
+    record(Kind::systemCall, "close");
+    return real(realClose, "close")(fd);
+}
+
+FILE* fopen(const char* path, const char* mode)
+{
+    record(Kind::systemCall, "fopen");
+    return real(realFopen, "fopen")(path, mode);
+}
+
+int open(const char* path, int flags, ...)
+{
+    record(Kind::systemCall, "open");
+
+    // The mode is only passed when a file may be created.
+    mode_t mode = 0;
+    if ((flags & (O_CREAT | O_TMPFILE)) != 0) {
+        va_list args;
+        va_start(args, flags);
+        mode = mode_t(va_arg(args, int));
+        va_end(args);
+    }
+    return real(realOpen, "open")(path, flags, mode);
+}
+
+// syscall() takes up to six arguments of register size. They are passed on
+// as they are, whether or not this particular call uses them all.
+long syscall(long number, ...) noexcept
+{
+    record(Kind::systemCall, "syscall");
+
+    va_list args;
+    va_start(args, number);
+    long a = va_arg(args, long), b = va_arg(args, long), c = va_arg(args, long);
+    long d = va_arg(args, long), e = va_arg(args, long), f = va_arg(args, long);
+    va_end(args);
+    return real(realSyscall, "syscall")(number, a, b, c, d, e, f);
+}
+
+}  // extern "C"
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Catches code that isn't real-time safe while it runs on the audio thread.
+
+    Code on the audio thread must not allocate or free memory, take a lock,
+    or make a system call that can block, such as sleeping or file I/O. Any of
+    these can take an unbounded amount of time, and one slow call is all it
+    takes for the host to miss a deadline and drop out.
+
+    A thread marks the code to check with a Scope. While a Scope is active on
+    a thread, every call it makes to one of the functions below is counted as
+    a violation. Other threads are not affected.
+
+    - operator new and delete, on every platform.
+    - On Linux with glibc: malloc, calloc, realloc, free, and friends; the
+      pthread mutex, rwlock, and condition variable functions, which is what
+      std::mutex and juce::CriticalSection use; sem_wait; the sleep
+      functions and sched_yield; read, write, open, and close; and syscall(),
+      which is how std::atomic::wait ends up in the kernel.
+
+    The functions are replaced for the whole program, by defining them in the
+    executable, which takes precedence over the C and C++ libraries. The
+    replacements look up the real functions and call them, so apart from the
+    counting the program works as usual. Calls that the C library makes to
+    itself internally, for example from printf to write, don't go through
+    these replacements and are not seen.
+
+    Recording a violation is itself real-time safe, so the code under test
+    keeps running normally and all violations are counted, not only the
+    first. For the first one, the call stack is kept so that it can be
+    printed afterwards.
+*/
+namespace AudioThreadGuard
+{
+    enum class Kind
+    {
+        allocation,
+        deallocation,
+        lock,
+        systemCall,
+        numKinds
+    };
+
+    struct Violations
+    {
+        std::uint64_t counts[int(Kind::numKinds)] = {};
+
+        // The function that was called first, such as "malloc", or nullptr.
+        const char* firstFunction = nullptr;
+
+        std::uint64_t getTotal() const;
+    };
+
+    // Looks up the real functions and warms up the stack trace code, which
+    // may allocate the first time. Call this once at the start of main().
+    void initialise();
+
+    // Checks the calling thread for as long as the Scope exists.
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // The violations since the last reset(), on all threads together.
+    Violations getViolations();
+    void reset();
+
+    // Writes the call stack of the first violation since the last reset()
+    // to stderr, if the platform supports this.
+    void printFirstStackTrace();
+
+    const char* getName(Kind kind);
+
+    // Whether locks and system calls can be seen on this platform.
+    // Allocations can always be seen.
+    bool canSeeLocks();
+}
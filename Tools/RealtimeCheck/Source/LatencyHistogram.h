@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+/*
+    Counts how long calls took, in buckets on a logarithmic scale, so that it
+    can hold any number of calls in a fixed amount of memory.
+
+    There are 16 buckets per doubling of the time, so each bucket is about 4%
+    wide, from 1 ns up to about one second. Percentiles are given as the upper
+    edge of the bucket they fall in, so they may be up to 4% too high but are
+    never too low. The longest time is kept exactly.
+*/
+class LatencyHistogram
+{
+public:
+    void add(double seconds) noexcept
+    {
+        double ns = seconds * 1.0e9;
+        int bucket = ns < 1.0 ? 0 : std::min(numBuckets - 1, 1 + int(std::log2(ns) * bucketsPerOctave));
+        counts[size_t(bucket)] += 1;
+        numCalls += 1;
+        totalSeconds += seconds;
+        maxSeconds = std::max(maxSeconds, seconds);
+    }
+
+    // The time that `fraction` of the calls took at most, e.g. 0.99 for the
+    // 99th percentile.
+    double getPercentile(double fraction) const noexcept
+    {
+        if (numCalls == 0) { return 0.0; }
+
+        auto wanted = std::uint64_t(std::ceil(fraction * double(numCalls)));
+        std::uint64_t seen = 0;
+        for (int bucket = 0; bucket < numBuckets; ++bucket) {
+            seen += counts[size_t(bucket)];
+            if (seen >= wanted) {
+                double upperEdge = std::exp2(double(bucket) / bucketsPerOctave) * 1.0e-9;
+                return std::min(upperEdge, maxSeconds);
+            }
+        }
+        return maxSeconds;
+    }
+
+    std::uint64_t getNumCalls() const noexcept { return numCalls; }
+    double getMeanSeconds() const noexcept { return numCalls == 0 ? 0.0 : totalSeconds / double(numCalls); }
+    double getMaxSeconds() const noexcept { return maxSeconds; }
+
+private:
+    static constexpr int bucketsPerOctave = 16;
+    static constexpr int numBuckets = 30 * bucketsPerOctave + 1;
+
+    // Bucket 0 is for anything under 1 ns. Bucket b holds the times from
+    // 2^((b - 1) / 16) ns up to 2^(b / 16) ns.
+    std::array<std::uint64_t, numBuckets> counts {};
+    std::uint64_t numCalls = 0;
+    double totalSeconds = 0.0;
+    double maxSeconds = 0.0;
+};
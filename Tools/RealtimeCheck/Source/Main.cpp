@@ -0,0 +1,278 @@
+/*
+    Checks that the plug-ins are safe to run on a real-time audio thread, and
+    measures how long every call to processBlock takes.
+
+    Usage:
+        RealtimeCheck [options]
+
+    Options:
+        --plugins <a,b,...>   Only check these plug-ins. Default: all of them.
+        --rate <hz>           Sample rate. Default: 44100.
+        --block-size <n>      Samples per call to processBlock. Default: 64.
+        --seconds <n>         How long to keep calling processBlock, per
+                              plug-in and precision. Default: 5.
+        --no-automation       Don't change the parameters while processing.
+        --seed <n>            Seed for the random parameter changes.
+
+    Each plug-in is run in float and in double precision, with the calls to
+    processBlock back to back on one thread, with white noise at +24 dBFS as
+    the input. Meanwhile, another thread plays the part of the host and the
+    UI: it sets random parameters to random values at random moments, and
+    now and then saves the plug-in's state and loads it back in. This is what
+    makes the processor's update() run while the audio thread is busy.
+
+    Every call to processBlock runs inside an AudioThreadGuard::Scope, which
+    counts any allocation, lock, or blocking system call. The program exits
+    with an error code if it finds any of them.
+
+    For each plug-in it prints the median, 99th percentile, 99.9th
+    percentile, and longest time per call, and the longest time as a
+    percentage of the time the call may take before the audio drops out.
+*/
+
+#include <JuceHeader.h>
+#include <random>
+#include <thread>
+#include "../../Common/Processors.h"
+#include "../../Common/TestSignals.h"
+#include "AudioThreadGuard.h"
+#include "LatencyHistogram.h"
+
+namespace
+{
+    struct Settings
+    {
+        juce::StringArray plugins = Processors::getNames();
+        double sampleRate = 44100.0;
+        int blockSize = 64;
+        double seconds = 5.0;
+        bool automation = true;
+        unsigned int seed = 1;
+    };
+
+    /*
+        Changes the parameters of a processor from its own thread, until it
+        is destroyed. About one in twenty changes is a save and reload of the
+        whole state instead, which goes through the XML code.
+    */
+    class Automation
+    {
+    public:
+        Automation(juce::AudioProcessor& processor, unsigned int seed) :
+            processor(processor),
+            random(seed),
+            thread([this] { run(); })
+        {
+        }
+
+        ~Automation()
+        {
+            stop.store(true);
+            thread.join();
+        }
+
+        int getNumChanges() const { return numChanges.load(); }
+
+    private:
+        void run()
+        {
+            auto& parameters = processor.getParameters();
+            std::uniform_int_distribution<int> pickParameter(0, std::max(0, parameters.size() - 1));
+            std::uniform_real_distribution<float> pickValue(0.0f, 1.0f);
+            std::uniform_int_distribution<int> pickPause(0, 1000);
+            std::uniform_int_distribution<int> pickAction(0, 19);
+
+            while (!stop.load()) {
+                if (pickAction(random) == 0) {
+                    juce::MemoryBlock state;
+                    processor.getStateInformation(state);
+                    processor.setStateInformation(state.getData(), int(state.getSize()));
+                } else if (!parameters.isEmpty()) {
+                    parameters[pickParameter(random)]->setValueNotifyingHost(pickValue(random));
+                }
+                numChanges.fetch_add(1);
+
+                std::this_thread::sleep_for(std::chrono::microseconds(pickPause(random)));
+            }
+        }
+
+        juce::AudioProcessor& processor;
+        std::mt19937 random;
+        std::atomic<bool> stop { false };
+        std::atomic<int> numChanges { 0 };
+        std::thread thread;
+    };
+
+    struct Result
+    {
+        LatencyHistogram histogram;
+        AudioThreadGuard::Violations violations;
+        int numChanges = 0;
+    };
+
+    template<typename SampleType>
+    Result check(const Settings& settings, const juce::String& pluginName,
+                 const juce::AudioBuffer<float>& signal)
+    {
+        constexpr int numChannels = 2;
+
+        auto processor = Processors::create(pluginName);
+        if constexpr (std::is_same_v<SampleType, double>) {
+            processor->setProcessingPrecision(juce::AudioProcessor::doublePrecision);
+        }
+        Processors::prepare(*processor, numChannels, settings.sampleRate, settings.blockSize);
+
+        juce::AudioBuffer<SampleType> input;
+        input.makeCopyOf(signal);
+        juce::AudioBuffer<SampleType> work(numChannels, settings.blockSize);
+        juce::MidiBuffer midi;
+
+        Result result;
+        AudioThreadGuard::reset();
+
+        {
+            std::unique_ptr<Automation> automation;
+            if (settings.automation) {
+                automation = std::make_unique<Automation>(*processor, settings.seed);
+            }
+
+            auto endTicks = juce::Time::getHighResolutionTicks()
+                          + juce::Time::secondsToHighResolutionTicks(settings.seconds);
+            int numBlocks = input.getNumSamples() / settings.blockSize;
+
+            for (int block = 0; juce::Time::getHighResolutionTicks() < endTicks; block = (block + 1) % numBlocks) {
+                for (int channel = 0; channel < numChannels; ++channel) {
+                    work.copyFrom(channel, 0, input, channel, block * settings.blockSize, settings.blockSize);
+                }
+
+                auto startTicks = juce::Time::getHighResolutionTicks();
+                {
+                    AudioThreadGuard::Scope scope;
+                    processor->processBlock(work, midi);
+                }
+                auto stopTicks = juce::Time::getHighResolutionTicks();
+
+                result.histogram.add(juce::Time::highResolutionTicksToSeconds(stopTicks - startTicks));
+            }
+
+            if (automation != nullptr) { result.numChanges = automation->getNumChanges(); }
+        }
+
+        result.violations = AudioThreadGuard::getViolations();
+        processor->releaseResources();
+        return result;
+    }
+
+    juce::String formatMicroseconds(double seconds)
+    {
+        return juce::String(seconds * 1.0e6, 2);
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: RealtimeCheck [options]\n\n"
+                  << "Options:\n"
+                  << "  --plugins <a,b,...>   plug-ins to check (default: all)\n"
+                  << "  --rate <hz>           sample rate (default: 44100)\n"
+                  << "  --block-size <n>      samples per call (default: 64)\n"
+                  << "  --seconds <n>         time per plug-in and precision (default: 5)\n"
+                  << "  --no-automation       don't change parameters while processing\n"
+                  << "  --seed <n>            seed for the random parameter changes\n\n"
+                  << "Plug-ins: " << Processors::getNames().joinIntoString(" ") << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    AudioThreadGuard::initialise();
+
+    // The parameters use timers, which need a message manager, even though
+    // its message loop never runs.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    Settings settings;
+
+    for (int i = 1; i < argc; ++i) {
+        juce::String arg(juce::CharPointer_UTF8(argv[i]));
+        juce::String value = i + 1 < argc ? juce::String(juce::CharPointer_UTF8(argv[i + 1])) : juce::String();
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--no-automation") {
+            settings.automation = false;
+            continue;
+        } else if (arg == "--plugins" && hasValue) {
+            settings.plugins = juce::StringArray::fromTokens(value, ",", "");
+        } else if (arg == "--rate" && hasValue) {
+            settings.sampleRate = value.getDoubleValue();
+        } else if (arg == "--block-size" && hasValue) {
+            settings.blockSize = std::max(1, value.getIntValue());
+        } else if (arg == "--seconds" && hasValue) {
+            settings.seconds = std::max(0.01, value.getDoubleValue());
+        } else if (arg == "--seed" && hasValue) {
+            settings.seed = (unsigned int) value.getLargeIntValue();
+        } else {
+            printUsage();
+            return 1;
+        }
+        ++i;
+    }
+
+    for (auto& name : settings.plugins) {
+        if (Processors::create(name) == nullptr) {
+            std::cerr << "Unknown plug-in: " << name << "\n";
+            return 1;
+        }
+    }
+
+    if (!AudioThreadGuard::canSeeLocks()) {
+        std::cout << "Note: on this platform only allocations are checked, not locks or system calls.\n\n";
+    }
+
+    // One second of input, which is looped.
+    juce::AudioBuffer<float> signal(2, std::max(settings.blockSize, int(settings.sampleRate)));
+    TestSignals::generate("noise", signal, settings.sampleRate);
+
+    double budget = settings.blockSize / settings.sampleRate;
+    bool failed = false;
+
+    std::cout << "plug-in        precision   calls    changes   p50 us   p99 us  p99.9 us   max us   max/budget  violations\n";
+
+    for (auto& name : settings.plugins) {
+        for (bool useDouble : { false, true }) {
+            auto result = useDouble ? check<double>(settings, name, signal) : check<float>(settings, name, signal);
+            const auto& histogram = result.histogram;
+            auto numViolations = result.violations.getTotal();
+
+            std::cout << name.paddedRight(' ', 15) << juce::String(useDouble ? "double" : "float").paddedRight(' ', 10)
+                      << juce::String(juce::int64(histogram.getNumCalls())).paddedLeft(' ', 7)
+                      << juce::String(result.numChanges).paddedLeft(' ', 11)
+                      << formatMicroseconds(histogram.getPercentile(0.5)).paddedLeft(' ', 9)
+                      << formatMicroseconds(histogram.getPercentile(0.99)).paddedLeft(' ', 9)
+                      << formatMicroseconds(histogram.getPercentile(0.999)).paddedLeft(' ', 10)
+                      << formatMicroseconds(histogram.getMaxSeconds()).paddedLeft(' ', 9)
+                      << (juce::String(histogram.getMaxSeconds() / budget * 100.0, 1) + "%").paddedLeft(' ', 13)
+                      << juce::String(juce::int64(numViolations)).paddedLeft(' ', 12) << std::endl;
+
+            if (numViolations > 0) {
+                failed = true;
+                std::cout << "  ";
+                for (int kind = 0; kind < int(AudioThreadGuard::Kind::numKinds); ++kind) {
+                    std::cout << AudioThreadGuard::getName(AudioThreadGuard::Kind(kind)) << ": "
+                              << result.violations.counts[kind] << "  ";
+                }
+                std::cout << "\n  first: " << result.violations.firstFunction << ", called from:" << std::endl;
+                AudioThreadGuard::printFirstStackTrace();
+            }
+        }
+    }
+
+    std::cout << "\nThe budget for a block of " << settings.blockSize << " samples at "
+              << int(settings.sampleRate) << " Hz is " << formatMicroseconds(budget) << " us.\n";
+
+    if (failed) {
+        std::cout << "FAILED: processBlock is not real-time safe.\n";
+        return 1;
+    }
+    std::cout << "No allocations, locks, or system calls in processBlock.\n";
+    return 0;
+}
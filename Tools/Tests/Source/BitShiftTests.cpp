@@ -0,0 +1,155 @@
+#include <JuceHeader.h>
+#include <cstring>
+#include <vector>
+#include "../../../Shared/BitShift.h"
+
+/*
+    Checks the promise of BitShift::apply(): every sample comes out as exactly
+    `x * 2^bits`, or is counted as an overflow or an underflow. The input is
+    random bit patterns, so that every exponent turns up, including subnormal
+    numbers, zeros, infinities, and NaNs.
+
+    Everything runs twice: as is, and with apply() called inside a
+    juce::ScopedNoDenormals like in the plug-in, where the CPU would otherwise
+    treat subnormal numbers as zero. The checks themselves always run with
+    denormals on, since frexp() and comparisons need them.
+*/
+namespace
+{
+    class BitShiftTests : public juce::UnitTest
+    {
+    public:
+        BitShiftTests() : juce::UnitTest("BitShift", "Shared") { }
+
+        void runTest() override
+        {
+            // Every shift from -70 to +70, plus the edges of the range that
+            // apply() clamps to, and shifts beyond it.
+            std::vector<int> shifts;
+            for (int bits = -70; bits <= 70; ++bits) { shifts.push_back(bits); }
+            for (int bits : { 126, 127, 128, 149, 150, 253, 254, 277, 278, 1022, 1023, 1024, 1074, 2098, 2099, 5000 }) {
+                shifts.push_back(bits);
+                shifts.push_back(-bits);
+            }
+
+            beginTest("float samples are exact or counted, for shifts from -70 to +70 and beyond");
+            checkShifts<float, std::uint32_t>(shifts);
+
+            beginTest("double samples are exact or counted, for shifts from -70 to +70 and beyond");
+            checkShifts<double, std::uint64_t>(shifts);
+
+            beginTest("float samples are exact or counted with denormals turned off");
+            checkShifts<float, std::uint32_t>(shifts, true);
+            checkSubnormal();
+
+            beginTest("double samples are exact or counted with denormals turned off");
+            checkShifts<double, std::uint64_t>(shifts, true);
+        }
+
+    private:
+        template<typename T>
+        static BitShift::Result apply(T* data, int numSamples, int bits, bool noDenormals)
+        {
+            if (noDenormals) {
+                juce::ScopedNoDenormals scope;
+                return BitShift::apply(data, numSamples, bits);
+            }
+            return BitShift::apply(data, numSamples, bits);
+        }
+
+        template<typename T, typename Bits>
+        void checkShifts(const std::vector<int>& shifts, bool noDenormals = false)
+        {
+            constexpr int numSamples = 4096;
+            juce::Random random(12345);
+
+            T input[numSamples];
+            T output[numSamples];
+            int numWrong = 0;
+            int numWrongFlags = 0;
+
+            for (int bits : shifts) {
+                for (int i = 0; i < numSamples; ++i) {
+                    Bits pattern = Bits(random.nextInt64());
+                    std::memcpy(&input[i], &pattern, sizeof(T));
+                    output[i] = input[i];
+                }
+
+                // All at once, as the plug-in does it.
+                BitShift::Result total = apply(output, numSamples, bits, noDenormals);
+
+                // One at a time, to see which samples were counted. This must
+                // give the same output and the same counts.
+                int numOverflows = 0;
+                int numUnderflows = 0;
+                for (int i = 0; i < numSamples; ++i) {
+                    T x = input[i];
+                    T y = x;
+                    BitShift::Result result = apply(&y, 1, bits, noDenormals);
+                    numOverflows += result.numOverflows;
+                    numUnderflows += result.numUnderflows;
+
+                    if (!sameBits(y, output[i])) { ++numWrong; }
+
+                    // A sample that is counted must really have overflowed or
+                    // underflowed, and one that is not counted must be exact.
+                    if (result.numOverflows > 0) {
+                        if (!std::isinf(y)) { ++numWrongFlags; }
+                    } else if (result.numUnderflows > 0) {
+                        if (!(std::abs(y) <= std::numeric_limits<T>::min())) { ++numWrongFlags; }
+                    } else if (!isExact(x, y, bits)) {
+                        ++numWrong;
+                        if (numWrong <= 5) {
+                            logMessage("not exact: " + juce::String(double(x)) + " * 2^" + juce::String(bits)
+                                       + " gave " + juce::String(double(y)));
+                        }
+                    }
+                }
+
+                expectEquals(total.numOverflows, numOverflows, "overflows at " + juce::String(bits) + " bits");
+                expectEquals(total.numUnderflows, numUnderflows, "underflows at " + juce::String(bits) + " bits");
+            }
+
+            expectEquals(numWrong, 0, "samples that are neither exact nor counted");
+            expectEquals(numWrongFlags, 0, "samples that are counted but did not overflow or underflow");
+        }
+
+        // The case that used to go wrong inside ScopedNoDenormals: a subnormal
+        // number, shifted up into the normal range, came out as 0.
+        void checkSubnormal()
+        {
+            std::uint32_t pattern = 0x3e8;
+            float x;
+            std::memcpy(&x, &pattern, sizeof(float));
+            BitShift::Result result = apply(&x, 1, 5, true);
+            std::uint32_t shifted;
+            std::memcpy(&shifted, &x, sizeof(float));
+            expectEquals(int(shifted), 0x7d00, "bits of subnormal 0x3e8 shifted by 5");
+            expectEquals(result.numUnderflows, 1, "underflows of subnormal 0x3e8 shifted by 5");
+        }
+
+        // Whether y is exactly x * 2^bits. frexp() splits a number into its
+        // mantissa and exponent exactly, even for subnormal numbers.
+        template<typename T>
+        static bool isExact(T x, T y, int bits)
+        {
+            if (std::isnan(x)) { return std::isnan(y); }
+            if (x == T(0) || std::isinf(x)) { return sameBits(x, y); }
+            if (y == T(0) || !std::isfinite(y)) { return false; }
+
+            int exponentX = 0;
+            int exponentY = 0;
+            T mantissaX = std::frexp(x, &exponentX);
+            T mantissaY = std::frexp(y, &exponentY);
+            return mantissaX == mantissaY && exponentY == exponentX + bits;
+        }
+
+        template<typename T>
+        static bool sameBits(T a, T b)
+        {
+            return std::memcmp(&a, &b, sizeof(T)) == 0;
+        }
+    };
+
+    BitShiftTests bitShiftTests;
+}
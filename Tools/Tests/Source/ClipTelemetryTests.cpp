@@ -0,0 +1,140 @@
+#include <JuceHeader.h>
+#include <vector>
+#include "../../../Shared/ClipOnlyKernel.h"
+#include "../../../Shared/ClipOnly2Kernel.h"
+#include "../../../Shared/ClipTelemetry.h"
+
+/*
+    Checks that a kernel measuring itself with a ClipTelemetry::Probe gives
+    exactly the same statistics as the Meter scanning the buffers before and
+    after the kernel, for every block, and that measuring doesn't change the
+    output. The blocks have random sizes, so that spans, clipped runs, and the
+    samples in the delay line end up on both sides of the block boundaries.
+
+    The input level is 1, because the Meter applies the gain in the precision
+    of the samples, while the clipper rounds a double product. The output
+    level is 0.7, which isn't exactly a float.
+*/
+namespace
+{
+    class ClipTelemetryTests : public juce::UnitTest
+    {
+    public:
+        ClipTelemetryTests() : juce::UnitTest("ClipTelemetry", "Shared") { }
+
+        void runTest() override
+        {
+            beginTest("ClipOnly measures float audio like the Meter does");
+            checkProbes<ClipOnly::Kernel, float>(44100.0, 2);
+            checkProbes<ClipOnly::Kernel, float>(44100.0, 1);
+
+            beginTest("ClipOnly measures double audio like the Meter does");
+            checkProbes<ClipOnly::Kernel, double>(44100.0, 2);
+
+            beginTest("ClipOnly2 measures float audio like the Meter does");
+            checkProbes<ClipOnly2::Kernel, float>(44100.0, 2);
+            checkProbes<ClipOnly2::Kernel, float>(96000.0, 2);
+            checkProbes<ClipOnly2::Kernel, float>(768000.0, 1);
+
+            beginTest("ClipOnly2 measures double audio like the Meter does");
+            checkProbes<ClipOnly2::Kernel, double>(44100.0, 2);
+            checkProbes<ClipOnly2::Kernel, double>(192000.0, 2);
+        }
+
+    private:
+        static constexpr double threshold = 0.9549925859;
+
+        template<typename Kernel, typename T>
+        void checkProbes(double sampleRate, int numChannels)
+        {
+            constexpr int numSamples = 48000;
+            juce::Random random(2468);
+
+            // Quiet noise with louder bursts, so that there are long spans
+            // that don't clip as well as runs of clipped samples.
+            std::vector<T> inA(numSamples);
+            std::vector<T> inB(numSamples);
+            for (int i = 0; i < numSamples; ++i) {
+                double level = ((i / 2000) % 4 == 3) ? 1.3 : 0.6;
+                inA[i] = T(level * (random.nextDouble() * 2.0 - 1.0));
+                inB[i] = T(level * (random.nextDouble() * 2.0 - 1.0));
+            }
+            if (numChannels == 1) { inB = inA; }
+
+            std::vector<T> scannedA = inA;
+            std::vector<T> scannedB = inB;
+            Kernel scannedKernel = makeKernel<Kernel>(sampleRate);
+            ClipTelemetry::Meter scannedMeter(threshold);
+            scannedMeter.prepare(numChannels);
+
+            std::vector<T> probedA = inA;
+            std::vector<T> probedB = inB;
+            std::vector<ClipTelemetry::Measured<Kernel>> probedKernels(1);
+            static_cast<Kernel&>(probedKernels[0]) = makeKernel<Kernel>(sampleRate);
+            ClipTelemetry::Meter probedMeter(threshold);
+            probedMeter.prepare(numChannels);
+
+            int numBlocks = 0;
+            int numDifferentBlocks = 0;
+            int numClipped = 0;
+
+            for (int start = 0; start < numSamples; ) {
+                int count = std::min(numSamples - start, 1 + random.nextInt(600));
+
+                T* scanned[2] = { &scannedA[size_t(start)], &scannedB[size_t(start)] };
+                scannedMeter.measureInput(scanned, numChannels, count, 1.0);
+                scannedKernel.process(scanned[0], scanned[numChannels - 1], scanned[0], scanned[numChannels - 1], count);
+                scannedMeter.measureOutput(scanned, numChannels, count);
+
+                T* probed[2] = { &probedA[size_t(start)], &probedB[size_t(start)] };
+                probedMeter.startProbes(probedKernels, numChannels, count);
+                probedKernels[0].process(probed[0], probed[numChannels - 1], probed[0], probed[numChannels - 1], count);
+                probedMeter.addProbes(probedKernels, numChannels, true);
+                probedMeter.finishBlock();
+
+                ClipTelemetry::BlockStats expected;
+                ClipTelemetry::BlockStats actual;
+                expect(scannedMeter.pop(expected) && probedMeter.pop(actual), "one block of statistics each");
+                if (!sameStats(expected, actual)) {
+                    ++numDifferentBlocks;
+                    if (numDifferentBlocks <= 5) {
+                        logMessage("block at " + juce::String(juce::int64(expected.position)) + ": clipped "
+                                   + juce::String(expected.clippedSamples) + "/" + juce::String(actual.clippedSamples)
+                                   + ", events " + juce::String(expected.clipEvents) + "/" + juce::String(actual.clipEvents)
+                                   + ", longest " + juce::String(expected.longestRun) + "/" + juce::String(actual.longestRun)
+                                   + ", peaks " + juce::String(expected.inputPeak) + "/" + juce::String(actual.inputPeak)
+                                   + " " + juce::String(expected.outputPeak) + "/" + juce::String(actual.outputPeak));
+                    }
+                }
+
+                numClipped += expected.clippedSamples;
+                ++numBlocks;
+                start += count;
+            }
+
+            juce::String where = " at " + juce::String(sampleRate) + " Hz with " + juce::String(numChannels) + " channels";
+            expect(numClipped > 0, "some samples clip" + where);
+            expectEquals(numDifferentBlocks, 0, "blocks out of " + juce::String(numBlocks) + " that differ" + where);
+            expect(probedA == scannedA && probedB == scannedB, "the output doesn't change" + where);
+        }
+
+        template<typename Kernel>
+        static Kernel makeKernel(double sampleRate)
+        {
+            Kernel kernel;
+            kernel.prepare(sampleRate);
+            kernel.outputLevel = 0.7;
+            return kernel;
+        }
+
+        static bool sameStats(const ClipTelemetry::BlockStats& a, const ClipTelemetry::BlockStats& b)
+        {
+            return a.position == b.position && a.numSamples == b.numSamples
+                && a.clippedSamples == b.clippedSamples && a.clipEvents == b.clipEvents
+                && a.longestRun == b.longestRun && a.inputPeak == b.inputPeak && a.outputPeak == b.outputPeak
+                && a.numDropped == b.numDropped;
+        }
+    };
+
+    ClipTelemetryTests clipTelemetryTests;
+}
@@ -0,0 +1,129 @@
+#include <JuceHeader.h>
+#include "../../../Shared/ClipSoftlyKernel.h"
+#include "../../../Shared/FastMath.h"
+
+/*
+    Checks the error bounds that FastMath.h promises, and that the Fast Math
+    mode of ClipSoftly stays within 3.2e-9 of the exact version before the
+    output is rounded to float. The kernels run on double buffers here, so
+    that nothing gets rounded.
+*/
+namespace
+{
+    class FastMathTests : public juce::UnitTest
+    {
+    public:
+        FastMathTests() : juce::UnitTest("FastMath", "Shared") { }
+
+        void runTest() override
+        {
+            beginTest("sin() is within 3.34e-9 of std::sin() on [-pi/2, pi/2]");
+            {
+                const double halfPi = 1.5707963267948966;
+                const int numSteps = 1 << 20;
+                double largestError = 0.0;
+                for (int i = 0; i <= numSteps; ++i) {
+                    double x = -halfPi + 2.0 * halfPi * double(i) / double(numSteps);
+                    DoublePair y = FastMath::sin(DoublePair::set(x, -x));
+                    largestError = std::max(largestError, std::abs(y.first() - std::sin(x)));
+                    largestError = std::max(largestError, std::abs(y.second() - std::sin(-x)));
+                }
+                logMessage("largest error: " + juce::String(largestError));
+                expectLessOrEqual(largestError, 3.34e-9);
+            }
+
+            beginTest("reciprocal() has a relative error below 1e-13");
+            {
+                // Every power of two in the range, with random mantissas, so
+                // that the hardware estimate is tried with every exponent.
+                juce::Random random(12345);
+                double largestError = 0.0;
+                for (int exponent = -100; exponent <= 100; ++exponent) {
+                    for (int i = 0; i < 1000; ++i) {
+                        double x = std::ldexp(1.0 + random.nextDouble(), exponent);
+                        DoublePair r = FastMath::reciprocal(DoublePair::set(x, -x));
+                        largestError = std::max(largestError, std::abs(r.first() * x - 1.0));
+                        largestError = std::max(largestError, std::abs(r.second() * x + 1.0));
+                    }
+                }
+                logMessage("largest error: " + juce::String(largestError));
+                expectLessThan(largestError, 1.0e-13);
+            }
+
+            beginTest("ClipSoftly with Fast Math is within 3.2e-9 of the exact version");
+            {
+                const double sampleRates[] = { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0,
+                                               192000.0, 352800.0, 384000.0, 705600.0, 768000.0 };
+                double largestError = 0.0;
+                for (double sampleRate : sampleRates) {
+                    for (int signal = 0; signal < numSignals; ++signal) {
+                        double error = compareClipSoftly(sampleRate, signal);
+                        expectLessOrEqual(error, 3.2e-9, juce::String(signalNames[signal]) + " at "
+                                                         + juce::String(int(sampleRate)) + " Hz");
+                        largestError = std::max(largestError, error);
+                    }
+                }
+                logMessage("largest difference: " + juce::String(largestError));
+            }
+        }
+
+    private:
+        static constexpr int numSignals = 3;
+        static constexpr const char* signalNames[numSignals] = { "clipping sine", "noise", "rising sine" };
+
+        // Runs the same input through ClipSoftly with and without Fast Math,
+        // in blocks of 512 samples, and returns the largest difference.
+        static double compareClipSoftly(double sampleRate, int signal)
+        {
+            ClipSoftly::Kernel exact;
+            ClipSoftly::Kernel fast;
+            exact.prepare(sampleRate);
+            fast.prepare(sampleRate);
+            fast.fastMath = true;
+
+            // A quarter of a second of each signal:
+            // - a 1 kHz sine at +12 dBFS, which clips most of the time
+            // - white noise at +24 dBFS, the worst case for the clippers
+            // - a 1 kHz sine that gets louder from silence to +12 dBFS, so
+            //   that every level in between is tried
+            const int numSamples = int(sampleRate / 4.0);
+            const int blockSize = 512;
+            const double increment = 2.0 * 3.141592653589793 * 1000.0 / sampleRate;
+            juce::Random random(12345);
+
+            double inA[blockSize], inB[blockSize];
+            double exactA[blockSize], exactB[blockSize];
+            double fastA[blockSize], fastB[blockSize];
+            double largestError = 0.0;
+
+            for (int start = 0; start < numSamples; start += blockSize) {
+                int count = std::min(blockSize, numSamples - start);
+                for (int i = 0; i < count; ++i) {
+                    int n = start + i;
+                    if (signal == 0) {
+                        inA[i] = 4.0 * std::sin(n * increment);
+                        inB[i] = 4.0 * std::sin(n * increment + 0.25);
+                    } else if (signal == 1) {
+                        inA[i] = (random.nextDouble() * 2.0 - 1.0) * 15.848932;
+                        inB[i] = (random.nextDouble() * 2.0 - 1.0) * 15.848932;
+                    } else {
+                        double amplitude = 4.0 * double(n) / double(numSamples);
+                        inA[i] = amplitude * std::sin(n * increment);
+                        inB[i] = amplitude * std::sin(n * increment + 0.25);
+                    }
+                }
+
+                exact.process(inA, inB, exactA, exactB, count);
+                fast.process(inA, inB, fastA, fastB, count);
+
+                for (int i = 0; i < count; ++i) {
+                    largestError = std::max(largestError, std::abs(fastA[i] - exactA[i]));
+                    largestError = std::max(largestError, std::abs(fastB[i] - exactB[i]));
+                }
+            }
+            return largestError;
+        }
+    };
+
+    FastMathTests fastMathTests;
+}
@@ -0,0 +1,31 @@
+/*
+    Runs the unit tests for the code in Shared/. These check the promises that
+    the comments in that code make, such as the error bounds of Fast Math, so
+    that a change which breaks one of them doesn't go unnoticed.
+
+    Usage:
+        Tests
+
+    The tests themselves are in the other files in this folder, one file per
+    header that they test. JUCE finds them by itself, since every juce::UnitTest
+    registers itself when it is created. The program prints the result of
+    every test and exits with an error code if any of them failed, so it can
+    run as part of a CI job.
+*/
+
+#include <JuceHeader.h>
+
+int main(int argc, char* argv[])
+{
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("Shared");
+
+    int numFailures = 0;
+    for (int i = 0; i < runner.getNumResults(); ++i) {
+        numFailures += runner.getResult(i)->failures;
+    }
+
+    std::cout << "\n" << (numFailures == 0 ? "All tests passed" : juce::String(numFailures) + " failures") << "\n";
+    return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include <JuceHeader.h>
+#include <vector>
+#include "../../../Shared/ClipOnlyKernel.h"
+#include "../../../Shared/ClipOnly2Kernel.h"
+
+/*
+    Checks that the fast path of ClipOnly and ClipOnly2, which copies spans of
+    unclipped samples, gives exactly the same output as running every sample
+    through the clipper. Whether a sample takes the fast path depends on where
+    the block starts and how long it is, so if the two paths rounded
+    differently, the output would change with the host's block size.
+
+    The levels are 1.1 and 0.7, which are not exactly floats, so the gains
+    must be applied in double precision on both paths.
+*/
+namespace
+{
+    class UnclippedSpansTests : public juce::UnitTest
+    {
+    public:
+        UnclippedSpansTests() : juce::UnitTest("UnclippedSpans", "Shared") { }
+
+        void runTest() override
+        {
+            beginTest("ClipOnly gives the same float output for any block size");
+            checkBlockSizes<ClipOnly::Kernel, float>(44100.0);
+
+            beginTest("ClipOnly gives the same double output for any block size");
+            checkBlockSizes<ClipOnly::Kernel, double>(44100.0);
+
+            beginTest("ClipOnly2 gives the same float output for any block size");
+            checkBlockSizes<ClipOnly2::Kernel, float>(44100.0);
+            checkBlockSizes<ClipOnly2::Kernel, float>(96000.0);
+
+            beginTest("ClipOnly2 gives the same double output for any block size");
+            checkBlockSizes<ClipOnly2::Kernel, double>(44100.0);
+            checkBlockSizes<ClipOnly2::Kernel, double>(96000.0);
+        }
+
+    private:
+        template<typename Kernel, typename T>
+        void checkBlockSizes(double sampleRate)
+        {
+            constexpr int numSamples = 48000;
+            juce::Random random(4321);
+
+            // Noise that mostly stays below the clip level once the input
+            // level is applied, with louder bursts that clip, so that there
+            // are many spans of every length.
+            std::vector<T> inA(numSamples);
+            std::vector<T> inB(numSamples);
+            for (int i = 0; i < numSamples; ++i) {
+                double level = ((i / 3000) % 3 == 2) ? 1.5 : 0.7;
+                inA[i] = T(level * (random.nextDouble() * 2.0 - 1.0));
+                inB[i] = T(level * (random.nextDouble() * 2.0 - 1.0));
+            }
+
+            // The whole buffer in one block, which takes the fast path
+            // wherever it can.
+            std::vector<T> wholeA = inA;
+            std::vector<T> wholeB = inB;
+            Kernel whole = makeKernel<Kernel>(sampleRate);
+            whole.process(wholeA.data(), wholeB.data(), wholeA.data(), wholeB.data(), numSamples);
+
+            // One sample at a time, which never does.
+            std::vector<T> singleA = inA;
+            std::vector<T> singleB = inB;
+            Kernel single = makeKernel<Kernel>(sampleRate);
+            for (int i = 0; i < numSamples; ++i) {
+                single.process(&singleA[size_t(i)], &singleB[size_t(i)], &singleA[size_t(i)], &singleB[size_t(i)], 1);
+            }
+
+            // Random block sizes, as some hosts do it.
+            std::vector<T> randomA = inA;
+            std::vector<T> randomB = inB;
+            Kernel blocks = makeKernel<Kernel>(sampleRate);
+            for (int start = 0; start < numSamples; ) {
+                int count = std::min(numSamples - start, 1 + random.nextInt(300));
+                blocks.process(&randomA[size_t(start)], &randomB[size_t(start)],
+                               &randomA[size_t(start)], &randomB[size_t(start)], count);
+                start += count;
+            }
+
+            int numDifferent = 0;
+            for (int i = 0; i < numSamples; ++i) {
+                if (singleA[size_t(i)] != wholeA[size_t(i)] || singleB[size_t(i)] != wholeB[size_t(i)]) { ++numDifferent; }
+                if (randomA[size_t(i)] != wholeA[size_t(i)] || randomB[size_t(i)] != wholeB[size_t(i)]) { ++numDifferent; }
+            }
+            expectEquals(numDifferent, 0, "samples that depend on the block size at " + juce::String(sampleRate) + " Hz");
+        }
+
+        template<typename Kernel>
+        static Kernel makeKernel(double sampleRate)
+        {
+            Kernel kernel;
+            kernel.prepare(sampleRate);
+            kernel.inputLevel = 1.1;
+            kernel.outputLevel = 0.7;
+            return kernel;
+        }
+    };
+
+    UnclippedSpansTests unclippedSpansTests;
+}